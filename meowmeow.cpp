@@ -5,8 +5,47 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
 #include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+// Scene cache file mapping
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// SSE steering for the crowd simulation (scalar fallback elsewhere)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CROWD_SIMD 1
+#else
+#define CROWD_SIMD 0
+#endif
+
+#if defined(__linux__)
+// Headless benchmark runs go through EGL surfaceless (Mesa llvmpipe works without a GPU or X server).
+// Link with -lEGL on Linux.
+#define HAVE_EGL_HEADLESS 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // ---------------------- Constants & Helpers ----------------------
 
@@ -14,15 +53,408 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+// A triangle mesh on the GPU. Plain meshes are [x y z nx ny nz] float triangle lists;
+// shared meshes are welded and packed by uploadMesh() (layout in the fields below).
 struct MeshVBO {
     GLuint vbo = 0;
-    int vertexCount = 0; // number of vertices (not floats)
+    int vertexCount = 0;     // number of vertices (not floats); unique ones when indexed
+    GLuint ibo = 0;          // 0 = triangle list
+    int indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    GLenum positionType = GL_FLOAT;  // or GL_HALF_FLOAT
+    GLenum normalType = GL_FLOAT;    // or GL_INT_2_10_10_10_REV / GL_BYTE (normalized)
+    int stride = 6 * sizeof(float);
+    int normalOffset = 3 * sizeof(float);
+    size_t sourceBytes = 0;  // as a float triangle list, and as uploaded (bench report)
+    size_t uploadedBytes = 0;
+    float acmrBefore = 3.0f; // vertex cache misses per triangle without/with the optimization stage (bench report)
+    float acmrAfter = 3.0f;
+    int overdrawClusters = 0; // patches sorted outward-first by uploadMesh (0 = generated order kept)
+};
+
+// A range of the per-frame stream ring (see Streaming Buffers)
+struct StreamSlice {
+    GLuint buffer = 0;
+    size_t offset = 0;
+};
+
+// Vertices one draw of the mesh submits
+inline int meshDrawVertices(const MeshVBO& mesh) {
+    return mesh.ibo ? mesh.indexCount : mesh.vertexCount;
+}
+
+// Per-frame submission counters (reset at the start of displayCallback, reported by the benchmark)
+struct FrameStats {
+    int drawCalls = 0;
+    long long vertices = 0;
+    int objectsVisible = 0;   // after frustum and occlusion culling
+    int objectsCulled = 0;    // by the frustum
+    int objectsOccluded = 0;  // in the frustum but behind the pyramid
+    int lodObjects[4] = {};   // sphere-based objects drawn at each LOD level
+    int terrainChunks = 0;    // drawn / frustum-culled terrain chunks
+    int terrainChunksCulled = 0;
+    int crowdVisible = 0;     // crowd agents drawn
+    int shadowCascadesRendered = 0; // static shadow cascades re-rendered (0 while cached)
+    int shadowDynamicCasters = 0;   // crowd instances drawn into the shadow composite
+    int stateIssued = 0;      // GL state calls sent / dropped as redundant (see GL State Cache)
+    int stateElided = 0;
+    int queueItems = 0;       // render queue items, material binds, and items that needed no bind
+    int materialSwitches = 0;
+    int materialSwitchesSaved = 0;
+    double overdraw = 0.0;    // opaque samples per pixel (see submitRenderQueue)
+    size_t arenaPeak = 0;     // bytes of the frame arena ever used
+    int jobSteals = 0;        // worker pool ranges stolen while culling and building draw lists
+    long long streamBytes = 0; // written into the stream ring, and waits for a region's fence
+    int streamFenceWaits = 0;
+    double streamWaitMs = 0.0;
 };
+FrameStats frameStats;
+
+inline void countDraw(long long vertices) {
+    frameStats.drawCalls++;
+    frameStats.vertices += vertices;
+}
+
+// Byte color for vertex/instance attributes (R in the lowest byte)
+inline unsigned int packRGBA8(float r, float g, float b, float a) {
+    auto byte = [](float c) { return (unsigned int)(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f); };
+    return byte(r) | byte(g) << 8 | byte(b) << 16 | byte(a) << 24;
+}
+
+// El Castillo proportions shared by buildPyramidData, the temple details and the occluder of occlusion culling
+const int   PYRAMID_TERRACE_COUNT = 9;
+const float PYRAMID_BASE_HALF = 13.5f;
+const float PYRAMID_TERRACE_HEIGHT = 1.4f;
+const float PYRAMID_TERRACE_INSET = 1.2f;      // each terrace is this much smaller per side
+const float PYRAMID_TEMPLE_HALF = 3.5f;
+const float PYRAMID_TEMPLE_HALF_HEIGHT = 2.0f;
+const float PYRAMID_TEMPLE_RISE = 1.2f;        // temple center above the last terrace
+const float PYRAMID_TEMPLE_CENTER_Y = (PYRAMID_TERRACE_COUNT + 0.5f) * PYRAMID_TERRACE_HEIGHT + PYRAMID_TEMPLE_RISE;
 
 // Interleaved: [x y z nx ny nz] per vertex
-void createPyramidMesh(MeshVBO& mesh);
-void createGroundMesh(MeshVBO& mesh);
+void buildPyramidData(std::vector<float>& data);
 void drawMeshLit(const MeshVBO& mesh, float r, float g, float b);
+void uploadMesh(MeshVBO& mesh, const std::vector<float>& data, bool byteNormals = false);
+void uploadMesh(MeshVBO& mesh, const float* data, int vertexCount, bool byteNormals = false);
+void addBox(std::vector<float>& data,
+    float halfSizeX, float halfSizeY, float halfSizeZ,
+    float centerY, float centerZOffset);
+void addSphere(std::vector<float>& data, float radius, int slices, int stacks, float centerY);
+
+// ---------------------- GL State Cache ----------------------
+
+// Every capability switch, the bound program, the depth mask and test, the current color and
+// the material and light parameters go through here. The cache remembers what was last sent
+// and drops calls that would not change anything; frameStats counts issued and elided calls.
+// Two things change state behind its back and must tell it: glPushAttrib/glPopAttrib
+// (statePushEnables / statePopEnables) and color arrays (stateForgetColor).
+struct CachedCap {
+    GLenum cap;
+    signed char enabled;    // -1 = unknown
+};
+
+struct CachedParam {
+    GLenum target, pname;   // target: GL_FRONT_AND_BACK (material), GL_LIGHTi, 0 (light model)
+    GLfloat values[4];
+    bool known;
+};
+
+struct GLStateCache {
+    bool enabled = true;    // --no-state-cache: issue everything (still counted)
+    std::vector<CachedCap> caps;
+    std::vector<std::vector<CachedCap>> pushedCaps;
+    GLuint program = 0;
+    bool programKnown = false;
+    GLboolean depthMask = GL_TRUE;
+    bool depthMaskKnown = false;
+    GLenum depthFunc = GL_LESS;
+    bool depthFuncKnown = false;
+    GLfloat color[4] = {};
+    bool colorKnown = false;
+    std::vector<CachedParam> params;
+    float view[5] = {};     // camera pose the eye-space light parameters were sent under
+    bool viewKnown = false;
+};
+GLStateCache glState;
+
+// Counts the call either way; true when it can be skipped
+inline bool stateElide(bool unchanged) {
+    if (unchanged && glState.enabled) {
+        frameStats.stateElided++;
+        return true;
+    }
+    frameStats.stateIssued++;
+    return false;
+}
+
+signed char& stateCapSlot(GLenum cap) {
+    for (CachedCap& c : glState.caps) {
+        if (c.cap == cap) return c.enabled;
+    }
+    glState.caps.push_back({ cap, -1 });
+    return glState.caps.back().enabled;
+}
+
+CachedParam& stateParamSlot(GLenum target, GLenum pname) {
+    for (CachedParam& p : glState.params) {
+        if (p.target == target && p.pname == pname) return p;
+    }
+    glState.params.push_back({ target, pname, {}, false });
+    return glState.params.back();
+}
+
+void stateForgetParam(GLenum target, GLenum pname) {
+    stateParamSlot(target, pname).known = false;
+}
+
+inline bool stateIsEnabled(GLenum cap) {
+    return stateCapSlot(cap) == 1;
+}
+
+void stateSetEnabled(GLenum cap, bool on) {
+    signed char& enabled = stateCapSlot(cap);
+    if (stateElide(enabled == (signed char)on)) return;
+    enabled = (signed char)on;
+    if (on) glEnable(cap);
+    else    glDisable(cap);
+
+    // Material ambient and diffuse stop (or start) following the color
+    if (cap == GL_COLOR_MATERIAL) {
+        stateForgetParam(GL_FRONT_AND_BACK, GL_AMBIENT);
+        stateForgetParam(GL_FRONT_AND_BACK, GL_DIFFUSE);
+    }
+}
+
+inline void stateEnable(GLenum cap) { stateSetEnabled(cap, true); }
+inline void stateDisable(GLenum cap) { stateSetEnabled(cap, false); }
+
+// Mirrors glPushAttrib/glPopAttrib of GL_ENABLE_BIT: the popped switches are the pushed ones
+void statePushEnables() {
+    glState.pushedCaps.push_back(glState.caps);
+}
+
+void statePopEnables() {
+    glState.caps = glState.pushedCaps.back();
+    glState.pushedCaps.pop_back();
+}
+
+void stateUseProgram(GLuint program) {
+    if (stateElide(glState.programKnown && glState.program == program)) return;
+    glState.program = program;
+    glState.programKnown = true;
+    glUseProgram(program);
+}
+
+void stateDepthMask(GLboolean write) {
+    if (stateElide(glState.depthMaskKnown && glState.depthMask == write)) return;
+    glState.depthMask = write;
+    glState.depthMaskKnown = true;
+    glDepthMask(write);
+}
+
+void stateDepthFunc(GLenum func) {
+    if (stateElide(glState.depthFuncKnown && glState.depthFunc == func)) return;
+    glState.depthFunc = func;
+    glState.depthFuncKnown = true;
+    glDepthFunc(func);
+}
+
+// Also valid between glBegin and glEnd
+void stateColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f) {
+    const GLfloat color[4] = { r, g, b, a };
+    if (stateElide(glState.colorKnown && memcmp(glState.color, color, sizeof(color)) == 0)) return;
+    memcpy(glState.color, color, sizeof(color));
+    glState.colorKnown = true;
+    glColor4f(r, g, b, a);
+}
+
+// After drawing with a color array the current color is undefined
+void stateForgetColor() {
+    glState.colorKnown = false;
+}
+
+// Front and back material. With GL_COLOR_MATERIAL on (initGL sets GL_AMBIENT_AND_DIFFUSE)
+// ambient and diffuse follow the current color and the driver ignores them.
+void stateMaterial(GLenum pname, const GLfloat* values, int count) {
+    if ((pname == GL_AMBIENT || pname == GL_DIFFUSE) && stateIsEnabled(GL_COLOR_MATERIAL)) {
+        stateElide(true);
+        return;
+    }
+    CachedParam& p = stateParamSlot(GL_FRONT_AND_BACK, pname);
+    if (stateElide(p.known && memcmp(p.values, values, count * sizeof(GLfloat)) == 0)) return;
+    memcpy(p.values, values, count * sizeof(GLfloat));
+    p.known = true;
+    if (count == 1) glMaterialf(GL_FRONT_AND_BACK, pname, values[0]);
+    else            glMaterialfv(GL_FRONT_AND_BACK, pname, values);
+}
+
+// GL_POSITION and GL_SPOT_DIRECTION are stored in eye space by the driver, so they are only
+// redundant while the camera (stateSetView) has not moved either
+void stateLight(GLenum light, GLenum pname, const GLfloat* values, int count) {
+    CachedParam& p = stateParamSlot(light, pname);
+    if (stateElide(p.known && memcmp(p.values, values, count * sizeof(GLfloat)) == 0)) return;
+    memcpy(p.values, values, count * sizeof(GLfloat));
+    p.known = true;
+    if (count == 1) glLightf(light, pname, values[0]);
+    else            glLightfv(light, pname, values);
+}
+
+void stateLightModel(GLenum pname, const GLfloat* values) {
+    CachedParam& p = stateParamSlot(0, pname);
+    if (stateElide(p.known && memcmp(p.values, values, 4 * sizeof(GLfloat)) == 0)) return;
+    memcpy(p.values, values, 4 * sizeof(GLfloat));
+    p.known = true;
+    glLightModelfv(pname, values);
+}
+
+// Called with the modelview about to hold the camera's view (applyCamera)
+void stateSetView(float x, float y, float z, float yaw, float pitch) {
+    const float view[5] = { x, y, z, yaw, pitch };
+    if (glState.viewKnown && memcmp(glState.view, view, sizeof(view)) == 0) return;
+    memcpy(glState.view, view, sizeof(view));
+    glState.viewKnown = true;
+    for (CachedParam& p : glState.params) {
+        if (p.pname == GL_POSITION || p.pname == GL_SPOT_DIRECTION) p.known = false;
+    }
+}
+
+// ---------------------- Streaming Buffers ----------------------
+
+// Everything rebuilt every frame (the vegetation, terrain chunk and crowd instance lists,
+// the shadow casters) is written into one ring buffer of STREAM_FRAMES regions: a frame
+// fills its own region while the GPU may still be reading the previous two. With GL 4.4
+// or ARB_buffer_storage the ring is mapped once, persistent and coherent, and an upload
+// is a memcpy; otherwise each upload maps its range unsynchronized. Either way, moving to
+// the next frame fences the region just written, and a region is only rewritten once the
+// GPU has passed its fence (a wait for it is counted). A frame that outgrows its region
+// doubles the ring; the old buffer is deleted at the start of the next frame.
+
+const int    STREAM_FRAMES = 3;
+const size_t STREAM_REGION_BYTES = 1 << 20; // initial size of one region
+const size_t STREAM_ALIGNMENT = 256;        // of every upload
+
+struct StreamRing {
+    bool persistentEnabled = true; // --no-persistent-map: map each upload instead
+    bool persistent = false;
+    bool fenced = false;           // GL 3.2 / ARB_sync
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t regionBytes = 0;
+    int region = 0;
+    size_t head = 0;               // bytes used in the current region
+    GLsync fences[STREAM_FRAMES] = {};
+    std::vector<GLuint> retired;   // outgrown buffers, still read by this frame's draws
+    int grows = 0;
+};
+StreamRing streamRing;
+
+void createStreamBuffer(size_t regionBytes) {
+    StreamRing& ring = streamRing;
+    ring.regionBytes = regionBytes;
+    ring.persistent = ring.persistentEnabled && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+    ring.fenced = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+    ring.region = 0;
+    ring.head = 0;
+
+    const size_t total = regionBytes * STREAM_FRAMES;
+    glGenBuffers(1, &ring.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, ring.buffer);
+    if (ring.persistent) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, total, nullptr, flags);
+        ring.mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, total, flags);
+        if (!ring.mapped) {
+            // Storage is immutable: start over with a plain buffer
+            glDeleteBuffers(1, &ring.buffer);
+            glGenBuffers(1, &ring.buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, ring.buffer);
+            ring.persistent = false;
+        }
+    }
+    if (!ring.persistent) glBufferData(GL_ARRAY_BUFFER, total, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void growStreamRing(size_t bytes) {
+    StreamRing& ring = streamRing;
+    if (ring.mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, ring.buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        ring.mapped = nullptr;
+    }
+    ring.retired.push_back(ring.buffer);
+    for (GLsync& fence : ring.fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    size_t regionBytes = ring.regionBytes * 2;
+    while (regionBytes < bytes) regionBytes *= 2;
+    createStreamBuffer(regionBytes);
+    ring.grows++;
+}
+
+// Copies bytes into the current frame's region; the slice stays valid until the frame ends
+StreamSlice streamUpload(const void* data, size_t bytes) {
+    StreamRing& ring = streamRing;
+    if (!ring.buffer) createStreamBuffer(STREAM_REGION_BYTES);
+
+    size_t offset = (ring.head + STREAM_ALIGNMENT - 1) & ~(STREAM_ALIGNMENT - 1);
+    if (offset + bytes > ring.regionBytes) {
+        growStreamRing(bytes);
+        offset = 0;
+    }
+    size_t at = (size_t)ring.region * ring.regionBytes + offset;
+    ring.head = offset + bytes;
+
+    if (ring.persistent) {
+        memcpy(ring.mapped + at, data, bytes);
+    }
+    else if (bytes > 0) {
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | (ring.fenced ? GL_MAP_UNSYNCHRONIZED_BIT : 0);
+        glBindBuffer(GL_ARRAY_BUFFER, ring.buffer);
+        void* target = glMapBufferRange(GL_ARRAY_BUFFER, at, bytes, access);
+        if (target) {
+            memcpy(target, data, bytes);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    frameStats.streamBytes += (long long)bytes;
+    return { ring.buffer, at };
+}
+
+// Start of a frame: fence the region the last frame wrote, move to the next one and wait
+// until the GPU is done with what was written there STREAM_FRAMES frames ago
+void streamBeginFrame() {
+    StreamRing& ring = streamRing;
+    if (!ring.retired.empty()) {
+        glDeleteBuffers((GLsizei)ring.retired.size(), ring.retired.data());
+        ring.retired.clear();
+    }
+    if (!ring.buffer) return;
+
+    if (ring.fenced && ring.head > 0) {
+        GLsync& written = ring.fences[ring.region];
+        if (written) glDeleteSync(written);
+        written = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    ring.region = (ring.region + 1) % STREAM_FRAMES;
+    ring.head = 0;
+
+    GLsync& fence = ring.fences[ring.region];
+    if (!fence) return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        frameStats.streamFenceWaits++;
+        auto start = std::chrono::steady_clock::now();
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+        frameStats.streamWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
 
 // ---------------------- Camera System ----------------------
 
@@ -37,6 +469,7 @@ struct Camera {
 void applyCamera() {
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
+    stateSetView(camera.x, camera.y, camera.z, camera.yaw, camera.pitch);
 
     float yawRad = camera.yaw * (float)M_PI / 180.0f;
     float pitchRad = camera.pitch * (float)M_PI / 180.0f;
@@ -52,8 +485,8 @@ void applyCamera() {
     );
 }
 
-void moveCamera(float forward, float right, float up) {
-    float yawRad = camera.yaw * (float)M_PI / 180.0f;
+void moveCamera(Camera& cam, float forward, float right, float up) {
+    float yawRad = cam.yaw * (float)M_PI / 180.0f;
 
     // Forward direction on XZ plane
     float fx = sinf(yawRad);
@@ -63,9 +496,9 @@ void moveCamera(float forward, float right, float up) {
     float rx = cosf(yawRad);
     float rz = sinf(yawRad);
 
-    camera.x += fx * forward + rx * right;
-    camera.z += fz * forward + rz * right;
-    camera.y += up;
+    cam.x += fx * forward + rx * right;
+    cam.z += fz * forward + rz * right;
+    cam.y += up;
 }
 
 // ---------------------- Scene Management ----------------------
@@ -73,34 +506,84 @@ void moveCamera(float forward, float right, float up) {
 enum SceneType { ANCIENT_SCENE = 0, MODERN_SCENE = 1 };
 SceneType currentScene = ANCIENT_SCENE;
 
-// Animation globals
+// Animation globals: render-time values, interpolated from the simulation (see Frame Loop)
 float timeSeconds = 0.0f;
-float cloudOffset = 0.0f;
-float touristBounce = 0.0f;
+float simAlpha = 1.0f;  // position between the last two simulation steps
+// Clock time of the frame being drawn, latched by displayCallback() (or set by a replay, see
+// Session Recording); per-frame logic reads it rather than the clock
+std::chrono::steady_clock::time_point frameTime;
 bool fogEnabled = true;
 bool showHelp = true;   // toggle for showing/hiding the controls overlay meowmeow
 
-// Forward declarations for drawing helpers: clouds, stairs, ground, template, fallen tree (ancient scene)
-void drawClouds(SceneType scene);
-void drawStairs();
-void drawGround(SceneType scene);
-void drawTempleDetails(SceneType scene);
-void drawFallenTree(float x, float z, float length, float angleDegrees);
+// Window / render target size, tracked in reshapeCallback (avoids glutGet in the HUD)
+int windowWidth = 1980;
+int windowHeight = 1080;
+
+// Projection clip planes (reshapeCallback and the frustum culler must agree)
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 1000.0f;
 
-// Meshes, the one for the pyramid and for the ground
+bool cullingEnabled = true; // 'C' toggles, to compare against drawing everything
+
+// True when rendering through an offscreen EGL context: there is no GLUT window,
+// so nothing may call glutSwapBuffers, glutBitmapCharacter or glutSolid*
+bool headlessMode = false;
+
+// Forward declarations for render queue emitters: clouds, terrain, static (baked) scene geometry
+void queueClouds(SceneType scene);
+void queueTerrain(SceneType scene);
+void queueStaticBatches(SceneType scene);
+
+// Pyramid mesh (the ground is the heightfield terrain, see Terrain)
 MeshVBO pyramidMesh;
-MeshVBO groundMesh;
+
+// Instanced vegetation: shared trunk/canopy meshes + one instance buffer per forest
+// (the jungle's rocks go through the same path with their own mesh and buffer).
+// Per-instance data is [x y z scale r g b a] (position, uniform scale, canopy color).
+struct TreeInstance {
+    float x, y, z, scale;
+    float r, g, b, a;
+};
+
+struct VegetationBatch {
+    StreamSlice instances;               // this frame's visible instances in the stream ring
+    int instanceCount = 0;
+    std::vector<TreeInstance> visibleScratch;
+    int lodFirst[4] = {};                // visible instances per canopy LOD level
+    int lodCount[4] = {};
+    float lodNearest[4] = {};            // camera distance of the nearest one (sort depth)
+    std::vector<int> blockOffsets;       // per block and LOD: count, then write position
+    std::vector<float> blockNearest;
+};
+
+MeshVBO treeTrunkMesh;
+MeshVBO treeCanopyLods[4]; // one per sphere LOD level (see Level of Detail)
+VegetationBatch ancientForest;
+VegetationBatch modernTrees;
+MeshVBO rockLods[4];       // squashed unit spheres, one per LOD level
+VegetationBatch jungleRocks;
+GLuint vegetationProgram = 0;
 
 // ---------------------- Lights ----------------------
 
+// Moon (ancient) and sun (modern); the shadow maps look along the same directions
+const GLfloat moonPosition[] = { 30.0f, 40.0f, 10.0f, 1.0f };
+const GLfloat sunPosition[] = { 0.0f, 60.0f, 30.0f, 1.0f };
+
+// Unit vector from the pyramid toward the scene's main light
+void sceneLightDirection(SceneType scene, float dir[3]) {
+    const GLfloat* p = (scene == ANCIENT_SCENE) ? moonPosition : sunPosition;
+    float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+    dir[0] = p[0] / len; dir[1] = p[1] / len; dir[2] = p[2] / len;
+}
+
+// Sets all lights each frame; the state cache drops what did not change since the last one
 void setupLights(SceneType scene) {
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_LIGHT1);
+    stateEnable(GL_LIGHTING);
+    stateEnable(GL_LIGHT0);
 
-    // Reset all lights each frame
     GLfloat globalAmbient[] = { 0.08f, 0.08f, 0.08f, 1.0f };
-    glLightModelfv(GL_LIGHT_MODEL_AMBIENT, globalAmbient);
+    stateLightModel(GL_LIGHT_MODEL_AMBIENT, globalAmbient);
 
     // Common camera direction (for headlight)
     float yawRad = camera.yaw * (float)M_PI / 180.0f;
@@ -114,780 +597,5763 @@ void setupLights(SceneType scene) {
         GLfloat ambient0[] = { 0.03f, 0.03f, 0.10f, 1.0f };
         GLfloat diffuse0[] = { 0.15f, 0.15f, 0.35f, 1.0f };
         GLfloat specular0[] = { 0.15f, 0.15f, 0.35f, 1.0f };
-        GLfloat position0[] = { 30.0f, 40.0f, 10.0f, 1.0f };
 
-        glLightfv(GL_LIGHT0, GL_AMBIENT, ambient0);
-        glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse0);
-        glLightfv(GL_LIGHT0, GL_SPECULAR, specular0);
-        glLightfv(GL_LIGHT0, GL_POSITION, position0);
+        stateLight(GL_LIGHT0, GL_AMBIENT, ambient0, 4);
+        stateLight(GL_LIGHT0, GL_DIFFUSE, diffuse0, 4);
+        stateLight(GL_LIGHT0, GL_SPECULAR, specular0, 4);
+        stateLight(GL_LIGHT0, GL_POSITION, moonPosition, 4);
 
         // Headlight attached to camera (LIGHT1)
+        stateEnable(GL_LIGHT1);
         GLfloat ambient1[] = { 0.0f, 0.0f, 0.0f, 1.0f };
         GLfloat diffuse1[] = { 0.9f, 0.9f, 0.8f, 1.0f };
         GLfloat specular1[] = { 1.0f, 1.0f, 1.0f, 1.0f };
         GLfloat position1[] = { camera.x, camera.y, camera.z, 1.0f };
         GLfloat spotDir[] = { dirX, dirY, dirZ };
 
-        glLightfv(GL_LIGHT1, GL_AMBIENT, ambient1);
-        glLightfv(GL_LIGHT1, GL_DIFFUSE, diffuse1);
-        glLightfv(GL_LIGHT1, GL_SPECULAR, specular1);
-        glLightfv(GL_LIGHT1, GL_POSITION, position1);
+        stateLight(GL_LIGHT1, GL_AMBIENT, ambient1, 4);
+        stateLight(GL_LIGHT1, GL_DIFFUSE, diffuse1, 4);
+        stateLight(GL_LIGHT1, GL_SPECULAR, specular1, 4);
+        stateLight(GL_LIGHT1, GL_POSITION, position1, 4);
 
-        glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, spotDir);
-        glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 30.0f); // narrow beam
-        glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 10.0f);
+        stateLight(GL_LIGHT1, GL_SPOT_DIRECTION, spotDir, 3);
+        const GLfloat cutoff = 30.0f, exponent = 10.0f; // narrow beam
+        stateLight(GL_LIGHT1, GL_SPOT_CUTOFF, &cutoff, 1);
+        stateLight(GL_LIGHT1, GL_SPOT_EXPONENT, &exponent, 1);
     }
     else {
         // Bright sun (LIGHT0)
         GLfloat ambient0[] = { 0.30f, 0.30f, 0.30f, 1.0f };
         GLfloat diffuse0[] = { 0.95f, 0.95f, 0.88f, 1.0f };
         GLfloat specular0[] = { 0.60f, 0.60f, 0.55f, 1.0f };
-        GLfloat position0[] = { 0.0f, 60.0f, 30.0f, 1.0f };
 
-        glLightfv(GL_LIGHT0, GL_AMBIENT, ambient0);
-        glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse0);
-        glLightfv(GL_LIGHT0, GL_SPECULAR, specular0);
-        glLightfv(GL_LIGHT0, GL_POSITION, position0);
+        stateLight(GL_LIGHT0, GL_AMBIENT, ambient0, 4);
+        stateLight(GL_LIGHT0, GL_DIFFUSE, diffuse0, 4);
+        stateLight(GL_LIGHT0, GL_SPECULAR, specular0, 4);
+        stateLight(GL_LIGHT0, GL_POSITION, sunPosition, 4);
 
-        glDisable(GL_LIGHT1); // No headlight in modern scene
+        stateDisable(GL_LIGHT1); // No headlight in modern scene
     }
 }
 
-// ---------------------- Drawing Helpers ----------------------
-
-void drawSkybox(SceneType scene) {
-    glDisable(GL_LIGHTING);
-    glDepthMask(GL_FALSE);
-
-    if (scene == ANCIENT_SCENE) {
-        glClearColor(0.02f, 0.02f, 0.08f, 1.0f); // dark night
-    }
-    else {
-        glClearColor(0.6f, 0.8f, 1.0f, 1.0f); // bright day
+// ---------------------- Shaders ----------------------
+
+// Generic attribute slots shared by every program (bound before linking)
+enum AttribSlot { ATTRIB_POSITION = 0, ATTRIB_NORMAL = 1, ATTRIB_INSTANCE = 2, ATTRIB_COLOR = 3 };
+
+// `library` is appended after the main source (functions it defines are declared there)
+GLuint compileShader(GLenum type, const char* source, const char* library = nullptr) {
+    GLuint shader = glCreateShader(type);
+    const char* sources[2] = { source, library };
+    glShaderSource(shader, library ? 2 : 1, sources, nullptr);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "Shader compile error:\n" << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
     }
+    return shader;
+}
 
-    // Simple large cube as sky
-    float size = 500.0f;
-    glPushMatrix();
-    glTranslatef(camera.x, camera.y, camera.z);
-    glBegin(GL_QUADS);
-    if (scene == ANCIENT_SCENE) glColor3f(0.02f, 0.02f, 0.08f);
-    else                        glColor3f(0.6f, 0.8f, 1.0f);
-
-    // +Z
-    glVertex3f(-size, -size, size);
-    glVertex3f(size, -size, size);
-    glVertex3f(size, size, size);
-    glVertex3f(-size, size, size);
-    // -Z
-    glVertex3f(-size, -size, -size);
-    glVertex3f(-size, size, -size);
-    glVertex3f(size, size, -size);
-    glVertex3f(size, -size, -size);
-    // +X
-    glVertex3f(size, -size, -size);
-    glVertex3f(size, size, -size);
-    glVertex3f(size, size, size);
-    glVertex3f(size, -size, size);
-    // -X
-    glVertex3f(-size, -size, -size);
-    glVertex3f(-size, -size, size);
-    glVertex3f(-size, size, size);
-    glVertex3f(-size, size, -size);
-    // +Y
-    glVertex3f(-size, size, -size);
-    glVertex3f(-size, size, size);
-    glVertex3f(size, size, size);
-    glVertex3f(size, size, -size);
-    glEnd();
-    glPopMatrix();
-
-    glDepthMask(GL_TRUE);
-    glEnable(GL_LIGHTING);
+GLuint createProgram(const char* vertexSource, const char* fragmentSource, const char* fragmentLibrary = nullptr) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource, fragmentLibrary);
+    if (!vs || !fs) return 0;
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glBindAttribLocation(program, ATTRIB_POSITION, "a_position");
+    glBindAttribLocation(program, ATTRIB_NORMAL, "a_normal");
+    glBindAttribLocation(program, ATTRIB_INSTANCE, "a_instance");
+    glBindAttribLocation(program, ATTRIB_COLOR, "a_color");
+    // Terrain names for the same slots (see Terrain)
+    glBindAttribLocation(program, ATTRIB_POSITION, "a_grid");
+    glBindAttribLocation(program, ATTRIB_INSTANCE, "a_chunk");
+    glBindAttribLocation(program, ATTRIB_COLOR, "a_seams");
+    // Cloud puff offset (see queueClouds)
+    glBindAttribLocation(program, ATTRIB_COLOR, "a_offset");
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "Program link error:\n" << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
 }
 
-void drawMeshLit(const MeshVBO& mesh, float r, float g, float b) {
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_NORMAL_ARRAY);
+// Unlit, fogged instanced geometry (matches the glColor + GL_FOG look of the old trees).
+// a_instance = [x y z scale], a_color = per-instance tint used when u_instanceColor = 1.
+const char* vegetationVertexSrc = R"(
+#version 120
+attribute vec3 a_position;
+attribute vec3 a_normal;
+attribute vec4 a_instance;
+attribute vec4 a_color;
+uniform vec3 u_color;
+uniform float u_instanceColor;
+varying vec3 v_color;
+varying vec3 v_world;
+varying float v_fogDepth;
+void main() {
+    vec4 world = vec4(a_instance.xyz + a_position * a_instance.w, 1.0);
+    vec4 eye = gl_ModelViewMatrix * world;
+    v_color = mix(u_color, a_color.rgb, u_instanceColor);
+    v_world = world.xyz;
+    v_fogDepth = abs(eye.z);
+    gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+const char* vegetationFragmentSrc = R"(
+#version 120
+uniform float u_fog;
+varying vec3 v_color;
+varying vec3 v_world;
+varying float v_fogDepth;
+float shadowFactor(vec3 world);
+void main() {
+    // Same falloff as glFogi(GL_FOG_MODE, GL_EXP2)
+    float f = exp(-pow(gl_Fog.density * v_fogDepth, 2.0));
+    f = mix(1.0, clamp(f, 0.0, 1.0), u_fog);
+    gl_FragColor = vec4(mix(gl_Fog.color.rgb, v_color * shadowFactor(v_world), f), 1.0);
+}
+)";
+
+// Linked into every fragment shader that receives shadows (see Shadows). The cascades are
+// tiles of one depth atlas; u_shadowMatrix maps world space into a tile's [0, 1] cube and
+// the first cascade whose tile contains the point answers. Hardware 2x2 PCF (GL_LINEAR on
+// a compare texture) softens the edges.
+const char* shadowReceiverSrc = R"(
+uniform sampler2DShadow u_shadowMap;
+uniform mat4 u_shadowMatrix[3];
+uniform float u_shadowStrength;    // 0 = not shadowed at all
+uniform vec3 u_shadowOffset;       // toward the light, keeps coarse casters off their own surface
+float shadowFactor(vec3 world) {
+    if (u_shadowStrength <= 0.0) return 1.0;
+    for (int i = 0; i < 3; ++i) {
+        vec3 p = (u_shadowMatrix[i] * vec4(world + u_shadowOffset, 1.0)).xyz;
+        if (p.x > 0.001 && p.x < 0.999 && p.y > 0.001 && p.y < 0.999 && p.z < 1.0) {
+            float lit = shadow2D(u_shadowMap, vec3((p.x + float(i)) / 3.0, p.y, p.z)).r;
+            return 1.0 - u_shadowStrength * (1.0 - lit);
+        }
+    }
+    return 1.0;
+}
+)";
 
-    GLsizei stride = 6 * sizeof(GLfloat);
-    glVertexPointer(3, GL_FLOAT, stride, (void*)0);
-    glNormalPointer(GL_FLOAT, stride, (void*)(3 * sizeof(GLfloat)));
+// Binds the frame's shadow atlas to texture unit 1 and sets the receiver uniforms of
+// `program` (strength 0 while shadows are off or when `receive` is false). Lookups move
+// `lightOffset` world units toward the light first.
+void bindShadowReceiver(GLuint program, bool receive, float lightOffset = 0.0f);
 
-    GLfloat materialDiffuse[] = { r, g, b, 1.0f };
-    GLfloat materialAmbient[] = { r * 0.3f, g * 0.3f, b * 0.3f, 1.0f };
-    GLfloat materialSpec[] = { 0.35f, 0.35f, 0.35f, 1.0f };
+// ---------------------- Scene Instances ----------------------
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, materialAmbient);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, materialDiffuse);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, materialSpec);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 25.0f);
+// Every placed object of a scene (pyramid, staircases, trees, rocks, tourists, ...) lives in
+// one structure-of-arrays store, filled once by buildSceneInstances(). Objects of one kind
+// are contiguous ([kindBegin, kindEnd)), so culling, LOD selection and submission are
+// linear loops over a few tightly packed arrays instead of trig and matrix-stack work
+// inside the draw functions. Baked objects read their placement from here too.
 
-    glDrawArrays(GL_TRIANGLES, 0, mesh.vertexCount);
+enum ObjectKind {
+    OBJ_PYRAMID, OBJ_TEMPLE, OBJ_STAIRCASE, OBJ_TREE, OBJ_ROCK, OBJ_PATCH, OBJ_FALLEN_TREE,
+    OBJ_KIND_COUNT
+};
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
+struct GridCell {
+    float minX, minY, minZ; // union of the contained objects' bounds
+    float maxX, maxY, maxZ;
+    bool occupied;
+};
 
-// Big visible ground
-void drawGround(SceneType scene) {
-    glDisable(GL_LIGHTING);
-    glPushMatrix();
-    glTranslatef(0.0f, -1.0f, 0.0f);
-    glScalef(200.0f, 1.0f, 200.0f);
+struct InstanceStore {
+    // Placement
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<float> yaw;             // degrees around +Y
+    std::vector<float> colorR, colorG, colorB;
+    std::vector<unsigned char> kind;
+    int kindBegin[OBJ_KIND_COUNT] = {};
+    int kindEnd[OBJ_KIND_COUNT] = {};
+
+    // Bounding spheres: analytic for instanced kinds, measured while baking for static ones
+    std::vector<float> boundX, boundY, boundZ, boundRadius;
+    std::vector<unsigned short> cell;   // grid cell of the bound center
+    std::vector<GridCell> cells;
+
+    // Per frame (refreshed by cullScene)
+    std::vector<unsigned char> visible;
+    std::vector<unsigned char> lod;     // sticky between frames (hysteresis)
+    std::vector<unsigned char> cellState;
+
+    int size() const { return (int)kind.size(); }
+};
 
-    if (scene == ANCIENT_SCENE)
-        glColor3f(0.27f, 0.20f, 0.12f); // earth
-    else
-        glColor3f(0.33f, 0.78f, 0.30f); // grass
+InstanceStore sceneInstances[2]; // indexed by SceneType
 
-    glutSolidCube(1.0f);
-    glPopMatrix();
-    glEnable(GL_LIGHTING);
+// Objects must be added grouped by kind (each kind's range stays contiguous)
+int addInstance(InstanceStore& store, ObjectKind kind, float x, float y, float z,
+    float sx, float sy, float sz, float yawDegrees, float r, float g, float b)
+{
+    int id = store.size();
+    if (store.kindEnd[kind] == store.kindBegin[kind]) store.kindBegin[kind] = id;
+    store.kindEnd[kind] = id + 1;
+
+    store.posX.push_back(x); store.posY.push_back(y); store.posZ.push_back(z);
+    store.scaleX.push_back(sx); store.scaleY.push_back(sy); store.scaleZ.push_back(sz);
+    store.yaw.push_back(yawDegrees);
+    store.colorR.push_back(r); store.colorG.push_back(g); store.colorB.push_back(b);
+    store.kind.push_back((unsigned char)kind);
+
+    store.boundX.push_back(x); store.boundY.push_back(y); store.boundZ.push_back(z);
+    store.boundRadius.push_back(0.0f);
+    store.cell.push_back(0);
+    store.visible.push_back(1);
+    store.lod.push_back(0);
+    return id;
 }
 
-// Simple tree: trunk (box) + canopy (scaled sphere-ish), basically rectangular prism + sphere
-void drawTree(float x, float z, float scale, SceneType scene) {
-    glPushMatrix();
-    glTranslatef(x, 0.0f, z);
-    glScalef(scale, scale, scale);
-
-    glDisable(GL_LIGHTING);
-    // Trunk
-    glColor3f(0.35f, 0.2f, 0.1f);
-    glPushMatrix();
-    glTranslatef(0.0f, 2.0f, 0.0f);
-    glScalef(0.5f, 4.0f, 0.5f);
-    glutSolidCube(1.0);
-    glPopMatrix();
-
-    // Canopy
-    if (scene == ANCIENT_SCENE) glColor3f(0.05f, 0.25f, 0.05f);
-    else                        glColor3f(0.1f, 0.5f, 0.1f);
-
-    glPushMatrix();
-    glTranslatef(0.0f, 5.0f, 0.0f);
-    glScalef(2.5f, 2.5f, 2.5f);
-    glutSolidSphere(1.0, 12, 12);
-    glPopMatrix();
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
+void setInstanceBounds(InstanceStore& store, int id, float x, float y, float z, float radius) {
+    store.boundX[id] = x;
+    store.boundY[id] = y;
+    store.boundZ[id] = z;
+    store.boundRadius[id] = radius;
 }
 
-// Simple tourist as a capsule-like figure, another combination of scaled cubes and spheres
-void drawTourist(float x, float z) {
-    glPushMatrix();
-    glTranslatef(x, 0.0f + touristBounce, z);
+inline bool objectVisible(SceneType scene, int id) {
+    return id < 0 || sceneInstances[scene].visible[id] != 0;
+}
 
-    glDisable(GL_LIGHTING);
-    // Body
-    glColor3f(0.2f, 0.4f, 0.8f);
-    glPushMatrix();
-    glTranslatef(0.0f, 1.0f, 0.0f);
-    glScalef(0.7f, 1.5f, 0.4f);
-    glutSolidCube(1.0);
-    glPopMatrix();
+// ---------------------- Worker Pool ----------------------
+
+// Persistent workers behind parallelFor. Generation passes could afford a thread spawn
+// per call, the per-frame passes (culling, draw lists, the crowd's steps) can't. Each
+// job's indices are dealt out as one contiguous range per thread; a thread takes indices
+// from the front of its own range and, once that is empty, steals the back half of the
+// fullest-looking other range, so uneven work (cells full of objects next to empty ones)
+// still finishes together. The calling thread works too, and a parallelFor issued from
+// inside a job simply runs inline.
+class WorkerPool {
+public:
+    explicit WorkerPool(int workerCount) : ranges(workerCount + 1) {
+        for (int i = 0; i < workerCount; ++i) threads.emplace_back([this, i]() { workerLoop(i + 1); });
+    }
 
-    // Head
-    glColor3f(1.0f, 0.8f, 0.6f);
-    glPushMatrix();
-    glTranslatef(0.0f, 2.1f, 0.0f);
-    glutSolidSphere(0.35, 10, 10);
-    glPopMatrix();
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
-}
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) t.join();
+    }
 
-// Clouds
-void drawClouds(SceneType scene) {
-    glDisable(GL_LIGHTING);
+    int threadCount() const { return (int)threads.size() + 1; }
+    int steals() const { return stealCount.load(std::memory_order_relaxed); } // since start
 
-    // Cloud color per scene
-    if (scene == ANCIENT_SCENE)
-        glColor3f(0.5f, 0.5f, 0.6f);   // darker, stormy-ish
-    else
-        glColor3f(0.98f, 0.98f, 0.99f); // bright white
+    void run(int count, const std::function<void(int)>& fn) {
+        if (threads.empty() || count <= 1 || insideJob) {
+            for (int i = 0; i < count; ++i) fn(i);
+            return;
+        }
 
-    // Make a ring of cloud clusters above the scene, slowly moving
-    float baseRadius = 60.0f;
-    float baseHeight = 30.0f;
+        const int slots = (int)ranges.size();
+        for (int t = 0; t < slots; ++t) {
+            unsigned begin = (unsigned)((long long)count * t / slots);
+            unsigned end = (unsigned)((long long)count * (t + 1) / slots);
+            ranges[t].packed.store(packRange(begin, end), std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            busy = (int)threads.size();
+            ++generation;
+        }
+        wake.notify_all();
 
-    for (int i = 0; i < 8; ++i) {
-        float angle = (float)i * (2.0f * (float)M_PI / 8.0f)
-            + cloudOffset * 0.01f; // slow drift
+        insideJob = true;
+        work(0, fn);
+        insideJob = false;
 
-        float cx = cosf(angle) * baseRadius;
-        float cz = sinf(angle) * baseRadius;
-        float cy = baseHeight + (i % 2) * 3.0f;
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        job = nullptr;
+    }
 
-        glPushMatrix();
-        glTranslatef(cx, cy, cz);
+private:
+    // [begin, end) of one thread's indices, packed so the owner and thieves can race on one CAS
+    struct alignas(64) RangeSlot {
+        std::atomic<unsigned long long> packed{ 0 };
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<RangeSlot> ranges; // [0] is the calling thread's
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* job = nullptr;
+    int busy = 0;                 // workers that haven't finished the current job
+    unsigned generation = 0;
+    bool stopping = false;
+    std::atomic<int> stealCount{ 0 };
+    static thread_local bool insideJob;
+
+    static unsigned long long packRange(unsigned begin, unsigned end) { return (unsigned long long)begin << 32 | end; }
+    static unsigned rangeBegin(unsigned long long packed) { return (unsigned)(packed >> 32); }
+    static unsigned rangeEnd(unsigned long long packed) { return (unsigned)packed; }
+
+    // Front index of the thread's own range
+    bool popFront(int self, int& index) {
+        std::atomic<unsigned long long>& slot = ranges[self].packed;
+        unsigned long long packed = slot.load(std::memory_order_acquire);
+        for (;;) {
+            unsigned begin = rangeBegin(packed), end = rangeEnd(packed);
+            if (begin >= end) return false;
+            if (slot.compare_exchange_weak(packed, packRange(begin + 1, end), std::memory_order_acq_rel)) {
+                index = (int)begin;
+                return true;
+            }
+        }
+    }
 
-        // Each cluster: 3–4 overlapping spheres
-        glutSolidSphere(4.0, 12, 12);
-        glTranslatef(3.0f, 1.0f, 1.5f);
-        glutSolidSphere(3.0, 12, 12);
-        glTranslatef(-4.0f, 0.0f, -2.0f);
-        glutSolidSphere(3.5, 12, 12);
-        glPopMatrix();
+    // Moves the back half of the largest other range into the thread's own (empty) range
+    bool steal(int self) {
+        for (;;) {
+            int victim = -1;
+            unsigned most = 0;
+            for (int t = 0; t < (int)ranges.size(); ++t) {
+                if (t == self) continue;
+                unsigned long long packed = ranges[t].packed.load(std::memory_order_relaxed);
+                unsigned left = rangeEnd(packed) > rangeBegin(packed) ? rangeEnd(packed) - rangeBegin(packed) : 0;
+                if (left > most) { most = left; victim = t; }
+            }
+            if (victim < 0) return false;
+
+            std::atomic<unsigned long long>& slot = ranges[victim].packed;
+            unsigned long long packed = slot.load(std::memory_order_acquire);
+            unsigned begin = rangeBegin(packed), end = rangeEnd(packed);
+            if (begin >= end) continue;
+            unsigned mid = begin + (end - begin) / 2; // one index left: take it
+            if (!slot.compare_exchange_strong(packed, packRange(begin, mid), std::memory_order_acq_rel)) continue;
+
+            ranges[self].packed.store(packRange(mid, end), std::memory_order_release);
+            stealCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
     }
 
-    glEnable(GL_LIGHTING);
-}
+    void work(int self, const std::function<void(int)>& fn) {
+        int index;
+        do {
+            while (popFront(self, index)) fn(index);
+        } while (steal(self));
+    }
 
-void drawFallenTree(float x, float z, float length, float angleDegrees) {
-    glPushMatrix();
-    glTranslatef(x, 0.0f, z);
-    glRotatef(angleDegrees, 0.0f, 1.0f, 0.0f);
-    glRotatef(-20.0f, 0.0f, 0.0f, 1.0f); // slight tilt to “lean”
+    void workerLoop(int self) {
+        unsigned seen = 0;
+        insideJob = true;
+        for (;;) {
+            const std::function<void(int)>* fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                fn = job;
+            }
+            work(self, *fn);
 
-    glDisable(GL_LIGHTING);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+};
+thread_local bool WorkerPool::insideJob = false;
 
-    // Trunk
-    glColor3f(0.28f, 0.18f, 0.10f);
-    glPushMatrix();
-    glTranslatef(0.0f, 1.0f, 0.0f);
-    glScalef(length, 0.6f, 0.6f);
-    glutSolidCube(1.0);
-    glPopMatrix();
+int workerThreadLimit = 0; // --threads N (0 = one per core); read when the pool starts
 
-    // Some leaves at one end
-    glColor3f(0.05f, 0.25f, 0.05f);
-    glPushMatrix();
-    glTranslatef(length * 0.5f, 1.3f, 0.0f);
-    glScalef(2.0f, 1.5f, 2.0f);
-    glutSolidSphere(0.8, 12, 12);
-    glPopMatrix();
+WorkerPool& workerPool() {
+    static WorkerPool pool(std::max(1, workerThreadLimit > 0 ? workerThreadLimit : (int)std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
 
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
+// Runs fn(0..count-1) on the worker pool, each index exactly once; returns the threads used
+int parallelFor(int count, const std::function<void(int)>& fn) {
+    workerPool().run(count, fn);
+    return std::max(1, std::min(workerPool().threadCount(), count));
 }
 
+// ---------------------- Visibility (Frustum Culling) ----------------------
 
-// ---------------- Rocks and "dirty" ground for ancient scene ----------------
+// Bounding spheres are bucketed into a uniform XZ grid. Each frame the occupied cells are
+// classified against the view frustum first, then one linear pass over the store resolves
+// every object: cells fully inside or outside decide it directly, only objects in cells
+// straddling a plane get their own sphere test. Draw code reads visible[], so nothing
+// hidden reaches a GL call. Clouds move, so they are tested directly instead.
 
-void drawRock(float x, float z, float scale)
-{
-    glPushMatrix();
-    glTranslatef(x, 0.0f, z);
+const float GRID_MIN = -128.0f;    // grid covers [-128, 128] on X and Z, outliers clamp to edge cells
+const float GRID_CELL_SIZE = 16.0f;
+const int   GRID_CELLS = 16;
 
-    glDisable(GL_LIGHTING);
-    glColor3f(0.40f, 0.40f, 0.42f);   // gray rock
+struct Plane {
+    float a, b, c, d;
+};
 
-    // Slightly squashed sphere to look like a rock
-    glPushMatrix();
-    glTranslatef(0.0f, 0.3f * scale, 0.0f);
-    glScalef(scale, scale * 0.6f, scale);
-    glutSolidSphere(1.0, 12, 12);
-    glPopMatrix();
+struct Frustum {
+    Plane planes[6];
+};
 
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
-}
+Frustum viewFrustum;
+float viewProjection[16]; // the frame's clip matrix, refreshed by cullScene
 
-// Darker ground patches near the pyramid to make it look worn / dirty
-void drawAncientGroundPatches()
-{
-    glDisable(GL_LIGHTING);
-    glColor3f(0.18f, 0.13f, 0.09f);   // darker dirt to make it more look like abandoned-ish
+// Called once after every object of the scene has its bounds
+void buildObjectGrid(SceneType scene) {
+    InstanceStore& store = sceneInstances[scene];
+    store.cells.assign(GRID_CELLS * GRID_CELLS, GridCell());
+    store.cellState.assign(store.cells.size(), 0);
 
-    auto patch = [](float x, float z, float sx, float sz)
-        {
-            glPushMatrix();
-            glTranslatef(x, -0.8f, z);    // slightly above the big ground cube
-            glScalef(sx, 0.4f, sz);
-            glutSolidCube(1.0f);
-            glPopMatrix();
+    auto cellCoord = [](float v) {
+        int c = (int)floorf((v - GRID_MIN) / GRID_CELL_SIZE);
+        return std::max(0, std::min(GRID_CELLS - 1, c));
         };
 
-    // A few irregular patches around the base
-    patch(6.0f, 18.0f, 10.0f, 6.0f);
-    patch(-8.0f, 16.0f, 7.0f, 5.0f);
-    patch(10.0f, -15.0f, 8.0f, 7.0f);
-    patch(-12.0f, -17.0f, 9.0f, 6.0f);
-    patch(0.0f, 22.0f, 12.0f, 4.0f);
-
-    glEnable(GL_LIGHTING);
+    for (int id = 0; id < store.size(); ++id) {
+        float x = store.boundX[id], y = store.boundY[id], z = store.boundZ[id], r = store.boundRadius[id];
+        int index = cellCoord(z) * GRID_CELLS + cellCoord(x);
+        GridCell& cell = store.cells[index];
+        store.cell[id] = (unsigned short)index;
+
+        if (!cell.occupied) {
+            cell.minX = x - r; cell.maxX = x + r;
+            cell.minY = y - r; cell.maxY = y + r;
+            cell.minZ = z - r; cell.maxZ = z + r;
+            cell.occupied = true;
+        }
+        else {
+            cell.minX = std::min(cell.minX, x - r); cell.maxX = std::max(cell.maxX, x + r);
+            cell.minY = std::min(cell.minY, y - r); cell.maxY = std::max(cell.maxY, y + r);
+            cell.minZ = std::min(cell.minZ, z - r); cell.maxZ = std::max(cell.maxZ, z + r);
+        }
+    }
 }
 
-// Place many rocks around the pyramid in rough rings
-void drawRocksAndDebris()
-{
-    // Ring of rocks around the base
-    float baseRadius = 28.0f;
+// out = a * b, column-major 4x4 like OpenGL (out must not alias a or b)
+void multiplyMatrices(const float a[16], const float b[16], float out[16]) {
+    for (int col = 0; col < 4; ++col)
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) sum += a[k * 4 + row] * b[col * 4 + k];
+            out[col * 4 + row] = sum;
+        }
+}
 
-    for (int i = 0; i < 32; ++i)
-    {
-        float angle = (float)i * (2.0f * (float)M_PI / 32.0f);
-        float radius = baseRadius + (i % 4) * 2.5f;   // slightly irregular
+// Gribb/Hartmann: planes are sums/differences of the rows of a (column-major) clip matrix
+void frustumFromMatrix(Frustum& frustum, const float clip[16]) {
+    auto row = [&](int r, int c) { return clip[c * 4 + r]; };
+    for (int i = 0; i < 6; ++i) {
+        int axis = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        Plane& p = frustum.planes[i];
+        p.a = row(3, 0) + sign * row(axis, 0);
+        p.b = row(3, 1) + sign * row(axis, 1);
+        p.c = row(3, 2) + sign * row(axis, 2);
+        p.d = row(3, 3) + sign * row(axis, 3);
+        float len = sqrtf(p.a * p.a + p.b * p.b + p.c * p.c);
+        p.a /= len; p.b /= len; p.c /= len; p.d /= len;
+    }
+}
 
-        float x = cosf(angle) * radius;
-        float z = sinf(angle) * radius;
-        float s = 0.7f + (i % 3) * 0.25f;             // various sizes
+// Same matrices as gluPerspective + gluLookAt in reshapeCallback/applyCamera, combined on the CPU
+void computeViewProjection(float clip[16]) {
+    float yawRad = camera.yaw * (float)M_PI / 180.0f;
+    float pitchRad = camera.pitch * (float)M_PI / 180.0f;
+    float fx = cosf(pitchRad) * sinf(yawRad);
+    float fy = sinf(pitchRad);
+    float fz = -cosf(pitchRad) * cosf(yawRad);
+
+    // side = forward x up(0,1,0), up' = side x forward
+    float sx = -fz, sy = 0.0f, sz = fx;
+    float sl = sqrtf(sx * sx + sz * sz);
+    if (sl > 0.0f) { sx /= sl; sz /= sl; }
+    float ux = sy * fz - sz * fy;
+    float uy = sz * fx - sx * fz;
+    float uz = sx * fy - sy * fx;
+
+    float view[16] = {
+        sx, ux, -fx, 0.0f,
+        sy, uy, -fy, 0.0f,
+        sz, uz, -fz, 0.0f,
+        -(sx * camera.x + sy * camera.y + sz * camera.z),
+        -(ux * camera.x + uy * camera.y + uz * camera.z),
+        (fx * camera.x + fy * camera.y + fz * camera.z),
+        1.0f
+    };
+
+    float aspect = (float)windowWidth / (float)std::max(windowHeight, 1);
+    float f = 1.0f / tanf(camera.fov * 0.5f * (float)M_PI / 180.0f);
+    float proj[16] = {
+        f / aspect, 0.0f, 0.0f, 0.0f,
+        0.0f, f, 0.0f, 0.0f,
+        0.0f, 0.0f, (FAR_PLANE + NEAR_PLANE) / (NEAR_PLANE - FAR_PLANE), -1.0f,
+        0.0f, 0.0f, 2.0f * FAR_PLANE * NEAR_PLANE / (NEAR_PLANE - FAR_PLANE), 0.0f
+    };
+
+    multiplyMatrices(proj, view, clip);
+}
 
-        drawRock(x, z, s);
+bool sphereInFrustum(const Frustum& frustum, float x, float y, float z, float radius) {
+    for (const Plane& p : frustum.planes) {
+        if (p.a * x + p.b * y + p.c * z + p.d < -radius) return false;
     }
+    return true;
+}
 
-    // A few larger rocks closer to some stairs
-    drawRock(5.0f, 20.0f, 1.2f);
-    drawRock(-7.0f, 19.0f, 1.0f);
-    drawRock(11.0f, -19.0f, 1.3f);
-    drawRock(-10.0f, -18.0f, 1.1f);
-
-    // Dirty patches right after the rocks
-    drawAncientGroundPatches();
+enum BoxVisibility { BOX_OUTSIDE, BOX_INTERSECTS, BOX_INSIDE };
+
+BoxVisibility classifyBox(const Frustum& frustum, const GridCell& cell) {
+    BoxVisibility result = BOX_INSIDE;
+    for (const Plane& p : frustum.planes) {
+        // Corner furthest along the plane normal, and the one furthest against it
+        float px = p.a >= 0.0f ? cell.maxX : cell.minX;
+        float py = p.b >= 0.0f ? cell.maxY : cell.minY;
+        float pz = p.c >= 0.0f ? cell.maxZ : cell.minZ;
+        float nx = p.a >= 0.0f ? cell.minX : cell.maxX;
+        float ny = p.b >= 0.0f ? cell.minY : cell.maxY;
+        float nz = p.c >= 0.0f ? cell.minZ : cell.maxZ;
+
+        if (p.a * px + p.b * py + p.c * pz + p.d < 0.0f) return BOX_OUTSIDE;
+        if (p.a * nx + p.b * ny + p.c * nz + p.d < 0.0f) result = BOX_INTERSECTS;
+    }
+    return result;
 }
 
+// ---------------------- Occlusion Culling ----------------------
 
-// ---------- Full-height staircases inspired by El Castillo ----------
+// The pyramid hides much of the jungle ring, the back staircase and the visitors behind
+// it, none of which the frustum test can drop. Every frame a simplified occluder is
+// rasterized on the CPU into a small depth buffer: the truncated pyramid through the inner
+// corners of the terraces (which lies wholly inside them) and the temple. A texel is
+// written only when a face covers all of it, with the farthest depth the face reaches
+// inside it, and faces that cross the near plane are skipped, so the buffer never claims
+// more than the pyramid really hides. An object survives if any texel under the screen
+// rectangle of its bounding sphere has no occluder in front of the sphere's nearest point.
 
-void drawOneStaircase(float yawDegrees) {
-    const float baseHalf = 12.5f;       // match pyramid base
-    const float terraceHeight = 1.2f;
-    const int   terraceCount = 12;
-    const float pyramidHeight = terraceCount * terraceHeight;
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
 
-    const int   stepCount = 30;
-    const float stepHeight = pyramidHeight / (float)stepCount;
-    const float baseZStart = baseHalf + 1.2f;
-    const float baseZEnd = baseHalf - 10.0f;
-    const float stepDepth = 1.2f;
+struct OccluderQuad {
+    float v[4][3];  // convex, planar, world space
+    float n[3];     // outward normal, for back-face rejection
+};
 
-    // Stop the stairs a bit before the very top so they don't overlap the temple, very big problem, readjusted for hours
-    const float maxStairY = pyramidHeight - stepHeight * 3.0f;
+struct OcclusionBuffer {
+    std::vector<OccluderQuad> quads;
+    std::vector<float> depth;      // NDC z of the nearest occluder per texel, 1 = none
+    const float* clip = nullptr;   // the frame's view-projection (see cullScene)
+    bool active = false;           // occluders were rasterized this frame
+} occlusion;
+bool occlusionEnabled = true;      // 'O' toggles, --no-occlusion
+
+void initOccluders() {
+    auto addQuad = [](const float a[3], const float b[3], const float c[3], const float d[3], float nx, float ny, float nz) {
+        OccluderQuad q;
+        memcpy(q.v[0], a, sizeof(q.v[0])); memcpy(q.v[1], b, sizeof(q.v[1]));
+        memcpy(q.v[2], c, sizeof(q.v[2])); memcpy(q.v[3], d, sizeof(q.v[3]));
+        q.n[0] = nx; q.n[1] = ny; q.n[2] = nz;
+        occlusion.quads.push_back(q);
+    };
+    // Four sides of a box-like solid from its bottom and top rings (corners -x-z, +x-z, +x+z, -x+z)
+    auto addSides = [&](float bottomHalf, float bottomY, float topHalf, float topY) {
+        const float sx[4] = { -1.0f, 1.0f, 1.0f, -1.0f }, sz[4] = { -1.0f, -1.0f, 1.0f, 1.0f };
+        float slope = (bottomHalf - topHalf) / (topY - bottomY);
+        for (int k = 0; k < 4; ++k) {
+            int l = (k + 1) % 4;
+            float b0[3] = { sx[k] * bottomHalf, bottomY, sz[k] * bottomHalf };
+            float b1[3] = { sx[l] * bottomHalf, bottomY, sz[l] * bottomHalf };
+            float t1[3] = { sx[l] * topHalf, topY, sz[l] * topHalf };
+            float t0[3] = { sx[k] * topHalf, topY, sz[k] * topHalf };
+            // Outward normal of the edge k -> l (counter-clockwise seen from above)
+            float nx = (sx[k] + sx[l]) * 0.5f, nz = (sz[k] + sz[l]) * 0.5f;
+            addQuad(b0, b1, t1, t0, nx, slope, nz);
+        }
+    };
 
-    glPushMatrix();
-    glRotatef(yawDegrees, 0.0f, 1.0f, 0.0f);
+    occlusion.quads.clear();
+    float top = PYRAMID_TERRACE_COUNT * PYRAMID_TERRACE_HEIGHT;
+    float insetPerUnit = PYRAMID_TERRACE_INSET / PYRAMID_TERRACE_HEIGHT;
+    addSides(PYRAMID_BASE_HALF, 0.0f, PYRAMID_BASE_HALF - top * insetPerUnit, top);
 
-    glDisable(GL_LIGHTING);
-    glColor3f(0.78f, 0.74f, 0.68f); // slightly lighter to stand out from terraces
+    // The temple above the last terrace; its top face matters when looking down
+    float templeTop = top + PYRAMID_TERRACE_HEIGHT * 0.5f + PYRAMID_TEMPLE_RISE + PYRAMID_TEMPLE_HALF_HEIGHT;
+    addSides(PYRAMID_TEMPLE_HALF, top, PYRAMID_TEMPLE_HALF, templeTop);
+    float h = PYRAMID_TEMPLE_HALF;
+    float c0[3] = { -h, templeTop, -h }, c1[3] = { h, templeTop, -h }, c2[3] = { h, templeTop, h }, c3[3] = { -h, templeTop, h };
+    addQuad(c0, c1, c2, c3, 0.0f, 1.0f, 0.0f);
 
-    for (int i = 0; i < stepCount; ++i) {
-        float t = (float)i / (float)(stepCount - 1);
+    occlusion.depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+}
 
-        float y = 0.3f + (i + 0.5f) * stepHeight;
-        float z = baseZStart + (baseZEnd - baseZStart) * t;
-        float width = 7.0f - t * 3.0f; // staircase becomes narrower near the top
+// Rasterizes the occluder's front faces with the view-projection `clip`
+void rasterizeOccluders(SceneType scene, const float clip[16]) {
+    occlusion.active = false;
+    occlusion.clip = clip;
+    const InstanceStore& store = sceneInstances[scene];
+    int pyramid = store.kindBegin[OBJ_PYRAMID];
+    if (!occlusionEnabled || !cullingEnabled || occlusion.quads.empty() ||
+        !sphereInFrustum(viewFrustum, store.boundX[pyramid], store.boundY[pyramid], store.boundZ[pyramid], store.boundRadius[pyramid]))
+        return;
+
+    std::fill(occlusion.depth.begin(), occlusion.depth.end(), 1.0f);
+    for (const OccluderQuad& quad : occlusion.quads) {
+        const float* v0 = quad.v[0];
+        if (quad.n[0] * (v0[0] - camera.x) + quad.n[1] * (v0[1] - camera.y) + quad.n[2] * (v0[2] - camera.z) >= 0.0f)
+            continue; // back face
+
+        float sx[4], sy[4], sz[4];
+        bool clipped = false;
+        for (int k = 0; k < 4; ++k) {
+            const float* v = quad.v[k];
+            float cx = clip[0] * v[0] + clip[4] * v[1] + clip[8] * v[2] + clip[12];
+            float cy = clip[1] * v[0] + clip[5] * v[1] + clip[9] * v[2] + clip[13];
+            float cz = clip[2] * v[0] + clip[6] * v[1] + clip[10] * v[2] + clip[14];
+            float cw = clip[3] * v[0] + clip[7] * v[1] + clip[11] * v[2] + clip[15];
+            if (cw < NEAR_PLANE) { clipped = true; break; }
+            sx[k] = (cx / cw * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            sy[k] = (cy / cw * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            sz[k] = cz / cw;
+        }
+        if (clipped) continue;
+
+        // Depth plane through the first three corners (NDC z is affine in screen space)
+        float d1x = sx[1] - sx[0], d1y = sy[1] - sy[0], d1z = sz[1] - sz[0];
+        float d2x = sx[2] - sx[0], d2y = sy[2] - sy[0], d2z = sz[2] - sz[0];
+        float det = d1x * d2y - d2x * d1y;
+        if (fabsf(det) < 1e-4f) continue; // edge-on
+        float sign = det > 0.0f ? 1.0f : -1.0f;
+        float dzdx = (d1z * d2y - d2z * d1y) / det;
+        float dzdy = (d2z * d1x - d1z * d2x) / det;
+        // Farthest depth inside a texel is its center value plus this
+        float zSlack = 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+
+        // Edge functions e = a*x + b*y + c, positive inside. A texel lies fully inside an
+        // edge when e at its center is at least half its extent along the edge normal.
+        float ea[4], eb[4], ec[4], inset[4];
+        for (int k = 0; k < 4; ++k) {
+            int l = (k + 1) % 4;
+            ea[k] = -(sy[l] - sy[k]) * sign;
+            eb[k] = (sx[l] - sx[k]) * sign;
+            ec[k] = -(ea[k] * sx[k] + eb[k] * sy[k]);
+            inset[k] = 0.5f * (fabsf(ea[k]) + fabsf(eb[k]));
+        }
 
-        // Clamp stair generation so we don't reach into the temple
-        if (y > maxStairY)
-            break;
+        int x0 = std::max(0, (int)floorf(std::min({ sx[0], sx[1], sx[2], sx[3] })));
+        int x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf(std::max({ sx[0], sx[1], sx[2], sx[3] })));
+        int y0 = std::max(0, (int)floorf(std::min({ sy[0], sy[1], sy[2], sy[3] })));
+        int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf(std::max({ sy[0], sy[1], sy[2], sy[3] })));
+
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            float* row = &occlusion.depth[(size_t)y * OCCLUSION_WIDTH];
+            for (int x = x0; x <= x1; ++x) {
+                float px = x + 0.5f;
+                if (ea[0] * px + eb[0] * py + ec[0] < inset[0] || ea[1] * px + eb[1] * py + ec[1] < inset[1] ||
+                    ea[2] * px + eb[2] * py + ec[2] < inset[2] || ea[3] * px + eb[3] * py + ec[3] < inset[3])
+                    continue;
+                float z = sz[0] + dzdx * (px - sx[0]) + dzdy * (py - sy[0]) + zSlack;
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+    occlusion.active = true;
+}
 
-        glPushMatrix();
-        glTranslatef(0.0f, y, z);
-        glScalef(width, stepHeight * 0.9f, stepDepth);
-        glutSolidCube(1.0);
-        glPopMatrix();
+// True when the sphere is behind the rasterized occluders everywhere it could show up.
+// Read-only on the buffer, so the crowd calls it from its worker threads.
+bool sphereOccluded(float x, float y, float z, float radius) {
+    if (!occlusion.active) return false;
+    const float* m = occlusion.clip;
+
+    // Distance along the view axis (clip w) to the sphere's nearest point, as NDC depth
+    float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+    float nearest = w - radius;
+    if (nearest <= NEAR_PLANE) return false;
+    float nearestZ = (FAR_PLANE + NEAR_PLANE) / (FAR_PLANE - NEAR_PLANE) -
+        2.0f * FAR_PLANE * NEAR_PLANE / ((FAR_PLANE - NEAR_PLANE) * nearest);
+
+    // Screen rectangle from the corners of the sphere's bounding box
+    float minX = 1e9f, maxX = -1e9f, minY = 1e9f, maxY = -1e9f;
+    for (int corner = 0; corner < 8; ++corner) {
+        float cx = x + ((corner & 1) ? radius : -radius);
+        float cy = y + ((corner & 2) ? radius : -radius);
+        float cz = z + ((corner & 4) ? radius : -radius);
+        float cw = m[3] * cx + m[7] * cy + m[11] * cz + m[15];
+        if (cw <= NEAR_PLANE) return false;
+        float px = (m[0] * cx + m[4] * cy + m[8] * cz + m[12]) / cw;
+        float py = (m[1] * cx + m[5] * cy + m[9] * cz + m[13]) / cw;
+        minX = std::min(minX, px); maxX = std::max(maxX, px);
+        minY = std::min(minY, py); maxY = std::max(maxY, py);
     }
 
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
+    int x0 = std::max(0, (int)floorf((minX * 0.5f + 0.5f) * OCCLUSION_WIDTH));
+    int x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf((maxX * 0.5f + 0.5f) * OCCLUSION_WIDTH));
+    int y0 = std::max(0, (int)floorf((minY * 0.5f + 0.5f) * OCCLUSION_HEIGHT));
+    int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf((maxY * 0.5f + 0.5f) * OCCLUSION_HEIGHT));
+    if (x0 > x1 || y0 > y1) return false;
+
+    for (int ty = y0; ty <= y1; ++ty) {
+        const float* row = &occlusion.depth[(size_t)ty * OCCLUSION_WIDTH];
+        for (int tx = x0; tx <= x1; ++tx) {
+            if (row[tx] >= nearestZ) return false;
+        }
+    }
+    return true;
 }
 
+// ---------------------- Level of Detail ----------------------
 
+// Spheres (canopies, rocks, clouds, tourist heads) exist at several tessellations.
+// The level is picked from the object's projected radius in pixels. Levels only
+// change once the size has moved past a threshold by LOD_HYSTERESIS, so an object
+// sitting right at a boundary doesn't flicker between two meshes.
+// Boxes are left at a single level: at 12 triangles there is nothing to drop.
+
+const int LOD_COUNT = 4;
+const int sphereLodSlices[LOD_COUNT] = { 12, 8, 6, 4 };
+const int sphereLodStacks[LOD_COUNT] = { 12, 8, 5, 3 };
+
+// Move to level i + 1 once the projected radius falls below lodPixelThresholds[i]
+const float lodPixelThresholds[LOD_COUNT - 1] = { 40.0f, 16.0f, 6.0f };
+const float LOD_HYSTERESIS = 0.15f;
+
+MeshVBO sphereLods[LOD_COUNT]; // unit radius
+
+float projectedRadiusPixels(float x, float y, float z, float radius) {
+    float dx = x - camera.x, dy = y - camera.y, dz = z - camera.z;
+    float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+    if (dist <= radius) return 1.0e6f; // camera inside the bounds
+
+    float pixelsPerUnit = (float)windowHeight * 0.5f / tanf(camera.fov * 0.5f * (float)M_PI / 180.0f);
+    return radius * pixelsPerUnit / dist;
+}
+
+int selectLod(float pixels, int previous) {
+    int lod = previous;
+    while (lod < LOD_COUNT - 1 && pixels < lodPixelThresholds[lod] * (1.0f - LOD_HYSTERESIS)) ++lod;
+    while (lod > 0 && pixels > lodPixelThresholds[lod - 1] * (1.0f + LOD_HYSTERESIS)) --lod;
+    return lod;
+}
+
+const int CULL_BLOCK = 256; // objects per culling job
+
+struct CullCounts {
+    int culled = 0, occluded = 0, visible = 0;
+};
+std::vector<CullCounts> cullBlockCounts;
+int cullThreads = 1;        // threads the last cull ran on
+
+// Per-frame pass: refresh visible[] (and lod[] of the visible ones) for every object of the scene
+void cullScene(SceneType scene) {
+    InstanceStore& store = sceneInstances[scene];
+    computeViewProjection(viewProjection);
+    frustumFromMatrix(viewFrustum, viewProjection);
+    rasterizeOccluders(scene, viewProjection);
+
+    for (size_t c = 0; c < store.cells.size(); ++c) {
+        const GridCell& cell = store.cells[c];
+        if (!cell.occupied) continue;
+        store.cellState[c] = (unsigned char)(cullingEnabled ? classifyBox(viewFrustum, cell) : BOX_INSIDE);
+    }
+
+    // Objects in blocks on the worker pool; each block counts into its own slot
+    const int count = store.size();
+    const int blocks = (count + CULL_BLOCK - 1) / CULL_BLOCK;
+    cullBlockCounts.assign(blocks, CullCounts());
+    cullThreads = parallelFor(blocks, [&](int b) {
+        CullCounts& counts = cullBlockCounts[b];
+        const int end = std::min(count, (b + 1) * CULL_BLOCK);
+        for (int id = b * CULL_BLOCK; id < end; ++id) {
+            BoxVisibility cellVis = (BoxVisibility)store.cellState[store.cell[id]];
+            float x = store.boundX[id], y = store.boundY[id], z = store.boundZ[id], r = store.boundRadius[id];
+
+            bool visible = cellVis == BOX_INSIDE ||
+                (cellVis == BOX_INTERSECTS && sphereInFrustum(viewFrustum, x, y, z, r));
+            store.visible[id] = visible ? 1 : 0;
+            if (!visible) {
+                counts.culled++;
+                continue;
+            }
+            // The pyramid and its temple details are the occluder
+            if (store.kind[id] != OBJ_PYRAMID && store.kind[id] != OBJ_TEMPLE && sphereOccluded(x, y, z, r)) {
+                store.visible[id] = 0;
+                counts.occluded++;
+                continue;
+            }
+
+            store.lod[id] = (unsigned char)selectLod(projectedRadiusPixels(x, y, z, r), store.lod[id]);
+            counts.visible++;
+        }
+        });
+
+    for (const CullCounts& counts : cullBlockCounts) {
+        frameStats.objectsCulled += counts.culled;
+        frameStats.objectsOccluded += counts.occluded;
+        frameStats.objectsVisible += counts.visible;
+    }
+}
+
+// ---------------------- Render Queue ----------------------
+
+// Scene code does not draw as it goes. It emits DrawItems (a draw function, the mesh, the
+// instance source and a range) with a 64-bit sort key
+//   pass (4 bits) | material (8) | depth (24, near first) | emission order (28)
+// into a per-frame arena, and submitRenderQueue() sorts them and issues each run of one
+// material between a single bind and unbind of that material's shared state (program,
+// uniforms, client arrays). The arena is a linear allocator reset by beginRenderQueue; it
+// only reaches the heap in a frame that outgrows it, and then grows at the next reset.
+
+enum RenderPass { PASS_OPAQUE, PASS_SKY }; // the sky fills in what the opaque pass left
+
+// Submission order inside a pass: the big occluders first, then what they hide, the
+// ground (everything stands on it) and the clouds far out last
+enum RenderMaterial { MAT_SKY, MAT_PYRAMID, MAT_STATIC_BATCH, MAT_CROWD, MAT_VEGETATION, MAT_TERRAIN, MAT_CLOUDS, MAT_COUNT };
+const char* renderMaterialNames[MAT_COUNT] = { "sky", "pyramid", "static_batch", "crowd", "vegetation", "terrain", "clouds" };
+
+struct DrawItem;
+typedef void (*DrawItemFn)(const DrawItem& item);
+
+struct DrawItem {
+    uint64_t key;
+    DrawItemFn draw;
+    const MeshVBO* mesh;
+    const void* source;     // instance buffer owner, instance store, or an arena payload
+    int first, count;
+};
+
+const size_t RENDER_ARENA_BYTES = 64 * 1024;
+const int    RENDER_QUEUE_ITEMS = 256;      // first item block; doubles inside the arena when full
+const float  RENDER_DEPTH_RANGE = 1000.0f;  // FAR_PLANE: depths beyond share the last key
+
+struct FrameArena {
+    std::vector<unsigned char> memory = std::vector<unsigned char>(RENDER_ARENA_BYTES);
+    size_t used = 0;
+    size_t peak = 0;
+    std::vector<std::vector<unsigned char>> spill; // this frame's overflow
+    size_t spilled = 0;
+
+    void reset() {
+        if (spilled > 0) {
+            memory.resize(memory.size() + std::max(spilled, memory.size()));
+            spill.clear();
+            spilled = 0;
+        }
+        used = 0;
+    }
+
+    void* allocate(size_t bytes) {
+        size_t offset = (used + 15) & ~(size_t)15;
+        if (offset + bytes > memory.size()) {
+            spill.emplace_back(bytes);
+            spilled += bytes;
+            return spill.back().data();
+        }
+        used = offset + bytes;
+        peak = std::max(peak, used);
+        return memory.data() + offset;
+    }
+
+    template <typename T> T* allocate(int count) {
+        return (T*)allocate(sizeof(T) * (size_t)count);
+    }
+};
+
+const int OVERDRAW_QUERIES = 3; // results are read two frames late, never waited for
+
+struct RenderQueue {
+    bool sorted = true;     // --no-render-sort: submit in emission order
+    FrameArena arena;
+    DrawItem* items = nullptr;
+    int count = 0;
+    int capacity = 0;
+    SceneType scene = ANCIENT_SCENE;
+    GLuint overdrawQueries[OVERDRAW_QUERIES] = {};
+    bool overdrawIssued[OVERDRAW_QUERIES] = {};
+    int overdrawSlot = 0;
+    double overdraw = 0.0;  // opaque fragments that passed the depth test, per pixel
+};
+RenderQueue renderQueue;
+
+inline float cameraDistance(float x, float y, float z) {
+    float dx = x - camera.x, dy = y - camera.y, dz = z - camera.z;
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+// Distance from the camera to an instance's bounding sphere
+inline float instanceDepth(const InstanceStore& store, int id) {
+    return std::max(0.0f, cameraDistance(store.boundX[id], store.boundY[id], store.boundZ[id]) - store.boundRadius[id]);
+}
+
+inline int renderKeyPass(uint64_t key) { return (int)(key >> 60); }
+inline int renderKeyMaterial(uint64_t key) { return (int)(key >> 52) & 0xff; }
+
+void queueDraw(RenderPass pass, RenderMaterial material, float depth, DrawItemFn draw,
+    const MeshVBO* mesh, const void* source, int first, int count)
+{
+    RenderQueue& q = renderQueue;
+    if (q.count == q.capacity) {
+        // Full: move to a block twice the size (the old one is dropped with the arena)
+        DrawItem* grown = q.arena.allocate<DrawItem>(q.capacity * 2);
+        if (q.count > 0) memcpy(grown, q.items, q.count * sizeof(DrawItem));
+        q.items = grown;
+        q.capacity *= 2;
+    }
+
+    float scaled = std::min(std::max(depth / RENDER_DEPTH_RANGE, 0.0f), 1.0f) * (float)0xffffff;
+    uint64_t key = (uint64_t)pass << 60 | (uint64_t)material << 52 | (uint64_t)scaled << 28 | (uint64_t)(q.count & 0xfffffff);
+    q.items[q.count++] = { key, draw, mesh, source, first, count };
+}
+
+void beginRenderQueue(SceneType scene) {
+    RenderQueue& q = renderQueue;
+    q.arena.reset();
+    q.capacity = RENDER_QUEUE_ITEMS;
+    q.items = q.arena.allocate<DrawItem>(q.capacity);
+    q.count = 0;
+    q.scene = scene;
+}
+
+// ---------------------- Drawing Helpers ----------------------
+
+// Sky: one triangle covering the screen, drawn after everything opaque at the far plane
+// (z = w) with depth test LEQUAL and no depth writes, so only pixels nothing else covered
+// are shaded. The fragment shader turns the pixel's view ray into a horizon-to-zenith
+// gradient per scene; with fog on, the haze thickens toward the horizon.
+const float skyZenith[2][3] = { { 0.01f, 0.01f, 0.05f }, { 0.36f, 0.58f, 0.92f } };  // indexed by SceneType
+const float skyHorizon[2][3] = { { 0.05f, 0.05f, 0.13f }, { 0.70f, 0.85f, 1.00f } }; // also the clear color
+
+const char* skyVertexSrc = R"(
+#version 120
+attribute vec2 a_position;  // clip space
+uniform vec3 u_forward;     // camera axes, right/up scaled to the frustum edges at distance 1
+uniform vec3 u_right;
+uniform vec3 u_up;
+varying vec3 v_ray;
+void main() {
+    v_ray = u_forward + a_position.x * u_right + a_position.y * u_up;
+    gl_Position = vec4(a_position, 1.0, 1.0);
+}
+)";
+
+const char* skyFragmentSrc = R"(
+#version 120
+uniform vec3 u_zenith;
+uniform vec3 u_horizon;
+uniform float u_fog;
+varying vec3 v_ray;
+void main() {
+    float up = max(normalize(v_ray).y, 0.0);
+    vec3 color = mix(u_horizon, u_zenith, sqrt(up));
+    color = mix(color, gl_Fog.color.rgb, u_fog * pow(1.0 - up, 4.0));
+    gl_FragColor = vec4(color, 1.0);
+}
+)";
+
+GLuint skyProgram = 0;
+GLuint skyVbo = 0;
+
+void createSky() {
+    skyProgram = createProgram(skyVertexSrc, skyFragmentSrc);
+    const float corners[6] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+    glGenBuffers(1, &skyVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, skyVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void bindSkyMaterial() {
+    SceneType scene = renderQueue.scene;
+    stateUseProgram(skyProgram);
+    stateDepthMask(GL_FALSE);
+    stateDepthFunc(GL_LEQUAL);
+
+    // Same basis as computeViewProjection
+    float yawRad = camera.yaw * (float)M_PI / 180.0f;
+    float pitchRad = camera.pitch * (float)M_PI / 180.0f;
+    float fx = cosf(pitchRad) * sinf(yawRad), fy = sinf(pitchRad), fz = -cosf(pitchRad) * cosf(yawRad);
+    float sx = -fz, sz = fx;
+    float sl = sqrtf(sx * sx + sz * sz);
+    if (sl > 0.0f) { sx /= sl; sz /= sl; }
+    float ux = -sz * fy, uy = sz * fx - sx * fz, uz = sx * fy;
+    float tanY = tanf(camera.fov * 0.5f * (float)M_PI / 180.0f);
+    float tanX = tanY * (float)windowWidth / (float)std::max(windowHeight, 1);
+
+    glUniform3f(glGetUniformLocation(skyProgram, "u_forward"), fx, fy, fz);
+    glUniform3f(glGetUniformLocation(skyProgram, "u_right"), sx * tanX, 0.0f, sz * tanX);
+    glUniform3f(glGetUniformLocation(skyProgram, "u_up"), ux * tanY, uy * tanY, uz * tanY);
+    glUniform3fv(glGetUniformLocation(skyProgram, "u_zenith"), 1, skyZenith[scene]);
+    glUniform3fv(glGetUniformLocation(skyProgram, "u_horizon"), 1, skyHorizon[scene]);
+    glUniform1f(glGetUniformLocation(skyProgram, "u_fog"), stateIsEnabled(GL_FOG) ? 1.0f : 0.0f);
+}
+
+void unbindSkyMaterial() {
+    stateDepthFunc(GL_LESS);
+    stateDepthMask(GL_TRUE);
+    stateUseProgram(0);
+}
+
+void drawSkyItem(const DrawItem&) {
+    glBindBuffer(GL_ARRAY_BUFFER, skyVbo);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    countDraw(3);
+}
+
+void queueSky() {
+    if (!skyProgram) return; // the clear color (the horizon) shows instead
+    queueDraw(PASS_SKY, MAT_SKY, RENDER_DEPTH_RANGE, drawSkyItem, nullptr, nullptr, 0, 3);
+}
+
+// Vertex + normal arrays of a mesh in whichever layout it was uploaded with (fixed function)
+void bindMeshArrays(const MeshVBO& mesh) {
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, mesh.positionType, mesh.stride, (void*)0);
+    glNormalPointer(mesh.normalType, mesh.stride, (void*)(size_t)mesh.normalOffset);
+}
+
+void unbindMeshArrays() {
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Same for the shader paths: a_position, and a_normal when the program reads it
+void bindMeshAttributes(const MeshVBO& mesh, bool normals) {
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, mesh.positionType, GL_FALSE, mesh.stride, (void*)0);
+    if (!normals) return;
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_NORMAL, mesh.normalType == GL_INT_2_10_10_10_REV ? 4 : 3, mesh.normalType,
+        mesh.normalType != GL_FLOAT, mesh.stride, (void*)(size_t)mesh.normalOffset);
+}
+
+// The whole mesh, once or `instances` times (arrays bound by one of the above)
+void drawMeshTriangles(const MeshVBO& mesh) {
+    if (mesh.ibo) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+        glDrawElements(GL_TRIANGLES, mesh.indexCount, mesh.indexType, nullptr);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    else {
+        glDrawArrays(GL_TRIANGLES, 0, mesh.vertexCount);
+    }
+    countDraw(meshDrawVertices(mesh));
+}
+
+void drawMeshInstances(const MeshVBO& mesh, int instances) {
+    if (mesh.ibo) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+        glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, nullptr, instances);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    else {
+        glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.vertexCount, instances);
+    }
+    countDraw((long long)meshDrawVertices(mesh) * instances);
+}
+
+void drawMeshLit(const MeshVBO& mesh, float r, float g, float b) {
+    bindMeshArrays(mesh);
+
+    GLfloat materialDiffuse[] = { r, g, b, 1.0f };
+    GLfloat materialAmbient[] = { r * 0.3f, g * 0.3f, b * 0.3f, 1.0f };
+    GLfloat materialSpec[] = { 0.35f, 0.35f, 0.35f, 1.0f };
+
+    const GLfloat shininess = 25.0f;
+    stateMaterial(GL_AMBIENT, materialAmbient, 4);
+    stateMaterial(GL_DIFFUSE, materialDiffuse, 4);
+    stateMaterial(GL_SPECULAR, materialSpec, 4);
+    stateMaterial(GL_SHININESS, &shininess, 1);
+    // GL_COLOR_MATERIAL is on: ambient + diffuse follow the current color, so set it too
+    // (otherwise whatever the previous draw left behind tints the mesh)
+    stateColor(r, g, b);
+
+    drawMeshTriangles(mesh);
+    unbindMeshArrays();
+}
+
+// Draws a mesh with the current color and matrix, without touching lighting or material state
+void drawUnlitMesh(const MeshVBO& mesh) {
+    bindMeshArrays(mesh);
+    drawMeshTriangles(mesh);
+    unbindMeshArrays();
+}
+
+// VBO versions of glutSolidCube / glutSolidSphere (GLUT's need a GLUT window, so they
+// can't be used headless). Both come from the mesh table (see buildMeshData).
+MeshVBO unitCubeMesh;
+
+void drawSolidCube(float size) {
+    glPushMatrix();
+    glScalef(size, size, size);
+    drawUnlitMesh(unitCubeMesh);
+    glPopMatrix();
+}
+
+void drawSphereLod(float radius, int lod) {
+    glPushMatrix();
+    glScalef(radius, radius, radius);
+    drawUnlitMesh(sphereLods[lod]);
+    glPopMatrix();
+}
+
+// Draws instances [firstInstance, firstInstance + count) of the batch's instance buffer
+void drawInstancedMesh(const MeshVBO& mesh, const VegetationBatch& batch, int firstInstance, int count) {
+    bindMeshAttributes(mesh, true);
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch.instances.buffer);
+    glEnableVertexAttribArray(ATTRIB_INSTANCE);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+    GLsizei instStride = sizeof(TreeInstance);
+    size_t base = batch.instances.offset + (size_t)firstInstance * sizeof(TreeInstance);
+    glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, instStride, (void*)base);
+    glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, instStride, (void*)(base + 4 * sizeof(GLfloat)));
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+    glVertexAttribDivisor(ATTRIB_COLOR, 1);
+
+    drawMeshInstances(mesh, count);
+
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 0);
+    glVertexAttribDivisor(ATTRIB_COLOR, 0);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glDisableVertexAttribArray(ATTRIB_NORMAL);
+    glDisableVertexAttribArray(ATTRIB_INSTANCE);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Packs the instances of one kind that survived culling into visibleScratch, grouped by
+// LOD so each level is one contiguous run. The counting sort runs in blocks on the worker
+// pool: every block counts its LODs, a prefix sum gives each block its write positions per
+// level, and the blocks scatter in parallel (in id order inside each level, as serially).
+const int VEGETATION_BLOCK = 512;
+
+void buildVisibleInstances(VegetationBatch& batch, SceneType scene, ObjectKind kind) {
+    const InstanceStore& store = sceneInstances[scene];
+    const int begin = store.kindBegin[kind], end = store.kindEnd[kind];
+    const int blocks = (end - begin + VEGETATION_BLOCK - 1) / VEGETATION_BLOCK;
+    batch.blockOffsets.assign(blocks * LOD_COUNT, 0);
+    batch.blockNearest.assign(blocks * LOD_COUNT, RENDER_DEPTH_RANGE);
+
+    parallelFor(blocks, [&](int b) {
+        int* counts = &batch.blockOffsets[b * LOD_COUNT];
+        float* nearest = &batch.blockNearest[b * LOD_COUNT];
+        const int blockEnd = std::min(end, begin + (b + 1) * VEGETATION_BLOCK);
+        for (int id = begin + b * VEGETATION_BLOCK; id < blockEnd; ++id) {
+            if (!store.visible[id]) continue;
+            int lod = store.lod[id];
+            counts[lod]++;
+            nearest[lod] = std::min(nearest[lod], cameraDistance(store.posX[id], store.posY[id], store.posZ[id]));
+        }
+        });
+
+    int total = 0;
+    for (int lod = 0; lod < LOD_COUNT; ++lod) {
+        batch.lodFirst[lod] = total;
+        batch.lodNearest[lod] = RENDER_DEPTH_RANGE;
+        for (int b = 0; b < blocks; ++b) {
+            int& slot = batch.blockOffsets[b * LOD_COUNT + lod];
+            int count = slot;
+            slot = total;
+            total += count;
+            batch.lodNearest[lod] = std::min(batch.lodNearest[lod], batch.blockNearest[b * LOD_COUNT + lod]);
+        }
+        batch.lodCount[lod] = total - batch.lodFirst[lod];
+        frameStats.lodObjects[lod] += batch.lodCount[lod];
+    }
+
+    batch.visibleScratch.resize(total);
+    parallelFor(blocks, [&](int b) {
+        int* offsets = &batch.blockOffsets[b * LOD_COUNT];
+        const int blockEnd = std::min(end, begin + (b + 1) * VEGETATION_BLOCK);
+        for (int id = begin + b * VEGETATION_BLOCK; id < blockEnd; ++id) {
+            if (!store.visible[id]) continue;
+            batch.visibleScratch[offsets[store.lod[id]]++] = {
+                store.posX[id], store.posY[id], store.posZ[id], store.scaleX[id],
+                store.colorR[id], store.colorG[id], store.colorB[id], 1.0f
+            };
+        }
+        });
+    batch.instanceCount = total;
+}
+
+void uploadVisibleInstances(VegetationBatch& batch) {
+    if (batch.instanceCount == 0) return;
+    batch.instances = streamUpload(batch.visibleScratch.data(), batch.visibleScratch.size() * sizeof(TreeInstance));
+}
+
+void bindVegetationMaterial() {
+    stateUseProgram(vegetationProgram);
+    glUniform1f(glGetUniformLocation(vegetationProgram, "u_fog"), stateIsEnabled(GL_FOG) ? 1.0f : 0.0f);
+    bindShadowReceiver(vegetationProgram, true);
+}
+
+void unbindShaderMaterial() {
+    stateUseProgram(0);
+}
+
+// Trunks: one shared bark color. Canopies and rocks: per-instance color, one item per LOD level
+void drawVegetationItem(const DrawItem& item) {
+    GLint instanceColorLoc = glGetUniformLocation(vegetationProgram, "u_instanceColor");
+    if (item.mesh == &treeTrunkMesh) {
+        glUniform3f(glGetUniformLocation(vegetationProgram, "u_color"), 0.35f, 0.2f, 0.1f);
+        glUniform1f(instanceColorLoc, 0.0f);
+    }
+    else {
+        glUniform1f(instanceColorLoc, 1.0f);
+    }
+    drawInstancedMesh(*item.mesh, *(const VegetationBatch*)item.source, item.first, item.count);
+}
+
+void queueVegetationLods(const VegetationBatch& batch, const MeshVBO* lods) {
+    for (int lod = 0; lod < LOD_COUNT; ++lod) {
+        if (batch.lodCount[lod] > 0)
+            queueDraw(PASS_OPAQUE, MAT_VEGETATION, batch.lodNearest[lod], drawVegetationItem,
+                &lods[lod], &batch, batch.lodFirst[lod], batch.lodCount[lod]);
+    }
+}
+
+// The instance lists were built with the frame's draw lists (see buildDrawLists)
+void queueTrees(VegetationBatch& batch) {
+    if (!vegetationProgram) return;
+
+    uploadVisibleInstances(batch);
+    if (batch.instanceCount == 0) return;
+
+    float nearest = *std::min_element(batch.lodNearest, batch.lodNearest + LOD_COUNT);
+    queueDraw(PASS_OPAQUE, MAT_VEGETATION, nearest, drawVegetationItem, &treeTrunkMesh, &batch, 0, batch.instanceCount);
+    queueVegetationLods(batch, treeCanopyLods);
+}
+
+void queueRocks(VegetationBatch& batch) {
+    if (!vegetationProgram) return;
+
+    uploadVisibleInstances(batch);
+    if (batch.instanceCount == 0) return;
+
+    queueVegetationLods(batch, rockLods);
+}
+
+// Clouds: every puff of every cluster is one instance in a static buffer (see
+// createCloudLayer). The vertex shader turns the clusters around the ring from the time
+// uniform, so a frame costs the same two GL draws for 8 clusters or thousands. The GPU
+// clips what is off screen. LODs are fixed per draw: the near ring at one level, the
+// scattered extra clusters, which are further out, at a coarser one.
+const float CLOUD_DRIFT_SPEED = 0.03f;                                   // radians per second
+const float CLOUD_DRIFT_PERIOD = 2.0f * (float)M_PI / CLOUD_DRIFT_SPEED; // u_time wraps (keeps precision)
+const int   CLOUD_RING_CLUSTERS = 8;
+const int   CLOUD_RING_LOD = 1;
+const int   CLOUD_FAR_LOD = 2;
+const int   CLOUD_PUFFS = 3;                                             // spheres per cluster
+
+// a_instance = [angle at t = 0, ring radius, height, puff radius], a_offset = puff offset
+const char* cloudVertexSrc = R"(
+#version 120
+attribute vec3 a_position;
+attribute vec4 a_instance;
+attribute vec3 a_offset;
+uniform float u_time;
+uniform float u_driftSpeed;
+uniform vec3 u_color;
+varying vec3 v_color;
+varying vec3 v_world;
+varying float v_fogDepth;
+void main() {
+    float angle = a_instance.x + u_time * u_driftSpeed;
+    vec3 center = vec3(cos(angle) * a_instance.y, a_instance.z, sin(angle) * a_instance.y);
+    v_world = center + a_offset + a_position * a_instance.w;
+    vec4 eye = gl_ModelViewMatrix * vec4(v_world, 1.0);
+    v_color = u_color;
+    v_fogDepth = abs(eye.z);
+    gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+struct CloudPuff {
+    float angle, ringRadius, height, radius;
+    float offsetX, offsetY, offsetZ;
+};
+
+struct CloudLayer {
+    GLuint program = 0;
+    GLuint instanceVbo = 0;
+    int clusters = 0;
+    int puffs = 0;
+};
+CloudLayer cloudLayer;
+int cloudClusterCount = 8; // --clouds
+
+// Puffs [first, first + count) as instances of a sphere LOD mesh
+void drawCloudPuffs(const MeshVBO& mesh, int first, int count) {
+    bindMeshAttributes(mesh, false);
+
+    glBindBuffer(GL_ARRAY_BUFFER, cloudLayer.instanceVbo);
+    glEnableVertexAttribArray(ATTRIB_INSTANCE);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+    GLsizei stride = sizeof(CloudPuff);
+    size_t base = (size_t)first * sizeof(CloudPuff);
+    glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, stride, (void*)base);
+    glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(CloudPuff, offsetX)));
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+    glVertexAttribDivisor(ATTRIB_COLOR, 1);
+
+    drawMeshInstances(mesh, count);
+
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 0);
+    glVertexAttribDivisor(ATTRIB_COLOR, 0);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glDisableVertexAttribArray(ATTRIB_INSTANCE);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void bindCloudMaterial() {
+    GLuint program = cloudLayer.program;
+    stateUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "u_time"), fmodf(timeSeconds, CLOUD_DRIFT_PERIOD));
+    glUniform1f(glGetUniformLocation(program, "u_driftSpeed"), CLOUD_DRIFT_SPEED);
+    glUniform1f(glGetUniformLocation(program, "u_fog"), stateIsEnabled(GL_FOG) ? 1.0f : 0.0f);
+    bindShadowReceiver(program, false); // nothing casts onto the clouds
+
+    // Cloud color per scene
+    if (renderQueue.scene == ANCIENT_SCENE)
+        glUniform3f(glGetUniformLocation(program, "u_color"), 0.5f, 0.5f, 0.6f);   // darker, stormy-ish
+    else
+        glUniform3f(glGetUniformLocation(program, "u_color"), 0.98f, 0.98f, 0.99f); // bright white
+}
+
+void drawCloudItem(const DrawItem& item) {
+    drawCloudPuffs(*item.mesh, item.first, item.count);
+}
+
+// The ring and the scattered clusters sit at the far end of the view; they keep their
+// emission order among themselves
+void queueClouds(SceneType) {
+    if (!cloudLayer.program || cloudLayer.puffs == 0) return;
+
+    int ringPuffs = std::min(cloudLayer.puffs, CLOUD_RING_CLUSTERS * CLOUD_PUFFS);
+    queueDraw(PASS_OPAQUE, MAT_CLOUDS, RENDER_DEPTH_RANGE, drawCloudItem, &sphereLods[CLOUD_RING_LOD], nullptr, 0, ringPuffs);
+    if (cloudLayer.puffs > ringPuffs)
+        queueDraw(PASS_OPAQUE, MAT_CLOUDS, RENDER_DEPTH_RANGE, drawCloudItem, &sphereLods[CLOUD_FAR_LOD], nullptr,
+            ringPuffs, cloudLayer.puffs - ringPuffs);
+}
+
+// ---------------------- Mesh Optimization ----------------------
+
+// Runs while meshes are generated, before anything is uploaded:
+// - hidden faces: box faces lying inside, or flush against, another solid are clipped away
+//   (terrace bottoms, the covered middle of each terrace top, stair steps buried in the
+//   pyramid), so the rasterizer never sees them;
+// - vertex cache: nothing to reorder. Every generated mesh already loads each unique vertex
+//   exactly once through a VERTEX_CACHE_SIZE FIFO (strip-ordered spheres, flat box faces
+//   that share no vertices), the floor no triangle order can beat; uploadMesh() only
+//   reports the ACMR (see simulateAcmr);
+// - overdraw: the render queue sorts whole objects front to back, but a mesh draws in one
+//   call, so within it uploadMesh() puts the outward-facing patches (the lower terraces'
+//   walls, the temple) ahead of the surfaces they hide (see sortClustersOutward). The order
+//   is kept only when it leaves the ACMR where it was.
+bool meshOptimizeEnabled = true; // --no-mesh-optimize
+
+// Axis-aligned solid: a pyramid terrace, the temple, the plaza under them, a stair step
+struct SolidBox {
+    float lo[3], hi[3];
+};
+
+// Triangles before and after the hidden-face pass (bench report; zero when the scene came from the cache)
+struct HiddenFaceStats {
+    int trianglesBefore = 0;
+    int trianglesAfter = 0;
+    int facesRemoved = 0;      // wholly covered: their 2 triangles are gone
+    int facesSplit = 0;        // partly covered and cut into more than one rectangle
+    int trianglesAdded = 0;    // by those cuts (a terrace top around the terrace above becomes a
+                               // ring of 4 strips, 8 triangles, the fewest a ring can take)
+    double areaBefore = 0.0; // surface in square units, what the rasterizer has to cover
+    double areaAfter = 0.0;
+};
+HiddenFaceStats pyramidHiddenFaces, stairHiddenFaces;
+
+const float SOLID_EPSILON = 1e-4f;           // faces closer than this to a solid's boundary are flush with it
+const int   VERTEX_CACHE_SIZE = 32;          // post-transform cache modelled by the ACMR report
+
+// Faces of `box` not covered by any of `solids`, as [x y z nx ny nz] triangles wound
+// counter-clockwise from outside. A face is covered where the space just in front of it
+// is inside a solid; the uncovered part of each face is kept as a few rectangles.
+void addVisibleBoxFaces(std::vector<float>& data, const SolidBox& box, const std::vector<SolidBox>& solids,
+    HiddenFaceStats& stats)
+{
+    struct Rect { float u0, u1, v0, v1; };
+    std::vector<Rect> pieces, next;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        int u = (axis + 1) % 3, v = (axis + 2) % 3; // u x v = axis
+        for (int side = 0; side < 2; ++side) {
+            float plane = side ? box.hi[axis] : box.lo[axis];
+            float front = side ? plane + SOLID_EPSILON : plane - SOLID_EPSILON;
+
+            pieces.assign(1, { box.lo[u], box.hi[u], box.lo[v], box.hi[v] });
+            for (const SolidBox& solid : solids) {
+                if (front <= solid.lo[axis] || front >= solid.hi[axis]) continue;
+                next.clear();
+                for (const Rect& r : pieces) {
+                    if (solid.lo[u] >= r.u1 - SOLID_EPSILON || solid.hi[u] <= r.u0 + SOLID_EPSILON ||
+                        solid.lo[v] >= r.v1 - SOLID_EPSILON || solid.hi[v] <= r.v0 + SOLID_EPSILON) {
+                        next.push_back(r);
+                        continue;
+                    }
+                    // Up to four strips around the covered rectangle
+                    float cu0 = std::max(r.u0, solid.lo[u]), cu1 = std::min(r.u1, solid.hi[u]);
+                    if (cu0 > r.u0 + SOLID_EPSILON) next.push_back({ r.u0, cu0, r.v0, r.v1 });
+                    if (cu1 < r.u1 - SOLID_EPSILON) next.push_back({ cu1, r.u1, r.v0, r.v1 });
+                    if (solid.lo[v] > r.v0 + SOLID_EPSILON) next.push_back({ cu0, cu1, r.v0, solid.lo[v] });
+                    if (solid.hi[v] < r.v1 - SOLID_EPSILON) next.push_back({ cu0, cu1, solid.hi[v], r.v1 });
+                }
+                pieces.swap(next);
+            }
+
+            stats.trianglesBefore += 2;
+            stats.areaBefore += (double)(box.hi[u] - box.lo[u]) * (box.hi[v] - box.lo[v]);
+            if (pieces.empty()) stats.facesRemoved++;
+            if (pieces.size() > 1) {
+                stats.facesSplit++;
+                stats.trianglesAdded += 2 * ((int)pieces.size() - 1);
+            }
+            for (const Rect& r : pieces) {
+                float corners[4][2] = { { r.u0, r.v0 }, { r.u1, r.v0 }, { r.u1, r.v1 }, { r.u0, r.v1 } };
+                const int order[2][6] = { { 0, 2, 1, 0, 3, 2 }, { 0, 1, 2, 0, 2, 3 } }; // -axis, +axis
+                for (int k : order[side]) {
+                    float p[3], n[3] = { 0.0f, 0.0f, 0.0f };
+                    p[axis] = plane; p[u] = corners[k][0]; p[v] = corners[k][1];
+                    n[axis] = side ? 1.0f : -1.0f;
+                    data.insert(data.end(), { p[0], p[1], p[2], n[0], n[1], n[2] });
+                }
+                stats.trianglesAfter += 2;
+                stats.areaAfter += (double)(r.u1 - r.u0) * (r.v1 - r.v0);
+            }
+        }
+    }
+}
+
+// The terraces and the temple of buildPyramidData, plus the plaza they stand on (the
+// camera is not meant to go underground)
+void pyramidSolids(std::vector<SolidBox>& solids) {
+    for (int i = 0; i < PYRAMID_TERRACE_COUNT; ++i) {
+        float half = PYRAMID_BASE_HALF - i * PYRAMID_TERRACE_INSET;
+        solids.push_back({ { -half, i * PYRAMID_TERRACE_HEIGHT, -half },
+            { half, (i + 1) * PYRAMID_TERRACE_HEIGHT, half } });
+    }
+    float h = PYRAMID_TEMPLE_HALF;
+    float templeCenterY = PYRAMID_TEMPLE_CENTER_Y;
+    solids.push_back({ { -h, templeCenterY - PYRAMID_TEMPLE_HALF_HEIGHT, -h },
+        { h, templeCenterY + PYRAMID_TEMPLE_HALF_HEIGHT, h } });
+    solids.push_back({ { -1000.0f, -1000.0f, -1000.0f }, { 1000.0f, 0.0f, 1000.0f } });
+}
+
+// Average cache misses per triangle of a FIFO post-transform cache (1/3 ideal for large
+// smooth meshes, 3 with no reuse at all; boxes with flat faces bottom out at 2)
+float simulateAcmr(const std::vector<unsigned int>& indices, int vertexCount) {
+    if (indices.size() < 3) return 0.0f;
+    std::vector<int> insertedAt(vertexCount, -VERTEX_CACHE_SIZE - 1);
+    int misses = 0;
+    for (unsigned int index : indices) {
+        if (misses - insertedAt[index] <= VERTEX_CACHE_SIZE) continue; // still among the last N misses
+        insertedAt[index] = misses++;
+    }
+    return (float)misses / (float)(indices.size() / 3);
+}
+
+// ACMR of a [x y z nx ny nz] triangle list once identical vertices are welded, in the
+// order they were generated (what uploadMesh would see)
+float triangleListAcmr(const std::vector<float>& data) {
+    int vertexCount = (int)(data.size() / 6);
+    std::vector<int> order(vertexCount);
+    for (int v = 0; v < vertexCount; ++v) order[v] = v;
+    auto less = [&](int a, int b) { return memcmp(&data[a * 6], &data[b * 6], 6 * sizeof(float)) < 0; };
+    std::stable_sort(order.begin(), order.end(), less);
+
+    std::vector<int> canonical(vertexCount), remap(vertexCount, -1);
+    for (int j = 0; j < vertexCount; ++j) {
+        bool repeat = j > 0 && !less(order[j - 1], order[j]);
+        canonical[order[j]] = repeat ? canonical[order[j - 1]] : order[j];
+    }
+    std::vector<unsigned int> indices(vertexCount);
+    int unique = 0;
+    for (int v = 0; v < vertexCount; ++v) {
+        int c = canonical[v];
+        if (remap[c] < 0) remap[c] = unique++;
+        indices[v] = (unsigned int)remap[c];
+    }
+    return simulateAcmr(indices, unique);
+}
+
+// Reorders the triangles of `indices` so patches facing away from the mesh center draw
+// first: a front-facing outer wall then fills the depth buffer before the surfaces behind
+// it, from any side the camera looks. A patch (cluster) starts wherever a triangle misses
+// the cache on all three vertices, so reuse inside each patch survives the sort; returns
+// how many there were. `positions` holds x y z per vertex.
+int sortClustersOutward(std::vector<unsigned int>& indices, const std::vector<float>& positions, int vertexCount) {
+    int triangleCount = (int)(indices.size() / 3);
+    if (triangleCount < 2) return 0;
+
+    float center[3] = { 0.0f, 0.0f, 0.0f };
+    for (int v = 0; v < vertexCount; ++v)
+        for (int k = 0; k < 3; ++k) center[k] += positions[v * 3 + k] / (float)vertexCount;
+
+    struct Cluster { int first, count; float potential; };
+    std::vector<Cluster> clusters;
+    std::vector<int> insertedAt(vertexCount, -VERTEX_CACHE_SIZE - 1);
+    int misses = 0;
+    for (int t = 0; t < triangleCount; ++t) {
+        int triangleMisses = 0;
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = indices[t * 3 + k];
+            if (misses - insertedAt[v] <= VERTEX_CACHE_SIZE) continue;
+            insertedAt[v] = misses++;
+            ++triangleMisses;
+        }
+        if (t == 0 || triangleMisses == 3) clusters.push_back({ t, 0, 0.0f });
+        clusters.back().count++;
+    }
+    for (Cluster& cluster : clusters) {
+        float centroid[3] = { 0.0f, 0.0f, 0.0f }, normal[3] = { 0.0f, 0.0f, 0.0f };
+        for (int t = cluster.first; t < cluster.first + cluster.count; ++t) {
+            const float* p0 = &positions[indices[t * 3] * 3];
+            const float* p1 = &positions[indices[t * 3 + 1] * 3];
+            const float* p2 = &positions[indices[t * 3 + 2] * 3];
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            normal[0] += e1[1] * e2[2] - e1[2] * e2[1]; // area weighted
+            normal[1] += e1[2] * e2[0] - e1[0] * e2[2];
+            normal[2] += e1[0] * e2[1] - e1[1] * e2[0];
+            for (int k = 0; k < 3; ++k) centroid[k] += (p0[k] + p1[k] + p2[k]) / (3.0f * cluster.count);
+        }
+        float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 0.0f)
+            cluster.potential = ((centroid[0] - center[0]) * normal[0] + (centroid[1] - center[1]) * normal[1] +
+                (centroid[2] - center[2]) * normal[2]) / length;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+        [](const Cluster& a, const Cluster& b) { return a.potential > b.potential; });
+
+    std::vector<unsigned int> generated;
+    generated.swap(indices);
+    for (const Cluster& cluster : clusters)
+        indices.insert(indices.end(), generated.begin() + cluster.first * 3, generated.begin() + (cluster.first + cluster.count) * 3);
+    return (int)clusters.size();
+}
+
+// ---------------------- Static Batching ----------------------
+
+// Everything that never moves (stairs, rocks, dirt patches, temple details, fallen tree)
+// is baked once in initScene() into one interleaved [x y z nx ny nz] VBO per color.
+// The bake functions below keep the old glPushMatrix/glTranslatef style, but run
+// against a CPU-side matrix stack instead of emitting immediate-mode geometry.
+
+// Contiguous run of one object's triangles inside a batch (objectId = instance id, -1 = never culled).
+// Sphere parts are baked once per LOD level; lod -1 ranges are drawn at every level.
+struct BatchRange {
+    int first, count;
+    int objectId;
+    int lod;
+};
+
+struct StaticBatch {
+    MeshVBO mesh;
+    float r, g, b;
+    bool cullFace;
+    std::vector<BatchRange> ranges;
+};
+
+std::vector<StaticBatch> staticBatches[2]; // indexed by SceneType
+
+// CPU side of a static batch, as produced by the builder or read from the scene cache
+struct BakedBatch {
+    float r, g, b;
+    bool cullFace;
+    std::vector<float> data;
+    std::vector<BatchRange> ranges;
+};
+
+void uploadStaticBatch(SceneType scene, float r, float g, float b, bool cullFace,
+    const float* data, int vertexCount, const BatchRange* ranges, int rangeCount)
+{
+    StaticBatch batch;
+    batch.r = r; batch.g = g; batch.b = b;
+    batch.cullFace = cullFace;
+    batch.ranges.assign(ranges, ranges + rangeCount);
+    batch.mesh.vertexCount = vertexCount;
+
+    glGenBuffers(1, &batch.mesh.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, batch.mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, (size_t)vertexCount * 6 * sizeof(float), data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    staticBatches[scene].push_back(batch);
+}
+
+class StaticBatchBuilder {
+public:
+    StaticBatchBuilder() {
+        loadIdentity(current);
+    }
+
+    void pushMatrix() { stack.push_back(current); }
+    void popMatrix() { current = stack.back(); stack.pop_back(); }
+
+    void translate(float x, float y, float z) {
+        Matrix t;
+        loadIdentity(t);
+        t.m[12] = x; t.m[13] = y; t.m[14] = z;
+        multiply(t);
+    }
+
+    void scale(float x, float y, float z) {
+        Matrix t;
+        loadIdentity(t);
+        t.m[0] = x; t.m[5] = y; t.m[10] = z;
+        multiply(t);
+    }
+
+    // Same convention as glRotatef (degrees, arbitrary axis)
+    void rotate(float angleDegrees, float x, float y, float z) {
+        float len = sqrtf(x * x + y * y + z * z);
+        if (len <= 0.0f) return;
+        x /= len; y /= len; z /= len;
+
+        float a = angleDegrees * (float)M_PI / 180.0f;
+        float c = cosf(a), s = sinf(a), ic = 1.0f - c;
+
+        Matrix t;
+        loadIdentity(t);
+        t.m[0] = x * x * ic + c;     t.m[4] = x * y * ic - z * s; t.m[8] = x * z * ic + y * s;
+        t.m[1] = y * x * ic + z * s; t.m[5] = y * y * ic + c;     t.m[9] = y * z * ic - x * s;
+        t.m[2] = x * z * ic - y * s; t.m[6] = y * z * ic + x * s; t.m[10] = z * z * ic + c;
+        multiply(t);
+    }
+
+    void color(float r, float g, float b) {
+        cr = r; cg = g; cb = b;
+    }
+
+    void setCullFace(bool enabled) { cull = enabled; }
+
+    // Geometry emitted between beginObject/endObject becomes the drawable of one store instance
+    void beginObject(int instanceId) {
+        objects.push_back({ instanceId, 0, 0, 0, 0, 0, 0, false });
+        activeObject = (int)objects.size() - 1;
+    }
+
+    void endObject() { activeObject = -1; }
+
+    // Replacement for glutSolidCube
+    void solidCube(float size) {
+        std::vector<float> local;
+        float h = size * 0.5f;
+        SolidBox box;
+        if (occluders && worldBox(h, box)) {
+            addVisibleBoxFaces(local, box, *occluders, *occluderStats);
+            Matrix identity;
+            loadIdentity(identity);
+            appendTransformed(local, identity);
+            return;
+        }
+        addBox(local, h, h, h, 0.0f, 0.0f);
+        appendTransformed(local);
+    }
+
+    // Cubes emitted while set lose the faces hidden by `solids` (see addVisibleBoxFaces);
+    // only cubes that stay axis-aligned after the current transform are clipped
+    void setOccluders(const std::vector<SolidBox>* solids, HiddenFaceStats* stats) {
+        occluders = solids;
+        occluderStats = stats;
+    }
+
+    // Replacement for glutSolidSphere: baked at every LOD tessellation, the draw picks the object's current level
+    void solidSphereLod(float radius) {
+        for (int lod = 0; lod < LOD_COUNT; ++lod) {
+            std::vector<float> local;
+            addSphere(local, radius, sphereLodSlices[lod], sphereLodStacks[lod], 0.0f);
+            activeLod = lod;
+            appendTransformed(local);
+        }
+        activeLod = -1;
+    }
+
+    // Replacement for glBegin(GL_QUADS) ... glVertex3f ... glEnd: every 4 vertices form a quad
+    void vertex(float x, float y, float z) {
+        float* q = quad[quadCount++];
+        q[0] = x; q[1] = y; q[2] = z;
+        if (quadCount < 4) return;
+        quadCount = 0;
+
+        float ux = quad[1][0] - quad[0][0], uy = quad[1][1] - quad[0][1], uz = quad[1][2] - quad[0][2];
+        float vx = quad[2][0] - quad[0][0], vy = quad[2][1] - quad[0][1], vz = quad[2][2] - quad[0][2];
+        float nx = uy * vz - uz * vy;
+        float ny = uz * vx - ux * vz;
+        float nz = ux * vy - uy * vx;
+        float len = sqrtf(nx * nx + ny * ny + nz * nz);
+        if (len > 0.0f) { nx /= len; ny /= len; nz /= len; }
+
+        std::vector<float> local;
+        const int order[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int i : order) {
+            local.insert(local.end(), { quad[i][0], quad[i][1], quad[i][2], nx, ny, nz });
+        }
+        appendTransformed(local);
+    }
+
+    // One batch per (color, cull) bucket; the measured bounds become the instances' culling spheres
+    void build(std::vector<BakedBatch>& out, InstanceStore& store) {
+        std::vector<int> instanceIds;
+        for (const BakedObject& obj : objects) {
+            float cx = (obj.minX + obj.maxX) * 0.5f;
+            float cy = (obj.minY + obj.maxY) * 0.5f;
+            float cz = (obj.minZ + obj.maxZ) * 0.5f;
+            float ex = obj.maxX - cx, ey = obj.maxY - cy, ez = obj.maxZ - cz;
+            setInstanceBounds(store, obj.instanceId, cx, cy, cz, sqrtf(ex * ex + ey * ey + ez * ez));
+            instanceIds.push_back(obj.instanceId);
+        }
+
+        for (BakedBatch& bucket : buckets) {
+            for (BatchRange& range : bucket.ranges) {
+                if (range.objectId >= 0) range.objectId = instanceIds[range.objectId];
+            }
+            out.push_back(std::move(bucket));
+        }
+        buckets.clear();
+        objects.clear();
+    }
+
+private:
+    struct Matrix { float m[16]; }; // column-major, like OpenGL
+
+    struct BakedObject {
+        int instanceId;
+        float minX, minY, minZ, maxX, maxY, maxZ;
+        bool hasBounds;
+    };
+
+    static void loadIdentity(Matrix& mat) {
+        for (int i = 0; i < 16; ++i) mat.m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+    }
+
+    void multiply(const Matrix& t) {
+        Matrix r;
+        for (int col = 0; col < 4; ++col)
+            for (int row = 0; row < 4; ++row) {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; ++k)
+                    sum += current.m[k * 4 + row] * t.m[col * 4 + k];
+                r.m[col * 4 + row] = sum;
+            }
+        current = r;
+    }
+
+    // Bucket ranges use objectId = index into objects until build()
+    BakedBatch& currentBucket() {
+        for (BakedBatch& bucket : buckets) {
+            if (bucket.r == cr && bucket.g == cg && bucket.b == cb && bucket.cullFace == cull)
+                return bucket;
+        }
+        buckets.push_back({ cr, cg, cb, cull, {}, {} });
+        return buckets.back();
+    }
+
+    // World bounds of the cube [-h, h]^3 under the current matrix, if its faces stay axis-aligned
+    bool worldBox(float h, SolidBox& box) const {
+        const float* m = current.m;
+        for (int col = 0; col < 3; ++col) {
+            int axes = 0;
+            for (int row = 0; row < 3; ++row) axes += fabsf(m[col * 4 + row]) > 1e-5f;
+            if (axes != 1) return false;
+        }
+        for (int row = 0; row < 3; ++row) {
+            float extent = h * (fabsf(m[row]) + fabsf(m[4 + row]) + fabsf(m[8 + row]));
+            box.lo[row] = m[12 + row] - extent;
+            box.hi[row] = m[12 + row] + extent;
+        }
+        return true;
+    }
+
+    void appendTransformed(const std::vector<float>& local) {
+        appendTransformed(local, current);
+    }
+
+    // Transform interleaved local vertices by `mat` into the active bucket
+    void appendTransformed(const std::vector<float>& local, const Matrix& mat) {
+        const float* m = mat.m;
+
+        // Normal matrix = cofactor of the upper 3x3 (inverse-transpose up to scale)
+        float n[9] = {
+            m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+            m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+            m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]
+        };
+
+        BakedBatch& bucket = currentBucket();
+        std::vector<float>& data = bucket.data;
+        int firstVertex = (int)(data.size() / 6);
+        int vertexCount = (int)(local.size() / 6);
+
+        // Extend the bucket's last range when the same object keeps emitting
+        if (!bucket.ranges.empty() && bucket.ranges.back().objectId == activeObject &&
+            bucket.ranges.back().lod == activeLod &&
+            bucket.ranges.back().first + bucket.ranges.back().count == firstVertex)
+            bucket.ranges.back().count += vertexCount;
+        else
+            bucket.ranges.push_back({ firstVertex, vertexCount, activeObject, activeLod });
+
+        for (size_t i = 0; i + 5 < local.size(); i += 6) {
+            float x = local[i], y = local[i + 1], z = local[i + 2];
+            float nx = local[i + 3], ny = local[i + 4], nz = local[i + 5];
+
+            float tx = n[0] * nx + n[3] * ny + n[6] * nz;
+            float ty = n[1] * nx + n[4] * ny + n[7] * nz;
+            float tz = n[2] * nx + n[5] * ny + n[8] * nz;
+            float len = sqrtf(tx * tx + ty * ty + tz * tz);
+            if (len > 0.0f) { tx /= len; ty /= len; tz /= len; }
+
+            float wx = m[0] * x + m[4] * y + m[8] * z + m[12];
+            float wy = m[1] * x + m[5] * y + m[9] * z + m[13];
+            float wz = m[2] * x + m[6] * y + m[10] * z + m[14];
+            data.insert(data.end(), { wx, wy, wz, tx, ty, tz });
+
+            if (activeObject >= 0) {
+                BakedObject& obj = objects[activeObject];
+                if (!obj.hasBounds) {
+                    obj.minX = obj.maxX = wx; obj.minY = obj.maxY = wy; obj.minZ = obj.maxZ = wz;
+                    obj.hasBounds = true;
+                }
+                obj.minX = std::min(obj.minX, wx); obj.maxX = std::max(obj.maxX, wx);
+                obj.minY = std::min(obj.minY, wy); obj.maxY = std::max(obj.maxY, wy);
+                obj.minZ = std::min(obj.minZ, wz); obj.maxZ = std::max(obj.maxZ, wz);
+            }
+        }
+    }
+
+    Matrix current;
+    std::vector<Matrix> stack;
+    float cr = 1.0f, cg = 1.0f, cb = 1.0f;
+    bool cull = true;
+    float quad[4][3] = {};
+    int quadCount = 0;
+    std::vector<BakedBatch> buckets;
+    std::vector<BakedObject> objects;
+    int activeObject = -1;
+    int activeLod = -1;
+    const std::vector<SolidBox>* occluders = nullptr;
+    HiddenFaceStats* occluderStats = nullptr;
+};
+
+// Each batch draws only the ranges of visible objects, merged into one glMultiDrawArrays.
+// The merged runs are copied into the frame arena; the item points at them.
+struct StaticBatchDraw {
+    const StaticBatch* batch;
+    const GLint* firsts;
+    const GLsizei* counts;
+    int runs;
+    long long vertices;
+};
+
+void bindStaticBatchMaterial() {
+    stateDisable(GL_LIGHTING);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+}
+
+void unbindStaticBatchMaterial() {
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    stateEnable(GL_CULL_FACE);
+    stateEnable(GL_LIGHTING);
+}
+
+void drawStaticBatchItem(const DrawItem& item) {
+    const StaticBatchDraw& draw = *(const StaticBatchDraw*)item.source;
+    const StaticBatch& batch = *draw.batch;
+    GLsizei stride = 6 * sizeof(GLfloat);
+
+    if (batch.cullFace) stateEnable(GL_CULL_FACE);
+    else                stateDisable(GL_CULL_FACE);
+
+    stateColor(batch.r, batch.g, batch.b);
+    glBindBuffer(GL_ARRAY_BUFFER, batch.mesh.vbo);
+    glVertexPointer(3, GL_FLOAT, stride, (void*)0);
+    glNormalPointer(GL_FLOAT, stride, (void*)(3 * sizeof(GLfloat)));
+    glMultiDrawArrays(GL_TRIANGLES, draw.firsts, draw.counts, draw.runs);
+    countDraw(draw.vertices);
+}
+
+// The visible runs of one batch, built off the GL thread (see buildDrawLists)
+struct StaticBatchList {
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    long long vertices = 0;
+    float nearest = 0.0f;
+    int lodObjects[LOD_COUNT] = {};
+};
+std::vector<StaticBatchList> staticBatchLists[2]; // indexed by SceneType, one per batch
+
+// One job per batch on the worker pool
+void buildStaticBatchLists(SceneType scene) {
+    const InstanceStore& store = sceneInstances[scene];
+    const std::vector<StaticBatch>& batches = staticBatches[scene];
+    std::vector<StaticBatchList>& lists = staticBatchLists[scene];
+    lists.resize(batches.size());
+
+    parallelFor((int)batches.size(), [&](int b) {
+        StaticBatchList& list = lists[b];
+        list.firsts.clear();
+        list.counts.clear();
+        list.vertices = 0;
+        list.nearest = RENDER_DEPTH_RANGE;
+        std::fill(list.lodObjects, list.lodObjects + LOD_COUNT, 0);
+        for (const BatchRange& range : batches[b].ranges) {
+            if (!objectVisible(scene, range.objectId)) continue;
+            bool owned = range.objectId >= 0; // -1: baked outside any object, never culled
+            if (range.lod >= 0) {
+                if (range.lod != (owned ? store.lod[range.objectId] : 0)) continue;
+                list.lodObjects[range.lod]++;
+            }
+
+            if (!list.firsts.empty() && list.firsts.back() + list.counts.back() == range.first)
+                list.counts.back() += range.count;
+            else {
+                list.firsts.push_back(range.first);
+                list.counts.push_back(range.count);
+            }
+            list.vertices += range.count;
+            // Unowned geometry has no bounds to measure; it sorts with the nearest
+            list.nearest = std::min(list.nearest, owned ? instanceDepth(store, range.objectId) : 0.0f);
+        }
+        });
+
+    for (const StaticBatchList& list : lists)
+        for (int lod = 0; lod < LOD_COUNT; ++lod) frameStats.lodObjects[lod] += list.lodObjects[lod];
+}
+
+void queueStaticBatches(SceneType scene) {
+    const std::vector<StaticBatch>& batches = staticBatches[scene];
+    const std::vector<StaticBatchList>& lists = staticBatchLists[scene];
+
+    for (size_t b = 0; b < lists.size(); ++b) {
+        const StaticBatchList& list = lists[b];
+        if (list.firsts.empty()) continue;
+
+        int runs = (int)list.firsts.size();
+        StaticBatchDraw* draw = renderQueue.arena.allocate<StaticBatchDraw>(1);
+        GLint* drawFirsts = renderQueue.arena.allocate<GLint>(runs);
+        GLsizei* drawCounts = renderQueue.arena.allocate<GLsizei>(runs);
+        memcpy(drawFirsts, list.firsts.data(), runs * sizeof(GLint));
+        memcpy(drawCounts, list.counts.data(), runs * sizeof(GLsizei));
+        *draw = { &batches[b], drawFirsts, drawCounts, runs, list.vertices };
+        queueDraw(PASS_OPAQUE, MAT_STATIC_BATCH, list.nearest, drawStaticBatchItem, &batches[b].mesh, draw, 0, (int)list.vertices);
+    }
+}
+
+// Placement (scaleX = trunk length, yaw) comes from the instance store
+void bakeFallenTree(StaticBatchBuilder& b, const InstanceStore& store, int id) {
+    float length = store.scaleX[id];
+
+    b.beginObject(id);
+    b.pushMatrix();
+    b.translate(store.posX[id], store.posY[id], store.posZ[id]);
+    b.rotate(store.yaw[id], 0.0f, 1.0f, 0.0f);
+    b.rotate(-20.0f, 0.0f, 0.0f, 1.0f); // slight tilt to “lean”
+
+    // Trunk
+    b.color(0.28f, 0.18f, 0.10f);
+    b.pushMatrix();
+    b.translate(0.0f, 1.0f, 0.0f);
+    b.scale(length, 0.6f, 0.6f);
+    b.solidCube(1.0);
+    b.popMatrix();
+
+    // Some leaves at one end
+    b.color(0.05f, 0.25f, 0.05f);
+    b.pushMatrix();
+    b.translate(length * 0.5f, 1.3f, 0.0f);
+    b.scale(2.0f, 1.5f, 2.0f);
+    b.solidSphereLod(0.8f);
+    b.popMatrix();
+
+    b.popMatrix();
+    b.endObject();
+}
+
+
+// ---------------- "Dirty" ground for ancient scene ----------------
+
+// Darker ground patches near the pyramid to make it look worn / dirty
+void bakeAncientGroundPatches(StaticBatchBuilder& b, const InstanceStore& store)
+{
+    for (int id = store.kindBegin[OBJ_PATCH]; id < store.kindEnd[OBJ_PATCH]; ++id) {
+        b.color(store.colorR[id], store.colorG[id], store.colorB[id]);
+        b.beginObject(id);
+        b.pushMatrix();
+        b.translate(store.posX[id], store.posY[id], store.posZ[id]);    // slightly above the big ground cube
+        b.scale(store.scaleX[id], store.scaleY[id], store.scaleZ[id]);
+        b.solidCube(1.0f);
+        b.popMatrix();
+        b.endObject();
+    }
+}
+
+// ---------- Full-height staircases inspired by El Castillo ----------
+
+void bakeOneStaircase(StaticBatchBuilder& b, const InstanceStore& store, int id) {
+    const float baseHalf = 12.5f;       // match pyramid base
+    const float terraceHeight = 1.2f;
+    const int   terraceCount = 12;
+    const float pyramidHeight = terraceCount * terraceHeight;
+
+    const int   stepCount = 30;
+    const float stepHeight = pyramidHeight / (float)stepCount;
+    const float baseZStart = baseHalf + 1.2f;
+    const float baseZEnd = baseHalf - 10.0f;
+    const float stepDepth = 1.2f;
+
+    // Stop the stairs a bit before the very top so they don't overlap the temple, very big problem, readjusted for hours
+    const float maxStairY = pyramidHeight - stepHeight * 3.0f;
+
+    b.beginObject(id);
+    b.pushMatrix();
+    b.translate(store.posX[id], store.posY[id], store.posZ[id]);
+    b.rotate(store.yaw[id], 0.0f, 1.0f, 0.0f);
+
+    b.color(store.colorR[id], store.colorG[id], store.colorB[id]); // slightly lighter to stand out from terraces
+
+    for (int i = 0; i < stepCount; ++i) {
+        float t = (float)i / (float)(stepCount - 1);
+
+        float y = 0.3f + (i + 0.5f) * stepHeight;
+        float z = baseZStart + (baseZEnd - baseZStart) * t;
+        float width = 7.0f - t * 3.0f; // staircase becomes narrower near the top
+
+        // Clamp stair generation so we don't reach into the temple
+        if (y > maxStairY)
+            break;
+
+        b.pushMatrix();
+        b.translate(0.0f, y, z);
+        b.scale(width, stepHeight * 0.9f, stepDepth);
+        b.solidCube(1.0);
+        b.popMatrix();
+    }
+
+    b.popMatrix();
+    b.endObject();
+}
+
+
+
+void bakeStairs(StaticBatchBuilder& b, const InstanceStore& store) {
+    // Most of every step is buried in the terraces
+    std::vector<SolidBox> pyramid;
+    pyramidSolids(pyramid);
+    if (meshOptimizeEnabled) b.setOccluders(&pyramid, &stairHiddenFaces);
+
+    for (int id = store.kindBegin[OBJ_STAIRCASE]; id < store.kindEnd[OBJ_STAIRCASE]; ++id)
+        bakeOneStaircase(b, store, id);
+    b.setOccluders(nullptr, nullptr);
+}
+
+
+// ---------------- Temple entrance + decorative details ----------------
+
+void bakeTempleDetails(StaticBatchBuilder& b, SceneType scene, const InstanceStore& store)
+{
+    // ---- Temple geometry (the same box buildPyramidData and pyramidSolids use) ----
+
+    const float templeHalfSize = PYRAMID_TEMPLE_HALF;
+    const float templeCenterY = PYRAMID_TEMPLE_CENTER_Y;
+
+    // Small epsilon so quads are slightly in front of temple faces
+    const float eps = 0.05f;
+
+    // ---------------- Common colors ----------------
+    GLfloat doorColorAncient[3] = { 0.03f, 0.03f, 0.03f };
+    GLfloat doorColorModern[3] = { 0.10f, 0.10f, 0.10f };
+    GLfloat frameColorAncient[3] = { 0.65f, 0.63f, 0.60f };
+    GLfloat frameColorModern[3] = { 0.98f, 0.96f, 0.92f };
+
+    b.beginObject(store.kindBegin[OBJ_TEMPLE]);
+    b.setCullFace(false);   // so all quads are visible from any side
+
+    // Helper lambdas to pick colors
+    auto setDoorColor = [&]() {
+        if (scene == ANCIENT_SCENE)
+            b.color(doorColorAncient[0], doorColorAncient[1], doorColorAncient[2]);
+        else
+            b.color(doorColorModern[0], doorColorModern[1], doorColorModern[2]);
+        };
+
+    auto setFrameColor = [&]() {
+        if (scene == ANCIENT_SCENE)
+            b.color(frameColorAncient[0], frameColorAncient[1], frameColorAncient[2]);
+        else
+            b.color(frameColorModern[0], frameColorModern[1], frameColorModern[2]);
+        };
+
+    // ---------------- Main front entrance (+Z) ----------------
+    {
+        float doorHalfWidth = 1.4f;
+        float doorBottomY = templeCenterY - 1.5f;
+        float doorTopY = templeCenterY + 0.5f;
+        float zFront = templeHalfSize + eps;
+
+        // Door opening
+        setDoorColor();
+        b.vertex(-doorHalfWidth, doorBottomY, zFront);
+        b.vertex(doorHalfWidth, doorBottomY, zFront);
+        b.vertex(doorHalfWidth, doorTopY, zFront);
+        b.vertex(-doorHalfWidth, doorTopY, zFront);
+
+        // Frame
+        setFrameColor();
+        float frameDepth = 0.25f;
+
+        // Top lintel
+        b.vertex(-doorHalfWidth - 0.3f, doorTopY + 0.25f, zFront);
+        b.vertex(doorHalfWidth + 0.3f, doorTopY + 0.25f, zFront);
+        b.vertex(doorHalfWidth + 0.3f, doorTopY + 0.75f, zFront + frameDepth);
+        b.vertex(-doorHalfWidth - 0.3f, doorTopY + 0.75f, zFront + frameDepth);
+
+        // Left column
+        b.vertex(-doorHalfWidth - 0.3f, doorBottomY - 0.1f, zFront);
+        b.vertex(-doorHalfWidth, doorBottomY - 0.1f, zFront);
+        b.vertex(-doorHalfWidth, doorTopY + 0.8f, zFront + frameDepth);
+        b.vertex(-doorHalfWidth - 0.3f, doorTopY + 0.8f, zFront + frameDepth);
+
+        // Right column
+        b.vertex(doorHalfWidth, doorBottomY - 0.1f, zFront);
+        b.vertex(doorHalfWidth + 0.3f, doorBottomY - 0.1f, zFront);
+        b.vertex(doorHalfWidth + 0.3f, doorTopY + 0.8f, zFront + frameDepth);
+        b.vertex(doorHalfWidth, doorTopY + 0.8f, zFront + frameDepth);
+    }
+
+    // ----------- Helper for smaller side/back entrances ---------
+    auto bakeSmallEntranceZ = [&](bool backSide) {
+        // backSide == false → +Z, true → -Z
+        float doorHalfWidth = 0.9f;
+        float doorBottomY = templeCenterY - 1.0f;
+        float doorTopY = templeCenterY + 0.2f;
+        float zSign = backSide ? -1.0f : 1.0f;
+        float zFace = zSign * (templeHalfSize + eps);
+        float frameDepth = 0.20f;
+
+        // Door
+        setDoorColor();
+        b.vertex(-doorHalfWidth, doorBottomY, zFace);
+        b.vertex(doorHalfWidth, doorBottomY, zFace);
+        b.vertex(doorHalfWidth, doorTopY, zFace);
+        b.vertex(-doorHalfWidth, doorTopY, zFace);
+
+        // Simple frame strip around
+        setFrameColor();
+        // Top strip
+        b.vertex(-doorHalfWidth - 0.2f, doorTopY + 0.15f, zFace);
+        b.vertex(doorHalfWidth + 0.2f, doorTopY + 0.15f, zFace);
+        b.vertex(doorHalfWidth + 0.2f, doorTopY + 0.40f, zFace + zSign * frameDepth);
+        b.vertex(-doorHalfWidth - 0.2f, doorTopY + 0.40f, zFace + zSign * frameDepth);
+        };
+
+    auto bakeSmallEntranceX = [&](bool rightSide) {
+        // rightSide == false → -X, true → +X
+        float doorHalfWidth = 0.9f;
+        float doorBottomY = templeCenterY - 1.0f;
+        float doorTopY = templeCenterY + 0.2f;
+        float xSign = rightSide ? 1.0f : -1.0f;
+        float xFace = xSign * (templeHalfSize + eps);
+        float frameDepth = 0.20f;
+
+        // Door
+        setDoorColor();
+        b.vertex(xFace, doorBottomY, -doorHalfWidth);
+        b.vertex(xFace, doorBottomY, doorHalfWidth);
+        b.vertex(xFace, doorTopY, doorHalfWidth);
+        b.vertex(xFace, doorTopY, -doorHalfWidth);
+
+        // Top strip
+        setFrameColor();
+        b.vertex(xFace, doorTopY + 0.15f, -doorHalfWidth - 0.2f);
+        b.vertex(xFace, doorTopY + 0.15f, doorHalfWidth + 0.2f);
+        b.vertex(xFace + xSign * frameDepth, doorTopY + 0.40f, doorHalfWidth + 0.2f);
+        b.vertex(xFace + xSign * frameDepth, doorTopY + 0.40f, -doorHalfWidth - 0.2f);
+        };
+
+    // Back (-Z), Left (-X), Right (+X)
+    bakeSmallEntranceZ(true);   // back side
+    bakeSmallEntranceX(false);  // left side
+    bakeSmallEntranceX(true);   // right side
+
+    // ---------------- Dark band around temple top ----------------
+    float bandTopY = templeCenterY + templeHalfSize - 0.2f;
+    float bandBottomY = bandTopY - 0.4f;
+    float bandHalfX = templeHalfSize + 0.05f;
+    float bandHalfZ = templeHalfSize + 0.05f;
+
+    if (scene == ANCIENT_SCENE)
+        b.color(0.35f, 0.35f, 0.36f);
+    else
+        b.color(0.45f, 0.45f, 0.47f);
+
+    // Front
+    b.vertex(-bandHalfX, bandBottomY, bandHalfZ);
+    b.vertex(bandHalfX, bandBottomY, bandHalfZ);
+    b.vertex(bandHalfX, bandTopY, bandHalfZ);
+    b.vertex(-bandHalfX, bandTopY, bandHalfZ);
+
+    // Back
+    b.vertex(-bandHalfX, bandBottomY, -bandHalfZ);
+    b.vertex(-bandHalfX, bandTopY, -bandHalfZ);
+    b.vertex(bandHalfX, bandTopY, -bandHalfZ);
+    b.vertex(bandHalfX, bandBottomY, -bandHalfZ);
+
+    // Left
+    b.vertex(-bandHalfX, bandBottomY, -bandHalfZ);
+    b.vertex(-bandHalfX, bandBottomY, bandHalfZ);
+    b.vertex(-bandHalfX, bandTopY, bandHalfZ);
+    b.vertex(-bandHalfX, bandTopY, -bandHalfZ);
+
+    // Right
+    b.vertex(bandHalfX, bandBottomY, -bandHalfZ);
+    b.vertex(bandHalfX, bandTopY, -bandHalfZ);
+    b.vertex(bandHalfX, bandTopY, bandHalfZ);
+    b.vertex(bandHalfX, bandBottomY, bandHalfZ);
+
+    b.setCullFace(true);
+    b.endObject();
+}
+
+
+// ---------------------- Jungle Generator ----------------------
+
+// Seeded blue-noise placement of the ancient scene's trees, rocks and fallen logs over the
+// whole ground. The ground is split into square tiles; each tile runs Bridson's Poisson-disk
+// sampling on its own seeded RNG, and all tiles share one background grid (cell = r / sqrt 2,
+// aligned to the tile edges, so every cell belongs to exactly one tile). Tiles are processed
+// in four phases by (tx % 2, tz % 2): tiles of one phase are never adjacent, so they run on
+// worker threads without locks, and each sees the final points of its earlier-phase
+// neighbors. The output only depends on the seed, not on the thread count.
+
+enum JunglePlantKind { PLANT_TREE, PLANT_ROCK, PLANT_LOG };
+
+struct JunglePlant {
+    float x, z;
+    float scale;      // tree/rock size, log length
+    float yaw;        // degrees, logs only
+    float r, g, b;
+    unsigned char kind;
+};
+
+struct JungleParams {
+    unsigned seed = 20121221;
+    float extent = 100.0f;        // square [-extent, extent], same as the ground
+    float tileSize = 20.0f;
+    float minDistance = 4.0f;     // Poisson-disk radius between any two plants
+    float clearingRadius = 30.0f; // pyramid, stairs and the hand-placed rock ring
+    float pathHalfWidth = 5.0f;   // open approach in front of the north stairs (+Z)
+    int candidates = 16;          // Bridson's k
+};
+
+struct JungleStats {
+    int plants = 0;
+    int perKind[3] = {};
+    int threads = 0;
+    double ms = 0.0;
+};
+
+// splitmix64: tiny, fast and good enough for placement
+struct Rng {
+    unsigned long long state;
+
+    explicit Rng(unsigned long long seed) : state(seed) {}
+
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    float uniform() { return (float)(next() >> 40) * (1.0f / 16777216.0f); } // [0, 1)
+    float range(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+};
+
+bool jungleExcluded(const JungleParams& p, float x, float z) {
+    if (x * x + z * z < p.clearingRadius * p.clearingRadius) return true;
+    return z > 0.0f && fabsf(x) < p.pathHalfWidth;
+}
+
+JunglePlant makeJunglePlant(Rng& rng, float x, float z) {
+    JunglePlant plant = { x, z, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, PLANT_TREE };
+    float roll = rng.uniform();
+
+    if (roll < 0.85f) {
+        // Canopy greens from dark to slightly yellow
+        float shade = rng.uniform();
+        plant.kind = PLANT_TREE;
+        plant.scale = rng.range(0.8f, 1.6f);
+        plant.r = 0.03f + 0.05f * shade;
+        plant.g = 0.18f + 0.14f * shade;
+        plant.b = 0.04f + 0.03f * rng.uniform();
+    }
+    else if (roll < 0.97f) {
+        // Weathered gray, some with a hint of moss
+        float gray = rng.range(0.32f, 0.46f);
+        plant.kind = PLANT_ROCK;
+        plant.scale = rng.range(0.5f, 1.4f);
+        plant.r = gray;
+        plant.g = gray + rng.range(0.0f, 0.05f);
+        plant.b = gray + 0.02f;
+    }
+    else {
+        plant.kind = PLANT_LOG;
+        plant.scale = rng.range(3.5f, 6.5f);
+        plant.yaw = rng.range(0.0f, 360.0f);
+        plant.r = 0.28f; plant.g = 0.18f; plant.b = 0.10f;
+    }
+    return plant;
+}
+
+// Poisson-disk radius that yields roughly `count` plants over the usable ground
+float jungleSpacingForCount(const JungleParams& p, int count) {
+    float side = 2.0f * p.extent;
+    float area = side * side - (float)M_PI * p.clearingRadius * p.clearingRadius
+        - 2.0f * p.pathHalfWidth * (p.extent - p.clearingRadius);
+    const float packing = 0.84f; // the sampler fills about this many points per r^2
+    return sqrtf(packing * std::max(area, 1.0f) / (float)std::max(count, 1));
+}
+
+std::vector<JunglePlant> generateJungle(const JungleParams& p, JungleStats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+
+    const int tiles = std::max(1, (int)ceilf(2.0f * p.extent / p.tileSize));
+    const float tileSize = 2.0f * p.extent / (float)tiles;
+    const float r = std::min(p.minDistance, tileSize); // neighbors must stay within one tile
+    const int cellsPerTile = std::max(1, (int)ceilf(tileSize / (r / sqrtf(2.0f))));
+    const float cell = tileSize / (float)cellsPerTile;
+    const int cells = tiles * cellsPerTile;
+
+    // Background grid: point per cell (at most one, since cell diagonal <= r)
+    std::vector<float> gridX(cells * cells), gridZ(cells * cells);
+    std::vector<unsigned char> gridUsed(cells * cells, 0);
+    std::vector<std::vector<JunglePlant>> tilePlants(tiles * tiles);
+
+    std::vector<float> ringCos(p.candidates), ringSin(p.candidates);
+    for (int k = 0; k < p.candidates; ++k) {
+        ringCos[k] = cosf(2.0f * (float)M_PI * k / p.candidates);
+        ringSin[k] = sinf(2.0f * (float)M_PI * k / p.candidates);
+    }
+
+    auto sampleTile = [&](int tileIndex) {
+        int tx = tileIndex % tiles, tz = tileIndex / tiles;
+        float x0 = -p.extent + tx * tileSize, z0 = -p.extent + tz * tileSize;
+        Rng rng(((unsigned long long)p.seed << 32) ^ (unsigned long long)(tileIndex * 2654435761u + 1));
+        std::vector<JunglePlant>& out = tilePlants[tileIndex];
+        std::vector<int> active;
+
+        auto accept = [&](float x, float z) {
+            if (x < x0 || x >= x0 + tileSize || z < z0 || z >= z0 + tileSize) return false;
+            if (jungleExcluded(p, x, z)) return false;
+            // Cell index relative to the tile, so rounding can never land in a neighbor's cells
+            int cx = tx * cellsPerTile + std::min(cellsPerTile - 1, (int)((x - x0) / cell));
+            int cz = tz * cellsPerTile + std::min(cellsPerTile - 1, (int)((z - z0) / cell));
+            for (int j = std::max(0, cz - 2); j <= std::min(cells - 1, cz + 2); ++j)
+                for (int i = std::max(0, cx - 2); i <= std::min(cells - 1, cx + 2); ++i) {
+                    int c = j * cells + i;
+                    if (!gridUsed[c]) continue;
+                    float dx = gridX[c] - x, dz = gridZ[c] - z;
+                    if (dx * dx + dz * dz < r * r) return false;
+                }
+            int c = cz * cells + cx;
+            gridUsed[c] = 1;
+            gridX[c] = x;
+            gridZ[c] = z;
+            active.push_back((int)out.size());
+            out.push_back(makeJunglePlant(rng, x, z));
+            return true;
+            };
+
+        // Several seed darts, so tiles cut by the clearing or the path fill on both sides
+        for (int seedTry = 0; seedTry < p.candidates; ++seedTry) {
+            accept(rng.range(x0, x0 + tileSize), rng.range(z0, z0 + tileSize));
+
+            while (!active.empty()) {
+                int slot = std::min((int)active.size() - 1, (int)(rng.uniform() * active.size()));
+                const JunglePlant& from = out[active[slot]];
+                float fx = from.x, fz = from.z;
+
+                // Candidates evenly spaced on a circle just outside r, from a random start angle
+                // (denser and much cheaper than random points in the [r, 2r] annulus)
+                float base = rng.range(0.0f, 2.0f * (float)M_PI);
+                float cb = cosf(base) * r * 1.0001f, sb = sinf(base) * r * 1.0001f;
+                bool spawned = false;
+                for (int k = 0; k < p.candidates && !spawned; ++k) {
+                    float c = ringCos[k], s = ringSin[k];
+                    spawned = accept(fx + cb * c - sb * s, fz + sb * c + cb * s);
+                }
+                if (!spawned) {
+                    active[slot] = active.back();
+                    active.pop_back();
+                }
+            }
+        }
+        };
+
+    int threads = 1;
+    for (int phase = 0; phase < 4; ++phase) {
+        std::vector<int> phaseTiles;
+        for (int tz = phase / 2; tz < tiles; tz += 2)
+            for (int tx = phase % 2; tx < tiles; tx += 2)
+                phaseTiles.push_back(tz * tiles + tx);
+        threads = std::max(threads, parallelFor((int)phaseTiles.size(), [&](int i) { sampleTile(phaseTiles[i]); }));
+    }
+
+    std::vector<JunglePlant> plants;
+    for (const std::vector<JunglePlant>& tile : tilePlants)
+        plants.insert(plants.end(), tile.begin(), tile.end());
+
+    if (stats) {
+        *stats = JungleStats();
+        stats->plants = (int)plants.size();
+        for (const JunglePlant& plant : plants) stats->perKind[plant.kind]++;
+        stats->threads = threads;
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return plants;
+}
+
+// ---------------------- Terrain ----------------------
+
+// Heightfield terrain far past the old 200x200 ground cube. Heights (and a precomputed
+// slope shade) live in one float texture, 1 sample per unit; the ground is cut into square
+// chunks that all share a few flat grid meshes, one per LOD level (32, 16, 8, 4, 2 quads a
+// side). Each chunk knows the worst height error of every level; per frame the visible
+// chunks take the coarsest level whose error, at their distance from the camera, stays
+// under TERRAIN_MAX_ERROR_PIXELS (so the flat plaza is always coarse), and are drawn with
+// one instanced call per level. Only the chunk list is uploaded per frame.
+// Seams are crack-free without skirts: edge vertices facing a coarser neighbor snap to
+// the straight line between that neighbor's vertices. The plaza around the pyramid is
+// flat at the old ground height; hills fade in past the jungle clearing.
+
+const float TERRAIN_EXTENT = 512.0f;           // square [-extent, extent]
+const int   TERRAIN_SAMPLES = 1025;            // heights per side (1 unit apart)
+const float TERRAIN_CHUNK_SIZE = 32.0f;
+const int   TERRAIN_CHUNKS = 32;               // per side
+const int   TERRAIN_LODS = 5;
+const int   TERRAIN_CHUNK_QUADS = 32;          // grid resolution at LOD 0
+const float TERRAIN_PLAZA_Y = -0.5f;           // top of the old ground cube, objects stand on it
+const float TERRAIN_PLAZA_RADIUS = 45.0f;
+const float TERRAIN_HILLS_RADIUS = 110.0f;     // hills reach full height here
+const float TERRAIN_MAX_ERROR_PIXELS = 2.0f;
+
+// Per-instance chunk data: [originX originZ spacing lod] + seam steps [-X +X -Z +Z]
+struct TerrainChunkInstance {
+    float originX, originZ, spacing, lod;
+    float seams[4];
+};
+
+struct Terrain {
+    std::vector<float> heights;                // TERRAIN_SAMPLES^2, row-major along +X
+    std::vector<float> chunkMinY, chunkMaxY;   // per chunk, for culling
+    std::vector<float> chunkError;             // per chunk and LOD: max height error vs. the full grid
+    std::vector<unsigned char> chunkLod;       // per chunk, refreshed every frame (255 = culled)
+    GLuint heightTexture = 0;
+    GLuint program = 0;
+    MeshVBO grids[TERRAIN_LODS];               // [i j] grid coordinates, triangles
+    StreamSlice stream;                        // this frame's instances in the stream ring
+    std::vector<TerrainChunkInstance> instances;
+    int lodFirst[TERRAIN_LODS] = {};
+    int lodCount[TERRAIN_LODS] = {};
+    float lodNearest[TERRAIN_LODS] = {}; // nearest chunk box of each level (sort depth)
+} terrain;
+
+const char* terrainVertexSrc = R"(
+#version 120
+attribute vec2 a_grid;     // vertex (i, j) in the chunk's grid
+attribute vec4 a_chunk;    // originX, originZ, spacing, lod
+attribute vec4 a_seams;    // coarser-neighbor step per edge (-X, +X, -Z, +Z), in grid units
+uniform sampler2D u_heights;  // r = height, g = slope shade
+uniform float u_extent;
+uniform float u_samples;
+uniform float u_quads;     // grid quads per side at this LOD
+uniform float u_fog;
+varying float v_shade;
+varying float v_fog;       // fog factor, per vertex like fixed-function fog
+varying vec3 v_world;
+
+vec2 sampleAt(vec2 world) {
+    vec2 uv = (world + u_extent + 0.5) / u_samples;
+    return texture2DLod(u_heights, uv, 0.0).rg;
+}
+
+float heightAt(vec2 world) {
+    return sampleAt(world).r;
+}
+
+vec2 worldOf(vec2 grid) {
+    return a_chunk.xy + grid * a_chunk.z;
+}
+
+// Height on the straight line between the coarse vertices around `along` on an edge
+float snappedHeight(vec2 edgeStart, vec2 dir, float along, float step) {
+    float a0 = floor(along / step) * step;
+    float t = (along - a0) / step;
+    float h0 = heightAt(worldOf(edgeStart + dir * a0));
+    float h1 = heightAt(worldOf(edgeStart + dir * (a0 + step)));
+    return mix(h0, h1, t);
+}
+
+void main() {
+    vec2 world = worldOf(a_grid);
+    vec2 texel = sampleAt(world);
+    float h = texel.r;
+
+    if (a_grid.x == 0.0 && a_seams.x > 1.0)        h = snappedHeight(vec2(0.0, 0.0), vec2(0.0, 1.0), a_grid.y, a_seams.x);
+    else if (a_grid.x == u_quads && a_seams.y > 1.0) h = snappedHeight(vec2(u_quads, 0.0), vec2(0.0, 1.0), a_grid.y, a_seams.y);
+    else if (a_grid.y == 0.0 && a_seams.z > 1.0)   h = snappedHeight(vec2(0.0, 0.0), vec2(1.0, 0.0), a_grid.x, a_seams.z);
+    else if (a_grid.y == u_quads && a_seams.w > 1.0) h = snappedHeight(vec2(0.0, u_quads), vec2(1.0, 0.0), a_grid.x, a_seams.w);
+
+    v_shade = texel.g;
+    v_world = vec3(world.x, h, world.y);
+    vec4 eye = gl_ModelViewMatrix * vec4(v_world, 1.0);
+    // Same falloff as glFogi(GL_FOG_MODE, GL_EXP2)
+    float f = exp(-pow(gl_Fog.density * abs(eye.z), 2.0));
+    v_fog = mix(1.0, clamp(f, 0.0, 1.0), u_fog);
+    gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+const char* terrainFragmentSrc = R"(
+#version 120
+uniform vec3 u_color;
+varying float v_shade;
+varying float v_fog;
+varying vec3 v_world;
+float shadowFactor(vec3 world);
+void main() {
+    gl_FragColor = vec4(mix(gl_Fog.color.rgb, u_color * v_shade * shadowFactor(v_world), v_fog), 1.0);
+}
+)";
+
+// Smooth value noise on an integer lattice, [0, 1)
+float latticeNoise(int x, int z, unsigned seed) {
+    unsigned h = (unsigned)x * 374761393u + (unsigned)z * 668265263u + seed * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return (float)((h ^ (h >> 16)) & 0xFFFFFF) / 16777216.0f;
+}
+
+float valueNoise(float x, float z, unsigned seed) {
+    int x0 = (int)floorf(x), z0 = (int)floorf(z);
+    float tx = x - x0, tz = z - z0;
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+    float a = latticeNoise(x0, z0, seed), b = latticeNoise(x0 + 1, z0, seed);
+    float c = latticeNoise(x0, z0 + 1, seed), d = latticeNoise(x0 + 1, z0 + 1, seed);
+    return (a + (b - a) * tx) + ((c + (d - c) * tx) - (a + (b - a) * tx)) * tz;
+}
+
+float terrainHeightFunction(float x, float z) {
+    float r = sqrtf(x * x + z * z);
+    float t = std::max(0.0f, std::min(1.0f, (r - TERRAIN_PLAZA_RADIUS) / (TERRAIN_HILLS_RADIUS - TERRAIN_PLAZA_RADIUS)));
+    float blend = t * t * (3.0f - 2.0f * t);
+    if (blend <= 0.0f) return TERRAIN_PLAZA_Y;
+
+    // Five octaves of rolling hills, roughly 0..22 units
+    float sum = 0.0f, amplitude = 12.0f, frequency = 1.0f / 160.0f;
+    for (int octave = 0; octave < 5; ++octave) {
+        sum += valueNoise(x * frequency, z * frequency, 7u + octave) * amplitude;
+        amplitude *= 0.45f;
+        frequency *= 2.1f;
+    }
+    return TERRAIN_PLAZA_Y + blend * sum;
+}
+
+// CPU only: heights for the whole terrain, rows in parallel
+void buildTerrainHeights(std::vector<float>& heights) {
+    heights.resize((size_t)TERRAIN_SAMPLES * TERRAIN_SAMPLES);
+    parallelFor(TERRAIN_SAMPLES, [&](int row) {
+        float z = -TERRAIN_EXTENT + row;
+        for (int col = 0; col < TERRAIN_SAMPLES; ++col)
+            heights[(size_t)row * TERRAIN_SAMPLES + col] = terrainHeightFunction(-TERRAIN_EXTENT + col, z);
+        });
+}
+
+// Bilinear height at a world position (for placing objects on the ground)
+float terrainHeightAt(float x, float z) {
+    if (terrain.heights.empty()) return TERRAIN_PLAZA_Y;
+    float fx = std::max(0.0f, std::min((float)TERRAIN_SAMPLES - 1.001f, x + TERRAIN_EXTENT));
+    float fz = std::max(0.0f, std::min((float)TERRAIN_SAMPLES - 1.001f, z + TERRAIN_EXTENT));
+    int ix = (int)fx, iz = (int)fz;
+    float tx = fx - ix, tz = fz - iz;
+    const float* row0 = &terrain.heights[(size_t)iz * TERRAIN_SAMPLES + ix];
+    const float* row1 = row0 + TERRAIN_SAMPLES;
+    float h0 = row0[0] + (row0[1] - row0[0]) * tx;
+    float h1 = row1[0] + (row1[1] - row1[0]) * tx;
+    return h0 + (h1 - h0) * tz;
+}
+
+// Offset from the plaza: objects placed at y = 0 on flat ground move up by this much
+float terrainGroundOffset(float x, float z) {
+    return terrainHeightAt(x, z) - TERRAIN_PLAZA_Y;
+}
+
+// Per-chunk height range and per-LOD error; terrain.heights must be filled
+void computeTerrainChunkBounds() {
+    const int samplesPerChunk = (int)TERRAIN_CHUNK_SIZE;
+    const int chunkCount = TERRAIN_CHUNKS * TERRAIN_CHUNKS;
+    terrain.chunkMinY.assign(chunkCount, 0.0f);
+    terrain.chunkMaxY.assign(chunkCount, 0.0f);
+    terrain.chunkError.assign(chunkCount * TERRAIN_LODS, 0.0f);
+    terrain.chunkLod.assign(chunkCount, 0);
+
+    auto sample = [](int x, int z) { return terrain.heights[(size_t)z * TERRAIN_SAMPLES + x]; };
+
+    parallelFor(chunkCount, [&](int c) {
+        int x0 = (c % TERRAIN_CHUNKS) * samplesPerChunk, z0 = (c / TERRAIN_CHUNKS) * samplesPerChunk;
+        float lo = 1e9f, hi = -1e9f;
+        for (int j = 0; j <= samplesPerChunk; ++j)
+            for (int i = 0; i <= samplesPerChunk; ++i) {
+                lo = std::min(lo, sample(x0 + i, z0 + j));
+                hi = std::max(hi, sample(x0 + i, z0 + j));
+            }
+        terrain.chunkMinY[c] = lo;
+        terrain.chunkMaxY[c] = hi;
+
+        // Error of each level: how far the true heights are from its triangles
+        float* error = &terrain.chunkError[c * TERRAIN_LODS];
+        for (int lod = 1; lod < TERRAIN_LODS; ++lod) {
+            int step = samplesPerChunk / (TERRAIN_CHUNK_QUADS >> lod);
+            float worst = error[lod - 1];
+            for (int j = 0; j <= samplesPerChunk; ++j)
+                for (int i = 0; i <= samplesPerChunk; ++i) {
+                    int i0 = std::min(i / step * step, samplesPerChunk - step), j0 = std::min(j / step * step, samplesPerChunk - step);
+                    float tx = (float)(i - i0) / step, tz = (float)(j - j0) / step;
+                    float h00 = sample(x0 + i0, z0 + j0), h10 = sample(x0 + i0 + step, z0 + j0);
+                    float h01 = sample(x0 + i0, z0 + j0 + step), h11 = sample(x0 + i0 + step, z0 + j0 + step);
+                    // Same diagonal split as the grid mesh: (0,0)-(1,1)
+                    float approx = (tz >= tx) ? h00 + (h11 - h01) * tx + (h01 - h00) * tz
+                                              : h00 + (h10 - h00) * tx + (h11 - h10) * tz;
+                    worst = std::max(worst, fabsf(approx - sample(x0 + i, z0 + j)));
+                }
+            error[lod] = worst;
+        }
+        });
+}
+
+// GL side: height texture, shared grid meshes, instance buffer, program
+void createTerrain() {
+    computeTerrainChunkBounds();
+
+    // Height + slope shade (flat ground keeps the base color, steep slopes darken)
+    std::vector<float> texels((size_t)TERRAIN_SAMPLES * TERRAIN_SAMPLES * 2);
+    parallelFor(TERRAIN_SAMPLES, [&](int row) {
+        for (int col = 0; col < TERRAIN_SAMPLES; ++col) {
+            auto h = [&](int x, int z) {
+                x = std::max(0, std::min(TERRAIN_SAMPLES - 1, x));
+                z = std::max(0, std::min(TERRAIN_SAMPLES - 1, z));
+                return terrain.heights[(size_t)z * TERRAIN_SAMPLES + x];
+                };
+            float dx = h(col + 1, row) - h(col - 1, row);
+            float dz = h(col, row + 1) - h(col, row - 1);
+            float ny = 2.0f / sqrtf(dx * dx + 4.0f + dz * dz);
+            size_t t = ((size_t)row * TERRAIN_SAMPLES + col) * 2;
+            texels[t] = h(col, row);
+            texels[t + 1] = 0.55f + 0.45f * ny * ny;
+        }
+        });
+
+    glGenTextures(1, &terrain.heightTexture);
+    glBindTexture(GL_TEXTURE_2D, terrain.heightTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, TERRAIN_SAMPLES, TERRAIN_SAMPLES, 0, GL_RG, GL_FLOAT, texels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Grid meshes: two floats per vertex, plain triangle lists
+    for (int lod = 0; lod < TERRAIN_LODS; ++lod) {
+        int quads = TERRAIN_CHUNK_QUADS >> lod;
+        std::vector<float> data;
+        for (int j = 0; j < quads; ++j)
+            for (int i = 0; i < quads; ++i) {
+                const float corners[6][2] = {
+                    { (float)i, (float)j }, { (float)i, (float)j + 1 }, { (float)i + 1, (float)j + 1 },
+                    { (float)i, (float)j }, { (float)i + 1, (float)j + 1 }, { (float)i + 1, (float)j }
+                };
+                for (const auto& c : corners) data.insert(data.end(), { c[0], c[1] });
+            }
+
+        MeshVBO& grid = terrain.grids[lod];
+        grid.vertexCount = (int)(data.size() / 2);
+        glGenBuffers(1, &grid.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
+    }
+
+    terrain.instances.reserve(TERRAIN_CHUNKS * TERRAIN_CHUNKS);
+
+    terrain.program = createProgram(terrainVertexSrc, terrainFragmentSrc, shadowReceiverSrc);
+}
+
+// Culls the chunks, picks their LOD by distance and fills the per-LOD instance runs
+void updateTerrainChunks() {
+    const float half = TERRAIN_CHUNK_SIZE * 0.5f;
+    const int chunkCount = TERRAIN_CHUNKS * TERRAIN_CHUNKS;
+    const float pixelsPerUnit = (float)windowHeight * 0.5f / tanf(camera.fov * 0.5f * (float)M_PI / 180.0f);
+    for (int lod = 0; lod < TERRAIN_LODS; ++lod) terrain.lodNearest[lod] = RENDER_DEPTH_RANGE;
+
+    for (int c = 0; c < chunkCount; ++c) {
+        float cx = -TERRAIN_EXTENT + (c % TERRAIN_CHUNKS) * TERRAIN_CHUNK_SIZE + half;
+        float cz = -TERRAIN_EXTENT + (c / TERRAIN_CHUNKS) * TERRAIN_CHUNK_SIZE + half;
+        float cy = (terrain.chunkMinY[c] + terrain.chunkMaxY[c]) * 0.5f;
+        float hy = (terrain.chunkMaxY[c] - terrain.chunkMinY[c]) * 0.5f;
+        float radius = sqrtf(2.0f * half * half + hy * hy);
+
+        // Coarsest level whose error, at the distance from the camera to the chunk's box, stays small
+        float dx = std::max(0.0f, fabsf(camera.x - cx) - half);
+        float dz = std::max(0.0f, fabsf(camera.z - cz) - half);
+        float dy = std::max(0.0f, fabsf(camera.y - cy) - hy);
+        float dist = std::max(1.0f, sqrtf(dx * dx + dy * dy + dz * dz));
+        const float* error = &terrain.chunkError[c * TERRAIN_LODS];
+        int lod = TERRAIN_LODS - 1;
+        while (lod > 0 && error[lod] * pixelsPerUnit / dist > TERRAIN_MAX_ERROR_PIXELS) --lod;
+        terrain.chunkLod[c] = (unsigned char)lod;
+
+        if (cullingEnabled && !sphereInFrustum(viewFrustum, cx, cy, cz, radius)) {
+            terrain.chunkLod[c] |= 0x80; // culled, LOD kept for the neighbors' seams
+            frameStats.terrainChunksCulled++;
+        }
+        else {
+            terrain.lodNearest[lod] = std::min(terrain.lodNearest[lod], dist);
+        }
+    }
+
+    int counts[TERRAIN_LODS] = {};
+    for (int c = 0; c < chunkCount; ++c)
+        if (!(terrain.chunkLod[c] & 0x80)) counts[terrain.chunkLod[c]]++;
+
+    int offsets[TERRAIN_LODS];
+    int total = 0;
+    for (int lod = 0; lod < TERRAIN_LODS; ++lod) {
+        offsets[lod] = terrain.lodFirst[lod] = total;
+        terrain.lodCount[lod] = counts[lod];
+        total += counts[lod];
+    }
+    terrain.instances.resize(total);
+    frameStats.terrainChunks += total;
+
+    auto lodAt = [&](int x, int z, int fallback) {
+        if (x < 0 || z < 0 || x >= TERRAIN_CHUNKS || z >= TERRAIN_CHUNKS) return fallback;
+        return (int)(terrain.chunkLod[z * TERRAIN_CHUNKS + x] & 0x7F);
+        };
+
+    for (int c = 0; c < chunkCount; ++c) {
+        if (terrain.chunkLod[c] & 0x80) continue;
+        int x = c % TERRAIN_CHUNKS, z = c / TERRAIN_CHUNKS;
+        int lod = terrain.chunkLod[c];
+
+        // A coarser neighbor's vertices are 2^(its lod - ours) of our grid steps apart
+        int neighbors[4] = { lodAt(x - 1, z, lod), lodAt(x + 1, z, lod), lodAt(x, z - 1, lod), lodAt(x, z + 1, lod) };
+        TerrainChunkInstance& inst = terrain.instances[offsets[lod]++];
+        inst.originX = -TERRAIN_EXTENT + x * TERRAIN_CHUNK_SIZE;
+        inst.originZ = -TERRAIN_EXTENT + z * TERRAIN_CHUNK_SIZE;
+        inst.spacing = TERRAIN_CHUNK_SIZE / (float)(TERRAIN_CHUNK_QUADS >> lod);
+        inst.lod = (float)lod;
+        for (int e = 0; e < 4; ++e)
+            inst.seams[e] = (float)(1 << std::max(0, neighbors[e] - lod));
+    }
+
+    if (total == 0) return;
+    terrain.stream = streamUpload(terrain.instances.data(), total * sizeof(TerrainChunkInstance));
+}
+
+void bindTerrainMaterial() {
+    stateUseProgram(terrain.program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, terrain.heightTexture);
+    glUniform1i(glGetUniformLocation(terrain.program, "u_heights"), 0);
+    glUniform1f(glGetUniformLocation(terrain.program, "u_extent"), TERRAIN_EXTENT);
+    glUniform1f(glGetUniformLocation(terrain.program, "u_samples"), (float)TERRAIN_SAMPLES);
+    glUniform1f(glGetUniformLocation(terrain.program, "u_fog"), stateIsEnabled(GL_FOG) ? 1.0f : 0.0f);
+    bindShadowReceiver(terrain.program, true);
+    if (renderQueue.scene == ANCIENT_SCENE)
+        glUniform3f(glGetUniformLocation(terrain.program, "u_color"), 0.27f, 0.20f, 0.12f); // earth
+    else
+        glUniform3f(glGetUniformLocation(terrain.program, "u_color"), 0.33f, 0.78f, 0.30f); // grass
+
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glEnableVertexAttribArray(ATTRIB_INSTANCE);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+    glVertexAttribDivisor(ATTRIB_COLOR, 1);
+}
+
+void unbindTerrainMaterial() {
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 0);
+    glVertexAttribDivisor(ATTRIB_COLOR, 0);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glDisableVertexAttribArray(ATTRIB_INSTANCE);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    stateUseProgram(0);
+}
+
+// One LOD level: the chunks [first, first + count) of the instance buffer on that level's grid
+void drawTerrainItem(const DrawItem& item) {
+    const MeshVBO& grid = *item.mesh;
+    int lod = (int)(&grid - terrain.grids);
+    glUniform1f(glGetUniformLocation(terrain.program, "u_quads"), (float)(TERRAIN_CHUNK_QUADS >> lod));
+
+    glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+
+    size_t base = terrain.stream.offset + (size_t)item.first * sizeof(TerrainChunkInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.stream.buffer);
+    glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunkInstance), (void*)base);
+    glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunkInstance), (void*)(base + 4 * sizeof(GLfloat)));
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, grid.vertexCount, item.count);
+    countDraw((long long)grid.vertexCount * item.count);
+}
+
+void queueTerrain(SceneType) {
+    if (!terrain.program) return;
+
+    updateTerrainChunks();
+
+    for (int lod = 0; lod < TERRAIN_LODS; ++lod) {
+        if (terrain.lodCount[lod] > 0)
+            queueDraw(PASS_OPAQUE, MAT_TERRAIN, terrain.lodNearest[lod], drawTerrainItem,
+                &terrain.grids[lod], nullptr, terrain.lodFirst[lod], terrain.lodCount[lod]);
+    }
+}
+
+// ---------------------- Crowd ----------------------
+// Peak-season visitors in the modern scene. Thousands of agents wander the plaza and
+// queue at the foot of the four staircases. Agent state is structure-of-arrays indexed by
+// agent id. Every step:
+//   1. hash: agents are counting-sorted into a uniform grid whose cell size equals the
+//      separation radius, and their positions are gathered in cell order, so a cell, and
+//      the three cells of one neighbourhood row, are a contiguous run;
+//   2. steer: seek the goal and separate from neighbours, reading those runs four
+//      positions at a time with SSE;
+//   3. integrate: four agents at a time;
+//   4. goals: a serial pass handles arrivals and the queues.
+// Steps 1-3 are split into blocks across the worker pool. Drawing interpolates between
+// the last two steps and submits all visible bodies and heads as instanced draws.
+
+const int   CROWD_DEFAULT_AGENTS = 5000;
+const int   CROWD_BLOCK = 1024;               // agents per parallel task
+const int   CROWD_REORDER_STEPS = 32;         // agents are re-stored in hash order this often
+const float CROWD_NEIGHBOR_RADIUS = 1.2f;     // separation radius and hash cell size
+const float CROWD_DENSITY = 0.15f;            // agents per square unit of wander area
+const float CROWD_INNER_RADIUS = 17.0f;       // wander area starts outside the pyramid skirt
+const float CROWD_PYRAMID_HALF = 14.2f;       // footprint agents are pushed out of (base + margin)
+const float CROWD_MAX_SPEED = 1.8f;
+const float CROWD_GOAL_GAIN = 2.0f;           // 1/s, pull of the velocity toward the desired one
+const float CROWD_SEPARATION_GAIN = 4.0f;
+const float CROWD_HEADING_RATE = 4.0f;        // 1/s, how fast bodies turn to their velocity
+const float CROWD_STRIDE = 5.0f;              // walk-cycle radians per unit travelled
+
+// Queues start at the foot of each staircase and run outward in a few lanes
+const float CROWD_STAIR_FOOT = 15.0f;
+const int   CROWD_QUEUE_LANES = 3;
+const float CROWD_QUEUE_SPACING = 0.9f;
+const int   CROWD_QUEUE_MAX = 90;             // visitors per staircase
+const int   CROWD_QUEUE_START = 45;           // already queuing per staircase when the crowd starts
+const float CROWD_SERVE_SECONDS = 0.8f;       // the queue head starts climbing this often
+const float CROWD_JOIN_CHANCE = 0.15f;        // of picking a queue at a waypoint
+
+struct CrowdAgents {
+    int count = 0;
+    std::vector<float> x, z;            // position (y comes from the terrain when drawn)
+    std::vector<float> prevX, prevZ;    // position one step earlier, for interpolation
+    std::vector<float> vx, vz;
+    std::vector<float> steerX, steerZ;  // velocity chosen by the steering pass
+    std::vector<float> headX, headZ;    // smoothed facing direction
+    std::vector<float> goalX, goalZ;
+    std::vector<float> speed;           // preferred walking speed
+    std::vector<float> phase;           // walk cycle (bob)
+    std::vector<unsigned int> color;    // RGBA8 shirt
+    std::vector<unsigned int> seed;     // xorshift32 state for goal picks
+    std::vector<signed char> queue;     // staircase, -1 while wandering
+    std::vector<int> ticket;            // position in that staircase's queue
+    std::vector<unsigned char> lod;     // head LOD (sticky, see selectLod)
+
+    // Spatial hash: agents order[cellStart[c]] .. order[cellStart[c + 1] - 1] are in cell c
+    float gridMin = 0.0f;
+    int gridDim = 0;
+    std::vector<int> cellOf, cellStart, order;
+    std::vector<float> sortedX, sortedZ;
+
+    float wanderRadius = 0.0f;
+    int served[4] = {};                 // per staircase: tickets already climbing
+    int nextTicket[4] = {};
+    float serveTimer = 0.0f;
+    Rng rng = Rng(0);                   // serial goal pass only
+    int steps = 0;
+
+    // Last step, in ms
+    double hashMs = 0.0, steerMs = 0.0, integrateMs = 0.0, goalMs = 0.0;
+    int threads = 1;
+};
+CrowdAgents crowd;
+int crowdAgentCount = CROWD_DEFAULT_AGENTS; // --crowd
+
+// Instanced draw data: [x y z yaw] + RGBA8 shirt color
+struct CrowdInstance {
+    float x, y, z, yaw;
+    unsigned int color;
+};
+
+struct CrowdRenderer {
+    GLuint program = 0;
+    StreamSlice stream;                     // this frame's instances in the stream ring
+    std::vector<CrowdInstance> instances;   // visible agents, grouped by head LOD
+    std::vector<CrowdInstance> drawScratch; // per agent; y = -1e9 marks culled, -2e9 occluded
+    int lodFirst[LOD_COUNT] = {};
+    int lodCount[LOD_COUNT] = {};
+    float lodNearest[LOD_COUNT] = {};       // camera distance of the nearest agent (sort depth)
+};
+CrowdRenderer crowdRenderer;
+
+inline unsigned int nextAgentRandom(unsigned int& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+inline float agentUniform(unsigned int& state) {
+    return (float)(nextAgentRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Staircase yaws are 0/90/180/270 degrees: foot directions +Z, +X, -Z, -X
+const float crowdStairDirX[4] = { 0.0f, 1.0f, 0.0f, -1.0f };
+const float crowdStairDirZ[4] = { 1.0f, 0.0f, -1.0f, 0.0f };
+
+void queueSlot(int stair, int rank, float& x, float& z) {
+    float along = CROWD_STAIR_FOOT + (float)(rank / CROWD_QUEUE_LANES) * CROWD_QUEUE_SPACING;
+    float across = (float)(rank % CROWD_QUEUE_LANES - CROWD_QUEUE_LANES / 2) * CROWD_QUEUE_SPACING;
+    x = crowdStairDirX[stair] * along - crowdStairDirZ[stair] * across;
+    z = crowdStairDirZ[stair] * along + crowdStairDirX[stair] * across;
+}
+
+void pickWanderGoal(int i) {
+    unsigned int& s = crowd.seed[i];
+    float inner2 = CROWD_INNER_RADIUS * CROWD_INNER_RADIUS;
+    float r = sqrtf(inner2 + (crowd.wanderRadius * crowd.wanderRadius - inner2) * agentUniform(s));
+    float a = agentUniform(s) * 2.0f * (float)M_PI;
+    crowd.goalX[i] = r * cosf(a);
+    crowd.goalZ[i] = r * sinf(a);
+}
+
+void initCrowd(int count) {
+    crowd = CrowdAgents();
+    crowd.count = count;
+    crowd.rng = Rng(20121221ull ^ (unsigned long long)count);
+
+    float inner2 = CROWD_INNER_RADIUS * CROWD_INNER_RADIUS;
+    crowd.wanderRadius = sqrtf(inner2 + (float)count / (CROWD_DENSITY * (float)M_PI));
+    crowd.wanderRadius = std::max(crowd.wanderRadius, 40.0f);
+
+    for (std::vector<float>* column : { &crowd.x, &crowd.z, &crowd.prevX, &crowd.prevZ, &crowd.vx, &crowd.vz,
+        &crowd.steerX, &crowd.steerZ, &crowd.headX, &crowd.headZ, &crowd.goalX, &crowd.goalZ, &crowd.speed,
+        &crowd.phase }) {
+        column->assign(count, 0.0f);
+    }
+    crowd.sortedX.assign(count + 3, 1.0e9f); // + sentinels for the 4-wide neighbour reads
+    crowd.sortedZ.assign(count + 3, 1.0e9f);
+    crowd.color.resize(count);
+    crowd.seed.resize(count);
+    crowd.queue.assign(count, -1);
+    crowd.ticket.assign(count, 0);
+    crowd.lod.assign(count, 0);
+    crowd.cellOf.resize(count);
+    crowd.order.resize(count);
+
+    // Summer shirts
+    const float palette[6][3] = {
+        { 0.2f, 0.4f, 0.8f }, { 0.85f, 0.2f, 0.2f }, { 0.95f, 0.85f, 0.3f },
+        { 0.95f, 0.95f, 0.95f }, { 0.2f, 0.6f, 0.35f }, { 0.9f, 0.5f, 0.7f }
+    };
+
+    for (int i = 0; i < count; ++i) {
+        crowd.seed[i] = (unsigned int)(crowd.rng.next() | 1);
+        pickWanderGoal(i);
+        crowd.x[i] = crowd.prevX[i] = crowd.goalX[i];
+        crowd.z[i] = crowd.prevZ[i] = crowd.goalZ[i];
+        pickWanderGoal(i);
+
+        crowd.speed[i] = crowd.rng.range(0.9f, 1.5f);
+        crowd.phase[i] = crowd.rng.range(0.0f, 2.0f * (float)M_PI);
+        float a = crowd.rng.range(0.0f, 2.0f * (float)M_PI);
+        crowd.headX[i] = sinf(a);
+        crowd.headZ[i] = cosf(a);
+
+        const float* c = palette[crowd.rng.next() % 6];
+        float shade = crowd.rng.range(0.8f, 1.0f);
+        crowd.color[i] = packRGBA8(c[0] * shade, c[1] * shade, c[2] * shade, 1.0f);
+    }
+
+    // Wanderers take a minute or more to reach a waypoint and maybe join a queue, so the
+    // queues start formed (small crowds keep most visitors wandering)
+    int startQueued = std::min(CROWD_QUEUE_START, count / 16);
+    for (int i = 0; i < 4 * startQueued; ++i) {
+        int stair = i % 4;
+        crowd.queue[i] = (signed char)stair;
+        crowd.ticket[i] = crowd.nextTicket[stair]++;
+        queueSlot(stair, crowd.ticket[i], crowd.goalX[i], crowd.goalZ[i]);
+        crowd.x[i] = crowd.prevX[i] = crowd.goalX[i];
+        crowd.z[i] = crowd.prevZ[i] = crowd.goalZ[i];
+        crowd.headX[i] = -crowdStairDirX[stair]; // facing the stairs
+        crowd.headZ[i] = -crowdStairDirZ[stair];
+    }
+
+    crowd.gridMin = -(crowd.wanderRadius + 2.0f);
+    crowd.gridDim = (int)ceilf(-2.0f * crowd.gridMin / CROWD_NEIGHBOR_RADIUS);
+    crowd.cellStart.assign(crowd.gridDim * crowd.gridDim + 1, 0);
+}
+
+// Runs fn(begin, end) over CROWD_BLOCK-sized index ranges on the worker pool
+void crowdParallel(const std::function<void(int, int)>& fn) {
+    int blocks = (crowd.count + CROWD_BLOCK - 1) / CROWD_BLOCK;
+    crowd.threads = parallelFor(blocks, [&](int b) {
+        fn(b * CROWD_BLOCK, std::min(crowd.count, (b + 1) * CROWD_BLOCK));
+        });
+}
+
+inline int crowdCellCoord(float v) {
+    int c = (int)((v - crowd.gridMin) * (1.0f / CROWD_NEIGHBOR_RADIUS));
+    return std::min(std::max(c, 0), crowd.gridDim - 1);
+}
+
+void crowdBuildHash() {
+    const int dim = crowd.gridDim;
+    crowdParallel([&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            crowd.cellOf[i] = crowdCellCoord(crowd.z[i]) * dim + crowdCellCoord(crowd.x[i]);
+        });
+
+    // Counting sort: cellStart[c] ends up as the first slot of cell c
+    std::vector<int>& start = crowd.cellStart;
+    std::fill(start.begin(), start.end(), 0);
+    for (int i = 0; i < crowd.count; ++i) start[crowd.cellOf[i] + 1]++;
+    for (int c = 0; c < dim * dim; ++c) start[c + 1] += start[c];
+    for (int i = 0; i < crowd.count; ++i) crowd.order[start[crowd.cellOf[i]]++] = i;
+    for (int c = dim * dim; c > 0; --c) start[c] = start[c - 1];
+    start[0] = 0;
+
+    crowdParallel([&](int begin, int end) {
+        for (int k = begin; k < end; ++k) {
+            crowd.sortedX[k] = crowd.x[crowd.order[k]];
+            crowd.sortedZ[k] = crowd.z[crowd.order[k]];
+        }
+        });
+}
+
+template <typename T>
+void permuteAgentColumn(std::vector<T>& column) {
+    std::vector<T> sorted(column.size());
+    for (size_t k = 0; k < sorted.size(); ++k) sorted[k] = column[crowd.order[k]];
+    column.swap(sorted);
+}
+
+// Agents drift slowly, so storing them in hash order now and then keeps the steering
+// pass's reads of their own columns close to sequential. Runs right after the hash is
+// built; afterwards agent k is the k-th in hash order.
+void crowdReorder() {
+    std::vector<float>* floatColumns[] = { &crowd.x, &crowd.z, &crowd.prevX, &crowd.prevZ, &crowd.vx, &crowd.vz,
+        &crowd.headX, &crowd.headZ, &crowd.goalX, &crowd.goalZ, &crowd.speed, &crowd.phase };
+    const int floatCount = (int)(sizeof(floatColumns) / sizeof(floatColumns[0]));
+    parallelFor(floatCount + 5, [&](int c) {
+        if (c < floatCount)  permuteAgentColumn(*floatColumns[c]);
+        else if (c == floatCount)     permuteAgentColumn(crowd.color);
+        else if (c == floatCount + 1) permuteAgentColumn(crowd.seed);
+        else if (c == floatCount + 2) permuteAgentColumn(crowd.queue);
+        else if (c == floatCount + 3) permuteAgentColumn(crowd.ticket);
+        else                          permuteAgentColumn(crowd.lod);
+        });
+    for (int k = 0; k < crowd.count; ++k) crowd.order[k] = k;
+}
+
+// Separation push from the neighbours in sorted slots [begin, end): each one within the
+// radius pushes by (p - q) * (R / d - 1); the agent itself (d = 0) is skipped.
+// The SSE loop reads whole groups of four past `end`. That is safe: the slots after a
+// row's three cells hold agents at least one radius away (or the far-away sentinels
+// padding the arrays), so the radius test gives them zero weight.
+inline void accumulateSeparation(float px, float pz, int begin, int end, float& sx, float& sz) {
+    const float* qx = crowd.sortedX.data();
+    const float* qz = crowd.sortedZ.data();
+    const float r = CROWD_NEIGHBOR_RADIUS;
+    int j = begin;
+#if CROWD_SIMD
+    const __m128 px4 = _mm_set1_ps(px), pz4 = _mm_set1_ps(pz);
+    const __m128 r4 = _mm_set1_ps(r), r2 = _mm_set1_ps(r * r);
+    const __m128 eps = _mm_set1_ps(1.0e-6f), one = _mm_set1_ps(1.0f);
+    __m128 accX = _mm_setzero_ps(), accZ = _mm_setzero_ps();
+    for (; j < end; j += 4) {
+        __m128 dx = _mm_sub_ps(px4, _mm_loadu_ps(qx + j));
+        __m128 dz = _mm_sub_ps(pz4, _mm_loadu_ps(qz + j));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+        __m128 inRange = _mm_and_ps(_mm_cmplt_ps(d2, r2), _mm_cmpgt_ps(d2, eps));
+        __m128 w = _mm_sub_ps(_mm_mul_ps(r4, _mm_rsqrt_ps(_mm_max_ps(d2, eps))), one);
+        w = _mm_and_ps(w, inRange);
+        accX = _mm_add_ps(accX, _mm_mul_ps(dx, w));
+        accZ = _mm_add_ps(accZ, _mm_mul_ps(dz, w));
+    }
+    float lanesX[4], lanesZ[4];
+    _mm_storeu_ps(lanesX, accX);
+    _mm_storeu_ps(lanesZ, accZ);
+    sx += lanesX[0] + lanesX[1] + lanesX[2] + lanesX[3];
+    sz += lanesZ[0] + lanesZ[1] + lanesZ[2] + lanesZ[3];
+#else
+    for (; j < end; ++j) {
+        float dx = px - qx[j], dz = pz - qz[j];
+        float d2 = dx * dx + dz * dz;
+        if (d2 >= r * r || d2 <= 1.0e-6f) continue;
+        float w = r / sqrtf(d2) - 1.0f;
+        sx += dx * w;
+        sz += dz * w;
+    }
+#endif
+}
+
+void crowdSteer(float dt) {
+    const int dim = crowd.gridDim;
+    crowdParallel([&](int begin, int end) {
+        // Sorted order: consecutive agents share neighbourhoods, so the runs stay in cache
+        for (int k = begin; k < end; ++k) {
+            int i = crowd.order[k];
+            float px = crowd.x[i], pz = crowd.z[i];
+
+            // Arrive: slow down over the last two units
+            float gx = crowd.goalX[i] - px, gz = crowd.goalZ[i] - pz;
+            float dist = sqrtf(gx * gx + gz * gz);
+            float desired = crowd.speed[i] * std::min(1.0f, dist * 0.5f);
+            float dvx = dist > 1.0e-4f ? gx / dist * desired : 0.0f;
+            float dvz = dist > 1.0e-4f ? gz / dist * desired : 0.0f;
+
+            float sx = 0.0f, sz = 0.0f;
+            int cx = crowdCellCoord(px), cz = crowdCellCoord(pz);
+            int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, dim - 1);
+            for (int row = std::max(cz - 1, 0); row <= std::min(cz + 1, dim - 1); ++row)
+                accumulateSeparation(px, pz, crowd.cellStart[row * dim + x0], crowd.cellStart[row * dim + x1 + 1], sx, sz);
+
+            float vx = crowd.vx[i] + ((dvx - crowd.vx[i]) * CROWD_GOAL_GAIN + sx * CROWD_SEPARATION_GAIN) * dt;
+            float vz = crowd.vz[i] + ((dvz - crowd.vz[i]) * CROWD_GOAL_GAIN + sz * CROWD_SEPARATION_GAIN) * dt;
+            float v2 = vx * vx + vz * vz;
+            if (v2 > CROWD_MAX_SPEED * CROWD_MAX_SPEED) {
+                float scale = CROWD_MAX_SPEED / sqrtf(v2);
+                vx *= scale;
+                vz *= scale;
+            }
+            crowd.steerX[i] = vx;
+            crowd.steerZ[i] = vz;
+        }
+        });
+}
+
+// Moves agents [begin, end) by their steered velocity and keeps them off the pyramid
+void integrateAgents(int begin, int end, float dt) {
+    float* x = crowd.x.data();   float* z = crowd.z.data();
+    float* px = crowd.prevX.data(); float* pz = crowd.prevZ.data();
+    float* vx = crowd.vx.data(); float* vz = crowd.vz.data();
+    float* hx = crowd.headX.data(); float* hz = crowd.headZ.data();
+    float* phase = crowd.phase.data();
+    const float* sx = crowd.steerX.data(); const float* sz = crowd.steerZ.data();
+    const float h = CROWD_PYRAMID_HALF;
+    const float turn = std::min(1.0f, CROWD_HEADING_RATE * dt);
+
+    int i = begin;
+#if CROWD_SIMD
+    const __m128 dt4 = _mm_set1_ps(dt), turn4 = _mm_set1_ps(turn), stride4 = _mm_set1_ps(CROWD_STRIDE * dt);
+    const __m128 h4 = _mm_set1_ps(h), signBit = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= end; i += 4) {
+        __m128 nvx = _mm_loadu_ps(sx + i), nvz = _mm_loadu_ps(sz + i);
+        __m128 cx = _mm_loadu_ps(x + i), cz = _mm_loadu_ps(z + i);
+        _mm_storeu_ps(px + i, cx);
+        _mm_storeu_ps(pz + i, cz);
+        cx = _mm_add_ps(cx, _mm_mul_ps(nvx, dt4));
+        cz = _mm_add_ps(cz, _mm_mul_ps(nvz, dt4));
+
+        // Inside the footprint: snap out along the axis the agent is furthest along
+        __m128 ax = _mm_andnot_ps(signBit, cx), az = _mm_andnot_ps(signBit, cz);
+        __m128 inside = _mm_and_ps(_mm_cmplt_ps(ax, h4), _mm_cmplt_ps(az, h4));
+        __m128 alongX = _mm_and_ps(inside, _mm_cmpge_ps(ax, az));
+        __m128 alongZ = _mm_andnot_ps(alongX, inside);
+        __m128 edgeX = _mm_or_ps(h4, _mm_and_ps(cx, signBit));
+        __m128 edgeZ = _mm_or_ps(h4, _mm_and_ps(cz, signBit));
+        cx = _mm_or_ps(_mm_and_ps(alongX, edgeX), _mm_andnot_ps(alongX, cx));
+        cz = _mm_or_ps(_mm_and_ps(alongZ, edgeZ), _mm_andnot_ps(alongZ, cz));
+        _mm_storeu_ps(x + i, cx);
+        _mm_storeu_ps(z + i, cz);
+        _mm_storeu_ps(vx + i, nvx);
+        _mm_storeu_ps(vz + i, nvz);
+
+        __m128 chx = _mm_loadu_ps(hx + i), chz = _mm_loadu_ps(hz + i);
+        _mm_storeu_ps(hx + i, _mm_add_ps(chx, _mm_mul_ps(_mm_sub_ps(nvx, chx), turn4)));
+        _mm_storeu_ps(hz + i, _mm_add_ps(chz, _mm_mul_ps(_mm_sub_ps(nvz, chz), turn4)));
+
+        __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(nvx, nvx), _mm_mul_ps(nvz, nvz)));
+        _mm_storeu_ps(phase + i, _mm_add_ps(_mm_loadu_ps(phase + i), _mm_mul_ps(speed, stride4)));
+    }
+#endif
+    for (; i < end; ++i) {
+        px[i] = x[i];
+        pz[i] = z[i];
+        float cx = x[i] + sx[i] * dt, cz = z[i] + sz[i] * dt;
+        if (fabsf(cx) < h && fabsf(cz) < h) {
+            if (fabsf(cx) >= fabsf(cz)) cx = copysignf(h, cx);
+            else                        cz = copysignf(h, cz);
+        }
+        x[i] = cx;
+        z[i] = cz;
+        vx[i] = sx[i];
+        vz[i] = sz[i];
+        hx[i] += (sx[i] - hx[i]) * turn;
+        hz[i] += (sz[i] - hz[i]) * turn;
+        phase[i] += sqrtf(sx[i] * sx[i] + sz[i] * sz[i]) * CROWD_STRIDE * dt;
+    }
+}
+
+// Serial: arrivals pick a new waypoint or join the shortest queue; queued visitors
+// follow their slot as the queue advances and leave once their turn comes
+void crowdUpdateGoals(float dt) {
+    crowd.serveTimer += dt;
+    if (crowd.serveTimer >= CROWD_SERVE_SECONDS) {
+        crowd.serveTimer -= CROWD_SERVE_SECONDS;
+        for (int s = 0; s < 4; ++s) {
+            if (crowd.served[s] < crowd.nextTicket[s]) crowd.served[s]++;
+        }
+    }
+
+    for (int i = 0; i < crowd.count; ++i) {
+        int stair = crowd.queue[i];
+        if (stair >= 0) {
+            int rank = crowd.ticket[i] - crowd.served[stair];
+            if (rank >= 0) {
+                queueSlot(stair, rank, crowd.goalX[i], crowd.goalZ[i]);
+                continue;
+            }
+            crowd.queue[i] = -1; // climbed: back into the crowd
+            pickWanderGoal(i);
+            continue;
+        }
+
+        float gx = crowd.goalX[i] - crowd.x[i], gz = crowd.goalZ[i] - crowd.z[i];
+        if (gx * gx + gz * gz > 1.0f) continue;
+
+        int shortest = 0;
+        for (int s = 1; s < 4; ++s) {
+            if (crowd.nextTicket[s] - crowd.served[s] < crowd.nextTicket[shortest] - crowd.served[shortest]) shortest = s;
+        }
+        if (agentUniform(crowd.seed[i]) < CROWD_JOIN_CHANCE &&
+            crowd.nextTicket[shortest] - crowd.served[shortest] < CROWD_QUEUE_MAX) {
+            crowd.queue[i] = (signed char)shortest;
+            crowd.ticket[i] = crowd.nextTicket[shortest]++;
+            queueSlot(shortest, crowd.ticket[i] - crowd.served[shortest], crowd.goalX[i], crowd.goalZ[i]);
+        }
+        else {
+            pickWanderGoal(i);
+        }
+    }
+}
+
+void crowdStep(float dt) {
+    if (crowd.count == 0) return;
+    auto msSince = [](std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+        };
+
+    auto t = std::chrono::steady_clock::now();
+    crowdBuildHash();
+    if (crowd.steps++ % CROWD_REORDER_STEPS == 0) crowdReorder();
+    crowd.hashMs = msSince(t);
+
+    t = std::chrono::steady_clock::now();
+    crowdSteer(dt);
+    crowd.steerMs = msSince(t);
+
+    t = std::chrono::steady_clock::now();
+    crowdParallel([&](int begin, int end) { integrateAgents(begin, end, dt); });
+    crowd.integrateMs = msSince(t);
+
+    t = std::chrono::steady_clock::now();
+    crowdUpdateGoals(dt);
+    crowd.goalMs = msSince(t);
+}
+
+// Places body and head at a unit cube / unit sphere scaled and offset by uniforms, turned by
+// the instance yaw (radians); a_color is the instance's shirt color
+const char* crowdVertexSrc = R"(
+#version 120
+attribute vec3 a_position;
+attribute vec4 a_instance;
+attribute vec4 a_color;
+uniform vec3 u_scale;
+uniform vec3 u_offset;
+uniform vec3 u_color;
+uniform float u_instanceColor;
+varying vec3 v_color;
+varying vec3 v_world;
+varying float v_fogDepth;
+void main() {
+    vec3 local = a_position * u_scale + u_offset;
+    float c = cos(a_instance.w), s = sin(a_instance.w);
+    vec4 world = vec4(a_instance.xyz + vec3(c * local.x + s * local.z, local.y, c * local.z - s * local.x), 1.0);
+    vec4 eye = gl_ModelViewMatrix * world;
+    v_color = mix(u_color, a_color.rgb, u_instanceColor);
+    v_world = world.xyz;
+    v_fogDepth = abs(eye.z);
+    gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+void createCrowdRenderer() {
+    crowdRenderer.program = createProgram(crowdVertexSrc, vegetationFragmentSrc, shadowReceiverSrc);
+    crowdRenderer.instances.reserve(crowd.count);
+    crowdRenderer.drawScratch.resize(crowd.count);
+}
+
+// Interpolates, culls and LOD-selects every agent (in parallel), then packs the visible
+// ones grouped by head LOD into the instance buffer
+void updateCrowdInstances(float alpha) {
+    const float pixelsPerUnit = (float)windowHeight * 0.5f / tanf(camera.fov * 0.5f * (float)M_PI / 180.0f);
+    std::vector<CrowdInstance>& scratch = crowdRenderer.drawScratch;
+
+    crowdParallel([&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            float x = crowd.prevX[i] + (crowd.x[i] - crowd.prevX[i]) * alpha;
+            float z = crowd.prevZ[i] + (crowd.z[i] - crowd.prevZ[i]) * alpha;
+            float y = terrainGroundOffset(x, z);
+
+            // Bounds as the old single tourists: 1.5 around the chest
+            if (cullingEnabled && !sphereInFrustum(viewFrustum, x, y + 1.3f, z, 1.5f)) {
+                scratch[i].y = -1.0e9f;
+                continue;
+            }
+            if (sphereOccluded(x, y + 1.3f, z, 1.5f)) {
+                scratch[i].y = -2.0e9f;
+                continue;
+            }
+
+            // Head LOD from the head's own projected size
+            float dx = x - camera.x, dy = y + 2.1f - camera.y, dz = z - camera.z;
+            float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+            float pixels = dist <= 0.35f ? 1.0e6f : 0.35f * pixelsPerUnit / dist;
+            crowd.lod[i] = (unsigned char)selectLod(pixels, crowd.lod[i]);
+
+            float bob = 0.08f * fabsf(sinf(crowd.phase[i]));
+            scratch[i] = { x, y + bob, z, atan2f(crowd.headX[i], crowd.headZ[i]), crowd.color[i] };
+        }
+        });
+
+    int counts[LOD_COUNT] = {};
+    int occluded = 0;
+    float* nearest = crowdRenderer.lodNearest;
+    for (int lod = 0; lod < LOD_COUNT; ++lod) nearest[lod] = RENDER_DEPTH_RANGE;
+    for (int i = 0; i < crowd.count; ++i) {
+        if (scratch[i].y > -1.0e8f) {
+            counts[crowd.lod[i]]++;
+            nearest[crowd.lod[i]] = std::min(nearest[crowd.lod[i]], cameraDistance(scratch[i].x, scratch[i].y, scratch[i].z));
+        }
+        else if (scratch[i].y < -1.5e9f) occluded++;
+    }
+    int offsets[LOD_COUNT];
+    int total = 0;
+    for (int lod = 0; lod < LOD_COUNT; ++lod) {
+        offsets[lod] = crowdRenderer.lodFirst[lod] = total;
+        crowdRenderer.lodCount[lod] = counts[lod];
+        total += counts[lod];
+        frameStats.lodObjects[lod] += counts[lod];
+    }
+
+    crowdRenderer.instances.resize(total);
+    for (int i = 0; i < crowd.count; ++i) {
+        if (scratch[i].y > -1.0e8f) crowdRenderer.instances[offsets[crowd.lod[i]]++] = scratch[i];
+    }
+    frameStats.crowdVisible = total;
+    frameStats.objectsCulled += crowd.count - total - occluded;
+    frameStats.objectsOccluded += occluded;
+    frameStats.objectsVisible += total;
+
+    if (total == 0) return;
+    crowdRenderer.stream = streamUpload(crowdRenderer.instances.data(), total * sizeof(CrowdInstance));
+}
+
+// Instances [firstInstance, firstInstance + count) of streamed CrowdInstances
+void drawCrowdMesh(const StreamSlice& instances, const MeshVBO& mesh, int firstInstance, int count) {
+    bindMeshAttributes(mesh, false);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+    glEnableVertexAttribArray(ATTRIB_INSTANCE);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+    GLsizei instStride = sizeof(CrowdInstance);
+    size_t base = instances.offset + (size_t)firstInstance * sizeof(CrowdInstance);
+    glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, instStride, (void*)base);
+    glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, instStride, (void*)(base + offsetof(CrowdInstance, color)));
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+    glVertexAttribDivisor(ATTRIB_COLOR, 1);
+
+    drawMeshInstances(mesh, count);
+
+    glVertexAttribDivisor(ATTRIB_INSTANCE, 0);
+    glVertexAttribDivisor(ATTRIB_COLOR, 0);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glDisableVertexAttribArray(ATTRIB_INSTANCE);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void bindCrowdMaterial() {
+    GLuint program = crowdRenderer.program;
+    stateUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "u_fog"), stateIsEnabled(GL_FOG) ? 1.0f : 0.0f);
+    bindShadowReceiver(program, true, 1.0f); // past the agent's own shadow box (see renderDynamicCasters)
+}
+
+// Bodies (the unit cube) in per-instance color, heads (sphere LODs) in skin tone
+void drawCrowdItem(const DrawItem& item) {
+    GLuint program = crowdRenderer.program;
+    GLint scaleLoc = glGetUniformLocation(program, "u_scale");
+    GLint offsetLoc = glGetUniformLocation(program, "u_offset");
+    GLint instanceColorLoc = glGetUniformLocation(program, "u_instanceColor");
+    if (item.mesh == &unitCubeMesh) {
+        glUniform3f(scaleLoc, 0.7f, 1.5f, 0.4f);
+        glUniform3f(offsetLoc, 0.0f, 1.0f, 0.0f);
+        glUniform1f(instanceColorLoc, 1.0f);
+    }
+    else {
+        glUniform3f(scaleLoc, 0.35f, 0.35f, 0.35f);
+        glUniform3f(offsetLoc, 0.0f, 2.1f, 0.0f);
+        glUniform3f(glGetUniformLocation(program, "u_color"), 1.0f, 0.8f, 0.6f);
+        glUniform1f(instanceColorLoc, 0.0f);
+    }
+    drawCrowdMesh(crowdRenderer.stream, *item.mesh, item.first, item.count);
+}
+
+// Bodies in one item, heads in one item per LOD level
+void queueCrowd() {
+    if (!crowdRenderer.program || crowd.count == 0) return;
+
+    updateCrowdInstances(simAlpha);
+    int total = (int)crowdRenderer.instances.size();
+    if (total == 0) return;
+
+    const float* nearest = crowdRenderer.lodNearest;
+    queueDraw(PASS_OPAQUE, MAT_CROWD, *std::min_element(nearest, nearest + LOD_COUNT), drawCrowdItem, &unitCubeMesh, nullptr, 0, total);
+    for (int lod = 0; lod < LOD_COUNT; ++lod) {
+        if (crowdRenderer.lodCount[lod] > 0)
+            queueDraw(PASS_OPAQUE, MAT_CROWD, nearest[lod], drawCrowdItem,
+                &sphereLods[lod], nullptr, crowdRenderer.lodFirst[lod], crowdRenderer.lodCount[lod]);
+    }
+}
+
+// ---------------------- Shadows ----------------------
+
+// Cascaded shadow maps for the moon (ancient) and the sun (modern). The three cascades
+// are squares of growing size centered on the camera, not fitted to slices of the view
+// frustum, so turning the view never moves them; they are tiles of one depth atlas.
+// Static casters (pyramid, baked stairs and details, trees, rocks) are cached: each scene
+// keeps its own atlas, and a cascade is only re-rendered when the camera walks out of
+// the SHADOW_CACHE_MARGIN its tile covers beyond what it needs, when the light moves,
+// or when the static world changes (invalidateShadowCaches). Dynamic casters, the crowd,
+// are composited every frame: the cached atlas is blitted into a second one and the
+// tourists, one box each, are drawn into its near cascade. Scenes without dynamic
+// casters sample the cached atlas directly. --no-shadow-cache re-renders every cascade every frame.
+// Receivers are the shader-drawn terrain, vegetation and crowd.
+
+const int   SHADOW_CASCADES = 3;                 // must match shadowReceiverSrc
+const int   SHADOW_MAP_SIZE = 1024;              // texels per cascade side
+const float shadowCascadeRadius[SHADOW_CASCADES] = { 32.0f, 90.0f, 260.0f }; // around the camera
+const int   shadowCasterLod[SHADOW_CASCADES] = { 1, 2, 3 };                 // sphere level of the casters
+const float SHADOW_CACHE_MARGIN = 0.5f;          // tiles cover radius * (1 + margin)
+const float SHADOW_DEPTH_PADDING = 120.0f;       // light depth kept past the tile (tall casters)
+const int   SHADOW_DYNAMIC_CASCADES = 1;         // tourists further out only cast into the ground texture noise
+const float shadowStrength[2] = { 0.35f, 0.55f }; // indexed by SceneType (moonlight is faint)
+
+struct ShadowCascade {
+    bool valid = false;
+    float centerX = 0.0f, centerY = 0.0f, centerZ = 0.0f;
+    float halfSize = 0.0f;
+    float view[16], proj[16];
+    float receiver[16];     // world -> tile [0, 1]^3
+    Frustum frustum;        // of proj * view, culls the casters
+};
+
+// One scene's static casters, kept between frames
+struct ShadowCache {
+    GLuint depthTexture = 0;
+    GLuint fbo = 0;
+    ShadowCascade cascades[SHADOW_CASCADES];
+    float lightDir[3] = {};
+    int staticVersion = -1;
+};
+
+struct ShadowMaps {
+    bool enabled = true;          // --no-shadows
+    bool cacheEnabled = true;     // --no-shadow-cache
+    ShadowCache scenes[2];        // indexed by SceneType
+    GLuint compositeTexture = 0;  // cached atlas + dynamic casters, redone every frame
+    GLuint compositeFbo = 0;
+    int compositeScene = -1;      // whose static tiles the composite holds
+    GLuint sampledTexture = 0;    // atlas the receivers read this frame (0 = no shadows)
+    const ShadowCascade* sampledCascades = nullptr;
+    const float* sampledLightDir = nullptr;
+    float strength = 0.0f;
+    int staticVersion = 0;        // bumped by invalidateShadowCaches()
+    int staleRedrawBudget = 1;    // valid cascades re-centered per frame (see Scene Residency)
+
+    VegetationBatch casters;      // trees, then rocks, inside the cascade being rendered
+    std::vector<unsigned char> cellState;
+    std::vector<CrowdInstance> crowdCasters;
+
+    double staticMs = 0.0;        // CPU time of the last frame that re-rendered static cascades
+    double dynamicMs = 0.0;       // CPU time of the last dynamic composite
+} shadows;
+
+// The static casters changed: every scene re-renders its cascades on its next frame
+void invalidateShadowCaches() {
+    shadows.staticVersion++;
+    shadows.compositeScene = -1;
+}
+
+void bindShadowReceiver(GLuint program, bool receive, float lightOffset) {
+    // Always unit 1: a depth-compare and a plain sampler may not share a unit
+    glUniform1i(glGetUniformLocation(program, "u_shadowMap"), 1);
+    bool active = receive && shadows.sampledTexture != 0;
+    glUniform1f(glGetUniformLocation(program, "u_shadowStrength"), active ? shadows.strength : 0.0f);
+    if (!active) return;
+
+    float matrices[SHADOW_CASCADES * 16];
+    for (int i = 0; i < SHADOW_CASCADES; ++i)
+        memcpy(&matrices[i * 16], shadows.sampledCascades[i].receiver, sizeof(float) * 16);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_shadowMatrix"), SHADOW_CASCADES, GL_FALSE, matrices);
+    const float* dir = shadows.sampledLightDir;
+    glUniform3f(glGetUniformLocation(program, "u_shadowOffset"), dir[0] * lightOffset, dir[1] * lightOffset, dir[2] * lightOffset);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, shadows.sampledTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Depth atlas (cascades side by side) with hardware comparison, attached to a depth-only FBO
+GLuint createShadowAtlas(GLuint& fbo) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE * SHADOW_CASCADES, SHADOW_MAP_SIZE, 0,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Shadow map framebuffer is incomplete, shadows disabled" << std::endl;
+        shadows.enabled = false;
+    }
+    return texture;
+}
+
+// Atlases for both scenes and the composite (caster instances are streamed)
+void createShadows() {
+    if (!shadows.enabled) return;
+    if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object) {
+        shadows.enabled = false;
+        return;
+    }
+
+    GLint previousFbo = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+    for (ShadowCache& cache : shadows.scenes)
+        cache.depthTexture = createShadowAtlas(cache.fbo);
+    shadows.compositeTexture = createShadowAtlas(shadows.compositeFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+
+}
+
+// Light-space axes: `dir` points at the light, right/up span the tiles
+void shadowBasis(const float dir[3], float right[3], float up[3]) {
+    float ref[3] = { 0.0f, 1.0f, 0.0f };
+    if (fabsf(dir[1]) > 0.99f) { ref[1] = 0.0f; ref[2] = 1.0f; }
+    right[0] = ref[1] * dir[2] - ref[2] * dir[1];
+    right[1] = ref[2] * dir[0] - ref[0] * dir[2];
+    right[2] = ref[0] * dir[1] - ref[1] * dir[0];
+    float len = sqrtf(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+    right[0] /= len; right[1] /= len; right[2] /= len;
+    up[0] = dir[1] * right[2] - dir[2] * right[1];
+    up[1] = dir[2] * right[0] - dir[0] * right[2];
+    up[2] = dir[0] * right[1] - dir[1] * right[0];
+}
+
+inline float dot3(const float a[3], float x, float y, float z) {
+    return a[0] * x + a[1] * y + a[2] * z;
+}
+
+// True while the camera's sphere of `radius` still fits in the cascade's cached tile
+bool cascadeCoversCamera(const ShadowCascade& c, const float dir[3], float radius) {
+    if (!c.valid) return false;
+    float right[3], up[3];
+    shadowBasis(dir, right, up);
+    float dx = camera.x - c.centerX, dy = camera.y - c.centerY, dz = camera.z - c.centerZ;
+    float slack = c.halfSize - radius;
+    return fabsf(dot3(right, dx, dy, dz)) <= slack && fabsf(dot3(up, dx, dy, dz)) <= slack &&
+        fabsf(dot3(dir, dx, dy, dz)) <= SHADOW_DEPTH_PADDING;
+}
+
+// Re-centers a cascade on the camera: orthographic light matrices, culling frustum and the
+// receivers' world -> tile matrix. The center snaps to whole texels across the light, so
+// shadow edges land on the same texels after a move instead of crawling.
+void placeCascade(ShadowCascade& c, const float dir[3], float radius) {
+    float right[3], up[3];
+    shadowBasis(dir, right, up);
+
+    c.halfSize = radius * (1.0f + SHADOW_CACHE_MARGIN);
+    float texel = 2.0f * c.halfSize / (float)SHADOW_MAP_SIZE;
+    float u = floorf(dot3(right, camera.x, camera.y, camera.z) / texel) * texel;
+    float v = floorf(dot3(up, camera.x, camera.y, camera.z) / texel) * texel;
+    float w = dot3(dir, camera.x, camera.y, camera.z);
+    c.centerX = right[0] * u + up[0] * v + dir[0] * w;
+    c.centerY = right[1] * u + up[1] * v + dir[1] * w;
+    c.centerZ = right[2] * u + up[2] * v + dir[2] * w;
+
+    // Looking down -dir from above the center (same layout as gluLookAt)
+    float depth = c.halfSize + SHADOW_DEPTH_PADDING;
+    float ex = c.centerX + dir[0] * depth, ey = c.centerY + dir[1] * depth, ez = c.centerZ + dir[2] * depth;
+    float view[16] = {
+        right[0], up[0], dir[0], 0.0f,
+        right[1], up[1], dir[1], 0.0f,
+        right[2], up[2], dir[2], 0.0f,
+        -dot3(right, ex, ey, ez), -dot3(up, ex, ey, ez), -dot3(dir, ex, ey, ez), 1.0f
+    };
+    float h = c.halfSize, far = 2.0f * depth;
+    float proj[16] = {
+        1.0f / h, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f / h, 0.0f, 0.0f,
+        0.0f, 0.0f, -2.0f / far, 0.0f,
+        0.0f, 0.0f, -1.0f, 1.0f
+    };
+    memcpy(c.view, view, sizeof(view));
+    memcpy(c.proj, proj, sizeof(proj));
+
+    float clip[16];
+    multiplyMatrices(proj, view, clip);
+    frustumFromMatrix(c.frustum, clip);
+
+    const float bias[16] = {
+        0.5f, 0.0f, 0.0f, 0.0f,
+        0.0f, 0.5f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.5f, 0.0f,
+        0.5f, 0.5f, 0.5f, 1.0f
+    };
+    multiplyMatrices(bias, clip, c.receiver);
+    c.valid = true;
+}
+
+// Viewport, cleared depth and matrices of one cascade's tile in the bound atlas
+void beginCascade(int index, const ShadowCascade& c) {
+    glViewport(index * SHADOW_MAP_SIZE, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glScissor(index * SHADOW_MAP_SIZE, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(c.proj);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(c.view);
+}
+
+// Packs the trees and rocks inside the frustum into the caster buffer (trees first);
+// the scene's object grid rejects whole cells first, like cullScene
+void gatherVegetationCasters(SceneType scene, const Frustum& frustum, int& trees, int& rocks) {
+    const InstanceStore& store = sceneInstances[scene];
+    shadows.cellState.assign(store.cells.size(), BOX_OUTSIDE);
+    for (size_t c = 0; c < store.cells.size(); ++c) {
+        if (store.cells[c].occupied) shadows.cellState[c] = (unsigned char)classifyBox(frustum, store.cells[c]);
+    }
+
+    std::vector<TreeInstance>& out = shadows.casters.visibleScratch;
+    out.clear();
+    auto gather = [&](ObjectKind kind) {
+        for (int id = store.kindBegin[kind]; id < store.kindEnd[kind]; ++id) {
+            BoxVisibility cellVis = (BoxVisibility)shadows.cellState[store.cell[id]];
+            if (cellVis == BOX_OUTSIDE) continue;
+            if (cellVis == BOX_INTERSECTS &&
+                !sphereInFrustum(frustum, store.boundX[id], store.boundY[id], store.boundZ[id], store.boundRadius[id]))
+                continue;
+            out.push_back({ store.posX[id], store.posY[id], store.posZ[id], store.scaleX[id], 0.0f, 0.0f, 0.0f, 1.0f });
+        }
+        return (int)out.size();
+        };
+    trees = gather(OBJ_TREE);
+    rocks = gather(OBJ_ROCK) - trees;
+
+    shadows.casters.instanceCount = trees + rocks;
+    if (out.empty()) return;
+    shadows.casters.instances = streamUpload(out.data(), out.size() * sizeof(TreeInstance));
+}
+
+// Baked batches, all objects inside the frustum, spheres at `lod`
+void drawStaticCasters(SceneType scene, const Frustum& frustum, int lod) {
+    static std::vector<GLint> firsts;
+    static std::vector<GLsizei> counts;
+    const InstanceStore& store = sceneInstances[scene];
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    GLsizei stride = 6 * sizeof(GLfloat);
+    for (const StaticBatch& batch : staticBatches[scene]) {
+        firsts.clear();
+        counts.clear();
+        long long vertices = 0;
+        for (const BatchRange& range : batch.ranges) {
+            if (range.lod >= 0 && range.lod != lod) continue;
+            int id = range.objectId;
+            if (id >= 0 && !sphereInFrustum(frustum, store.boundX[id], store.boundY[id], store.boundZ[id], store.boundRadius[id]))
+                continue;
+
+            if (!firsts.empty() && firsts.back() + counts.back() == range.first)
+                counts.back() += range.count;
+            else {
+                firsts.push_back(range.first);
+                counts.push_back(range.count);
+            }
+            vertices += range.count;
+        }
+        if (firsts.empty()) continue;
+
+        glBindBuffer(GL_ARRAY_BUFFER, batch.mesh.vbo);
+        glVertexPointer(3, GL_FLOAT, stride, (void*)0);
+        glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), (GLsizei)firsts.size());
+        countDraw(vertices);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Everything that never moves, into the current cascade tile
+void renderStaticCasters(SceneType scene, const ShadowCascade& c, int lod) {
+    const InstanceStore& store = sceneInstances[scene];
+    int pyramid = store.kindBegin[OBJ_PYRAMID];
+    if (sphereInFrustum(c.frustum, store.boundX[pyramid], store.boundY[pyramid], store.boundZ[pyramid], store.boundRadius[pyramid]))
+        drawUnlitMesh(pyramidMesh);
+
+    drawStaticCasters(scene, c.frustum, lod);
+
+    if (!vegetationProgram) return;
+    int trees = 0, rocks = 0;
+    gatherVegetationCasters(scene, c.frustum, trees, rocks);
+    if (trees + rocks == 0) return;
+
+    stateUseProgram(vegetationProgram);
+    bindShadowReceiver(vegetationProgram, false);
+    if (trees > 0) {
+        drawInstancedMesh(treeTrunkMesh, shadows.casters, 0, trees);
+        drawInstancedMesh(treeCanopyLods[lod], shadows.casters, 0, trees);
+    }
+    if (rocks > 0)
+        drawInstancedMesh(rockLods[lod], shadows.casters, trees, rocks);
+    stateUseProgram(0);
+}
+
+// Tourists at their interpolated positions, into the near cascades of the bound atlas, as
+// one box from feet to head each; returns how many instances were drawn
+int renderDynamicCasters(const ShadowCascade* cascades) {
+    if (!crowdRenderer.program || crowd.count == 0) return 0;
+
+    std::vector<CrowdInstance>& out = shadows.crowdCasters;
+    out.clear();
+    int first[SHADOW_DYNAMIC_CASCADES], count[SHADOW_DYNAMIC_CASCADES];
+    for (int c = 0; c < SHADOW_DYNAMIC_CASCADES; ++c) {
+        first[c] = (int)out.size();
+        for (int i = 0; i < crowd.count; ++i) {
+            float x = crowd.prevX[i] + (crowd.x[i] - crowd.prevX[i]) * simAlpha;
+            float z = crowd.prevZ[i] + (crowd.z[i] - crowd.prevZ[i]) * simAlpha;
+            float y = terrainGroundOffset(x, z);
+            if (!sphereInFrustum(cascades[c].frustum, x, y + 1.3f, z, 1.5f)) continue;
+            out.push_back({ x, y, z, atan2f(crowd.headX[i], crowd.headZ[i]), 0 });
+        }
+        count[c] = (int)out.size() - first[c];
+    }
+    if (out.empty()) return 0;
+    StreamSlice instances = streamUpload(out.data(), out.size() * sizeof(CrowdInstance));
+
+    GLuint program = crowdRenderer.program;
+    stateUseProgram(program);
+    bindShadowReceiver(program, false);
+    glUniform3f(glGetUniformLocation(program, "u_scale"), 0.6f, 2.2f, 0.4f);
+    glUniform3f(glGetUniformLocation(program, "u_offset"), 0.0f, 1.35f, 0.0f);
+    for (int c = 0; c < SHADOW_DYNAMIC_CASCADES; ++c) {
+        if (count[c] == 0) continue;
+        beginCascade(c, cascades[c]);
+        drawCrowdMesh(instances, unitCubeMesh, first[c], count[c]);
+    }
+    stateUseProgram(0);
+    return (int)out.size();
+}
+
+// Once per frame, before anything that receives shadows is drawn: re-renders the static
+// cascades that moved (all of them with the cache off), then composites the dynamic
+// casters. Leaves the camera's matrices, viewport and framebuffer as they were.
+void updateShadows(SceneType scene) {
+    shadows.sampledTexture = 0;
+    if (!shadows.enabled) return;
+
+    ShadowCache& cache = shadows.scenes[scene];
+    float dir[3];
+    sceneLightDirection(scene, dir);
+    if (!shadows.cacheEnabled || cache.staticVersion != shadows.staticVersion ||
+        dir[0] != cache.lightDir[0] || dir[1] != cache.lightDir[1] || dir[2] != cache.lightDir[2]) {
+        for (ShadowCascade& c : cache.cascades) c.valid = false;
+        memcpy(cache.lightDir, dir, sizeof(dir));
+        cache.staticVersion = shadows.staticVersion;
+    }
+
+    // Nothing may sample an atlas while it is being rendered
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLint previousFbo = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT | GL_VIEWPORT_BIT | GL_SCISSOR_BIT | GL_COLOR_BUFFER_BIT);
+    statePushEnables();
+    stateDisable(GL_LIGHTING);
+    stateDisable(GL_FOG);
+    stateDisable(GL_CULL_FACE);        // open meshes (stairs, patches) cast from both sides
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    stateEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);    // slope-scaled bias against acne on the receivers
+
+    auto start = std::chrono::steady_clock::now();
+    bool redrawn[SHADOW_CASCADES] = {};
+    int staleRedraws = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, cache.fbo);
+    stateEnable(GL_SCISSOR_TEST);      // clears stay inside the tile
+    for (int i = 0; i < SHADOW_CASCADES; ++i) {
+        ShadowCascade& c = cache.cascades[i];
+        if (cascadeCoversCamera(c, dir, shadowCascadeRadius[i])) continue;
+        // A valid cascade that fell behind the camera waits its turn (finest first)
+        if (c.valid) {
+            if (staleRedraws >= shadows.staleRedrawBudget) continue;
+            ++staleRedraws;
+        }
+
+        placeCascade(c, dir, shadowCascadeRadius[i]);
+        beginCascade(i, c);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        renderStaticCasters(scene, c, shadowCasterLod[i]);
+        redrawn[i] = true;
+        frameStats.shadowCascadesRendered++;
+    }
+    stateDisable(GL_SCISSOR_TEST);
+    if (frameStats.shadowCascadesRendered > 0)
+        shadows.staticMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    shadows.sampledTexture = cache.depthTexture;
+    if (scene == MODERN_SCENE && crowd.count > 0) {
+        start = std::chrono::steady_clock::now();
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, cache.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadows.compositeFbo);
+        for (int i = 0; i < SHADOW_CASCADES; ++i) {
+            // Tiles without dynamic casters only need a copy when their static content changed
+            if (i >= SHADOW_DYNAMIC_CASCADES && !redrawn[i] && shadows.compositeScene == scene) continue;
+            int x0 = i * SHADOW_MAP_SIZE, x1 = x0 + SHADOW_MAP_SIZE;
+            glBlitFramebuffer(x0, 0, x1, SHADOW_MAP_SIZE, x0, 0, x1, SHADOW_MAP_SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+        shadows.compositeScene = scene;
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.compositeFbo);
+        frameStats.shadowDynamicCasters = renderDynamicCasters(cache.cascades);
+        shadows.sampledTexture = shadows.compositeTexture;
+        shadows.dynamicMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    glPopAttrib();
+    statePopEnables();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+
+    shadows.sampledCascades = cache.cascades;
+    shadows.sampledLightDir = cache.lightDir;
+    shadows.strength = shadowStrength[scene];
+}
+
+// ---------------------- Scenes ----------------------
+
+// Every placement of both scenes; kinds are added in enum order so each stays contiguous.
+// Static kinds get their bounds measured by the bake, instanced kinds get them here.
+void buildSceneInstances(SceneType scene) {
+    InstanceStore& store = sceneInstances[scene];
+    bool ancient = (scene == ANCIENT_SCENE);
+
+    // Pyramid (terraces + temple)
+    int id = addInstance(store, OBJ_PYRAMID, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f,
+        ancient ? 0.38f : 1.0f, ancient ? 0.40f : 0.96f, ancient ? 0.34f : 0.90f);
+    setInstanceBounds(store, id, 0.0f, 8.0f, 0.0f, 21.0f);
+
+    // Temple entrance + decorative details (colors are per part, see bakeTempleDetails)
+    addInstance(store, OBJ_TEMPLE, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f);
+
+    // Staircases: front (+Z), right (+X), back (-Z), left (-X)
+    const float stairYaw[4] = { 0.0f, 90.0f, 180.0f, -90.0f };
+    for (float yaw : stairYaw)
+        addInstance(store, OBJ_STAIRCASE, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, yaw, 0.78f, 0.74f, 0.68f);
+
+    // Trees: bounding sphere from trunk base (y) to canopy top (y + 7.5 * scale)
+    // Everything stands on the terrain (offset 0 on the flat plaza)
+    auto addTree = [&](float x, float z, float scale, float r, float g, float b) {
+        float y = terrainGroundOffset(x, z);
+        int tree = addInstance(store, OBJ_TREE, x, y, z, scale, scale, scale, 0.0f, r, g, b);
+        setInstanceBounds(store, tree, x, y + 3.75f * scale, z, 4.6f * scale);
+        };
+
+    if (ancient) {
+        // Dense jungle over the whole ground, clear around the pyramid (see Jungle Generator)
+        std::vector<JunglePlant> jungle = generateJungle(JungleParams());
+        for (const JunglePlant& plant : jungle) {
+            if (plant.kind == PLANT_TREE) addTree(plant.x, plant.z, plant.scale, plant.r, plant.g, plant.b);
+        }
+
+        // Rocks: squashed spheres (see MESH_ROCK_LOD0), bounds around the visible half
+        auto addRock = [&](float x, float z, float scale, float r, float g, float b) {
+            float y = terrainGroundOffset(x, z);
+            int rock = addInstance(store, OBJ_ROCK, x, y, z, scale, scale * 0.6f, scale, 0.0f, r, g, b);
+            setInstanceBounds(store, rock, x, y + 0.3f * scale, z, scale);
+            };
+
+        // Ring of rocks around the base
+        float rockRadius = 28.0f;
+        for (int i = 0; i < 32; ++i) {
+            float angle = (float)i * (2.0f * (float)M_PI / 32.0f);
+            float radius = rockRadius + (i % 4) * 2.5f;   // slightly irregular
+            addRock(cosf(angle) * radius, sinf(angle) * radius, 0.7f + (i % 3) * 0.25f, 0.40f, 0.40f, 0.42f);
+        }
+
+        // A few larger rocks closer to some stairs
+        addRock(5.0f, 20.0f, 1.2f, 0.40f, 0.40f, 0.42f);
+        addRock(-7.0f, 19.0f, 1.0f, 0.40f, 0.40f, 0.42f);
+        addRock(11.0f, -19.0f, 1.3f, 0.40f, 0.40f, 0.42f);
+        addRock(-10.0f, -18.0f, 1.1f, 0.40f, 0.40f, 0.42f);
+
+        for (const JunglePlant& plant : jungle) {
+            if (plant.kind == PLANT_ROCK) addRock(plant.x, plant.z, plant.scale, plant.r, plant.g, plant.b);
+        }
+
+        // A few irregular dirt patches around the base
+        auto addPatch = [&](float x, float z, float sx, float sz) {
+            addInstance(store, OBJ_PATCH, x, -0.8f, z, sx, 0.4f, sz, 0.0f, 0.18f, 0.13f, 0.09f);
+            };
+        addPatch(6.0f, 18.0f, 10.0f, 6.0f);
+        addPatch(-8.0f, 16.0f, 7.0f, 5.0f);
+        addPatch(10.0f, -15.0f, 8.0f, 7.0f);
+        addPatch(-12.0f, -17.0f, 9.0f, 6.0f);
+        addPatch(0.0f, 22.0f, 12.0f, 4.0f);
+
+        // Fallen tree leaning toward the pyramid front (scaleX = trunk length)
+        addInstance(store, OBJ_FALLEN_TREE, 18.0f, 0.0f, 10.0f, 6.0f, 1.0f, 1.0f, 200.0f, 0.28f, 0.18f, 0.10f);
+        for (const JunglePlant& plant : jungle) {
+            if (plant.kind == PLANT_LOG)
+                addInstance(store, OBJ_FALLEN_TREE, plant.x, terrainGroundOffset(plant.x, plant.z), plant.z,
+                    plant.scale, 1.0f, 1.0f, plant.yaw, plant.r, plant.g, plant.b);
+        }
+    }
+    else {
+        // Fewer, placed trees (landscaped)
+        addTree(-25.0f, -25.0f, 1.5f, 0.1f, 0.5f, 0.1f);
+        addTree(25.0f, -25.0f, 1.3f, 0.1f, 0.5f, 0.1f);
+        addTree(-25.0f, 25.0f, 1.4f, 0.1f, 0.5f, 0.1f);
+        addTree(25.0f, 25.0f, 1.2f, 0.1f, 0.5f, 0.1f);
+
+        // Tourists are the simulated crowd (see Crowd), not placed instances
+    }
+}
+
+void drawPyramidItem(const DrawItem& item) {
+    const InstanceStore& store = *(const InstanceStore*)item.source;
+    int id = item.first;
+    drawMeshLit(*item.mesh, store.colorR[id], store.colorG[id], store.colorB[id]);
+}
+
+void queuePyramid(SceneType scene) {
+    const InstanceStore& store = sceneInstances[scene];
+    int id = store.kindBegin[OBJ_PYRAMID];
+    if (store.visible[id])
+        queueDraw(PASS_OPAQUE, MAT_PYRAMID, instanceDepth(store, id), drawPyramidItem, &pyramidMesh, &store, id, 1);
+}
+
+// CPU side of the frame's draw lists, after culling: the static batches' visible runs and
+// the vegetation instance lists, as jobs on the worker pool. The queue emitters then only
+// upload and record them on the GL thread.
+void buildDrawLists(SceneType scene) {
+    buildStaticBatchLists(scene);
+    if (scene == ANCIENT_SCENE) {
+        buildVisibleInstances(ancientForest, ANCIENT_SCENE, OBJ_TREE);
+        buildVisibleInstances(jungleRocks, ANCIENT_SCENE, OBJ_ROCK);
+    }
+    else {
+        buildVisibleInstances(modernTrees, MODERN_SCENE, OBJ_TREE);
+    }
+}
+
+void queueAncientScene() {
+    // Slightly darker, more desaturated stone with a hint of green (see buildSceneInstances)
+    queuePyramid(ANCIENT_SCENE);
+
+    // Stairs, temple details, dirt patches and fallen trees (baked, see bakeStaticScene)
+    queueStaticBatches(ANCIENT_SCENE);
+
+    // Dense jungle trees and rocks (instanced, see createForests)
+    queueTrees(ancientForest);
+    queueRocks(jungleRocks);
+}
+
+
+void queueModernScene() {
+    // Clean bright limestone
+    queuePyramid(MODERN_SCENE);
+
+    // Sharp staircases + temple details (baked, see bakeStaticScene)
+    queueStaticBatches(MODERN_SCENE);
+
+    // Fewer, placed trees (landscaped)
+    queueTrees(modernTrees);
+
+    // Visitors around the pyramid and queuing at the stairs (simulated, see Crowd)
+    queueCrowd();
+}
+
+// State shared by every item of a material, set once per run of that material.
+// Unbinding leaves what the rest of the frame expects (fixed function, lighting on).
+struct RenderMaterialState {
+    void (*bind)();
+    void (*unbind)();
+};
+
+const RenderMaterialState renderMaterials[MAT_COUNT] = {
+    { bindSkyMaterial,         unbindSkyMaterial },         // MAT_SKY
+    { nullptr,                 nullptr },                   // MAT_PYRAMID: fixed-function lit
+    { bindStaticBatchMaterial, unbindStaticBatchMaterial }, // MAT_STATIC_BATCH
+    { bindCrowdMaterial,       unbindShaderMaterial },      // MAT_CROWD
+    { bindVegetationMaterial,  unbindShaderMaterial },      // MAT_VEGETATION
+    { bindTerrainMaterial,     unbindTerrainMaterial },     // MAT_TERRAIN
+    { bindCloudMaterial,       unbindShaderMaterial },      // MAT_CLOUDS
+};
+
+// Opaque samples that passed the depth test over the frame's pixels, from a query
+// issued OVERDRAW_QUERIES - 1 submits ago (never waits on the GPU)
+void beginOverdrawQuery() {
+    RenderQueue& q = renderQueue;
+    if (!q.overdrawQueries[0]) glGenQueries(OVERDRAW_QUERIES, q.overdrawQueries);
+
+    GLuint query = q.overdrawQueries[q.overdrawSlot];
+    if (q.overdrawIssued[q.overdrawSlot]) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+            q.overdraw = (double)samples / std::max(1, windowWidth * windowHeight);
+        }
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    q.overdrawIssued[q.overdrawSlot] = true;
+    q.overdrawSlot = (q.overdrawSlot + 1) % OVERDRAW_QUERIES;
+}
+
+// Starts timing a run of `material` (-1 ends the last run; see Performance Overlay)
+void perfMarkMaterial(int material);
+
+// Sorts the frame's items by key (unless --no-render-sort) and issues them, binding a
+// material only where it differs from the previous item's
+void submitRenderQueue() {
+    RenderQueue& q = renderQueue;
+    if (q.sorted)
+        std::sort(q.items, q.items + q.count, [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+    int bound = -1;
+    int switches = 0;
+    bool opaque = false, queried = false;
+    for (int i = 0; i < q.count; ++i) {
+        const DrawItem& item = q.items[i];
+        int material = renderKeyMaterial(item.key);
+        if (material != bound) {
+            if (bound >= 0 && renderMaterials[bound].unbind) renderMaterials[bound].unbind();
+            bool opaquePass = renderKeyPass(item.key) == PASS_OPAQUE;
+            if (opaquePass && !queried) {
+                beginOverdrawQuery();
+                opaque = queried = true;
+            }
+            else if (!opaquePass && opaque) {
+                glEndQuery(GL_SAMPLES_PASSED);
+                opaque = false;
+            }
+            perfMarkMaterial(material);
+            if (renderMaterials[material].bind) renderMaterials[material].bind();
+            bound = material;
+            switches++;
+        }
+        item.draw(item);
+    }
+    if (bound >= 0 && renderMaterials[bound].unbind) renderMaterials[bound].unbind();
+    if (opaque) glEndQuery(GL_SAMPLES_PASSED);
+    if (bound >= 0) perfMarkMaterial(-1);
+
+    frameStats.queueItems += q.count;
+    frameStats.materialSwitches += switches;
+    frameStats.materialSwitchesSaved += q.count - switches; // items that reused the bound material
+    frameStats.overdraw = q.overdraw;
+    frameStats.arenaPeak = q.arena.peak;
+}
+
+// ---------------------- VBO Creation ----------------------
+
+void addBox(std::vector<float>& data,
+    float halfSizeX, float halfSizeY, float halfSizeZ,
+    float centerY, float centerZOffset)
+{
+    // center at (0, centerY, centerZOffset)
+    float cx = 0.0f;
+    float cy = centerY;
+    float cz = centerZOffset;
+
+    // Convenience lambda to push one triangle
+    auto pushTri = [&](float x1, float y1, float z1,
+        float x2, float y2, float z2,
+        float x3, float y3, float z3,
+        float nx, float ny, float nz)
+        {
+            float v[9] = { x1,y1,z1,x2,y2,z2,x3,y3,z3 };
+            for (int i = 0; i < 3; ++i) {
+                data.push_back(v[i * 3 + 0]);
+                data.push_back(v[i * 3 + 1]);
+                data.push_back(v[i * 3 + 2]);
+                data.push_back(nx);
+                data.push_back(ny);
+                data.push_back(nz);
+            }
+        };
+
+    float x0 = cx - halfSizeX, x1 = cx + halfSizeX;
+    float y0 = cy - halfSizeY, y1 = cy + halfSizeY;
+    float z0 = cz - halfSizeZ, z1 = cz + halfSizeZ;
+
+    // Top (+Y)
+    pushTri(x0, y1, z0, x1, y1, z1, x1, y1, z0, 0, 1, 0);
+    pushTri(x0, y1, z0, x0, y1, z1, x1, y1, z1, 0, 1, 0);
+
+    // Bottom (-Y)
+    pushTri(x0, y0, z0, x1, y0, z0, x1, y0, z1, 0, -1, 0);
+    pushTri(x0, y0, z0, x1, y0, z1, x0, y0, z1, 0, -1, 0);
 
-void drawStairs() {
-    glPushMatrix();
     // Front (+Z)
-    drawOneStaircase(0.0f);
-    // Right (+X)
-    drawOneStaircase(90.0f);
+    pushTri(x0, y0, z1, x1, y0, z1, x1, y1, z1, 0, 0, 1);
+    pushTri(x0, y0, z1, x1, y1, z1, x0, y1, z1, 0, 0, 1);
+
     // Back (-Z)
-    drawOneStaircase(180.0f);
+    pushTri(x0, y0, z0, x1, y1, z0, x1, y0, z0, 0, 0, -1);
+    pushTri(x0, y0, z0, x0, y1, z0, x1, y1, z0, 0, 0, -1);
+
     // Left (-X)
-    drawOneStaircase(-90.0f);
-    glPopMatrix();
+    pushTri(x0, y0, z0, x0, y0, z1, x0, y1, z1, -1, 0, 0);
+    pushTri(x0, y0, z0, x0, y1, z1, x0, y1, z0, -1, 0, 0);
+
+    // Right (+X)
+    pushTri(x1, y0, z0, x1, y1, z1, x1, y0, z1, 1, 0, 0);
+    pushTri(x1, y0, z0, x1, y1, z0, x1, y1, z1, 1, 0, 0);
+}
+
+// UV sphere with the same slices/stacks meaning as glutSolidSphere, centered at (0, centerY, 0)
+void addSphere(std::vector<float>& data, float radius, int slices, int stacks, float centerY)
+{
+    auto pushVertex = [&](float theta, float phi) {
+        float nx = sinf(phi) * cosf(theta);
+        float ny = cosf(phi);
+        float nz = -sinf(phi) * sinf(theta);
+        data.push_back(nx * radius);
+        data.push_back(ny * radius + centerY);
+        data.push_back(nz * radius);
+        data.push_back(nx);
+        data.push_back(ny);
+        data.push_back(nz);
+        };
+
+    for (int j = 0; j < stacks; ++j) {
+        float phi0 = (float)M_PI * (float)j / (float)stacks;
+        float phi1 = (float)M_PI * (float)(j + 1) / (float)stacks;
+
+        for (int i = 0; i < slices; ++i) {
+            float theta0 = 2.0f * (float)M_PI * (float)i / (float)slices;
+            float theta1 = 2.0f * (float)M_PI * (float)(i + 1) / (float)slices;
+
+            // Counter-clockwise seen from outside
+            if (j > 0) {
+                pushVertex(theta0, phi0);
+                pushVertex(theta0, phi1);
+                pushVertex(theta1, phi0);
+            }
+            if (j < stacks - 1) {
+                pushVertex(theta1, phi0);
+                pushVertex(theta0, phi1);
+                pushVertex(theta1, phi1);
+            }
+        }
+    }
+}
+
+// Shared meshes are welded into an index buffer, with normals packed as
+// GL_INT_2_10_10_10_REV (GL_BYTE before GL 3.3, or when `byteNormals` asks for it) and
+// positions as half floats when every
+// coordinate survives the round trip within MESH_HALF_TOLERANCE mesh units: the unit
+// spheres, rocks and tree parts qualify, the pyramid (world units, flush against baked
+// details) keeps 32-bit floats. A 24-byte triangle-list vertex becomes 12 bytes plus a
+// 16-bit index, and shared corners are fetched and transformed once per instance instead
+// of up to six times. The builders and the scene cache keep producing triangle lists.
+const float MESH_HALF_TOLERANCE = 1.0f / 512.0f;
+bool meshPackingEnabled = true; // --no-mesh-packing
+
+unsigned short floatToHalf(float f) {
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x7fffff;
+    if (exponent <= 0) return (unsigned short)sign;              // flushed to zero
+    if (exponent >= 31) return (unsigned short)(sign | 0x7c00);  // infinity
+    unsigned int half = sign | (unsigned int)exponent << 10 | mantissa >> 13;
+    if (mantissa & 0x1000) ++half; // round to nearest; a carry correctly bumps the exponent
+    return (unsigned short)half;
+}
+
+float halfToFloat(unsigned short h) {
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int mantissa = h & 0x3ff;
+    unsigned int bits = sign;
+    if (exponent == 31) bits |= 0x7f800000;
+    else if (exponent > 0) bits |= (exponent - 15 + 127) << 23 | mantissa << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Signed normalized x, y, z in 10 bits each (w = 0), R in the lowest bits
+inline unsigned int packNormal1010102(float x, float y, float z) {
+    auto component = [](float c) {
+        return (unsigned int)lroundf(std::min(std::max(c, -1.0f), 1.0f) * 511.0f) & 0x3ff;
+        };
+    return component(x) | component(y) << 10 | component(z) << 20;
+}
+
+void uploadMesh(MeshVBO& mesh, const float* data, int vertexCount, bool byteNormals) {
+    mesh.sourceBytes = (size_t)vertexCount * 6 * sizeof(float);
+    if (!mesh.vbo) glGenBuffers(1, &mesh.vbo);
+
+    if (!meshPackingEnabled) {
+        mesh = MeshVBO{ mesh.vbo, vertexCount };
+        mesh.sourceBytes = mesh.uploadedBytes = (size_t)vertexCount * 6 * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+        glBufferData(GL_ARRAY_BUFFER, mesh.sourceBytes, data, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    bool halfPositions = true;
+    for (int v = 0; v < vertexCount && halfPositions; ++v) {
+        for (int k = 0; k < 3; ++k) {
+            float p = data[v * 6 + k];
+            if (fabsf(halfToFloat(floatToHalf(p)) - p) > MESH_HALF_TOLERANCE) halfPositions = false;
+        }
+    }
+    mesh.positionType = halfPositions ? GL_HALF_FLOAT : GL_FLOAT;
+    mesh.normalType = GLEW_VERSION_3_3 && !byteNormals ? GL_INT_2_10_10_10_REV : GL_BYTE;
+    mesh.normalOffset = halfPositions ? 4 * sizeof(unsigned short) : 3 * sizeof(float); // halves padded to 8 bytes
+    mesh.stride = mesh.normalOffset + 4;
+
+    // Pack every triangle-list vertex first, so welding compares exactly what the GPU sees
+    const size_t stride = (size_t)mesh.stride;
+    std::vector<unsigned char> packed((size_t)vertexCount * stride, 0);
+    for (int v = 0; v < vertexCount; ++v) {
+        const float* src = data + (size_t)v * 6;
+        unsigned char* dst = &packed[v * stride];
+        if (halfPositions) {
+            unsigned short half[3] = { floatToHalf(src[0]), floatToHalf(src[1]), floatToHalf(src[2]) };
+            memcpy(dst, half, sizeof(half));
+        }
+        else {
+            memcpy(dst, src, 3 * sizeof(float));
+        }
+        if (mesh.normalType == GL_INT_2_10_10_10_REV) {
+            unsigned int normal = packNormal1010102(src[3], src[4], src[5]);
+            memcpy(dst + mesh.normalOffset, &normal, sizeof(normal));
+        }
+        else {
+            for (int k = 0; k < 3; ++k)
+                dst[mesh.normalOffset + k] = (unsigned char)(signed char)lroundf(std::min(std::max(src[3 + k], -1.0f), 1.0f) * 127.0f);
+        }
+    }
+
+    // Weld: sort vertex ids by their bytes; a stable sort leaves the lowest id first in each
+    // run of equal vertices. Unique vertices are then numbered by first use, so triangles
+    // keep their order and nearby triangles keep nearby indices.
+    auto bytesOf = [&](int v) { return &packed[(size_t)v * stride]; };
+    std::vector<int> order(vertexCount);
+    for (int v = 0; v < vertexCount; ++v) order[v] = v;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return memcmp(bytesOf(a), bytesOf(b), stride) < 0; });
+    std::vector<int> canonical(vertexCount);
+    for (int j = 0; j < vertexCount; ++j) {
+        bool repeat = j > 0 && memcmp(bytesOf(order[j]), bytesOf(order[j - 1]), stride) == 0;
+        canonical[order[j]] = repeat ? canonical[order[j - 1]] : order[j];
+    }
+
+    std::vector<int> remap(vertexCount, -1);
+    std::vector<unsigned char> vertices;
+    std::vector<float> positions;
+    std::vector<unsigned int> indices(vertexCount);
+    int unique = 0;
+    for (int v = 0; v < vertexCount; ++v) {
+        int c = canonical[v];
+        if (remap[c] < 0) {
+            remap[c] = unique++;
+            vertices.insert(vertices.end(), bytesOf(c), bytesOf(c) + stride);
+            positions.insert(positions.end(), data + (size_t)c * 6, data + (size_t)c * 6 + 3);
+        }
+        indices[v] = (unsigned int)remap[c];
+    }
+
+    // The pyramid's "before" also undoes the hidden-face pass (see setUnoptimizedAcmr)
+    mesh.acmrBefore = mesh.acmrAfter = simulateAcmr(indices, unique);
+    mesh.overdrawClusters = 0;
+    if (meshOptimizeEnabled) {
+        std::vector<unsigned int> sorted = indices;
+        int clusters = sortClustersOutward(sorted, positions, unique);
+        float acmr = simulateAcmr(sorted, unique);
+        if (clusters > 1 && sorted != indices && acmr <= mesh.acmrAfter) {
+            indices.swap(sorted);
+            mesh.acmrAfter = acmr;
+            mesh.overdrawClusters = clusters;
+        }
+    }
+
+    mesh.vertexCount = unique;
+    mesh.indexCount = vertexCount;
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!mesh.ibo) glGenBuffers(1, &mesh.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+    size_t indexBytes;
+    if (unique <= 65536) {
+        std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        mesh.indexType = GL_UNSIGNED_SHORT;
+        indexBytes = shortIndices.size() * sizeof(unsigned short);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else {
+        mesh.indexType = GL_UNSIGNED_INT;
+        indexBytes = indices.size() * sizeof(unsigned int);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    mesh.uploadedBytes = vertices.size() + indexBytes;
+}
+
+void uploadMesh(MeshVBO& mesh, const std::vector<float>& data, bool byteNormals) {
+    uploadMesh(mesh, data.data(), (int)(data.size() / 6), byteNormals);
+}
+
+// More El Castillo–like proportions:
+// 9 terraces, each slightly inset, shorter height,
+// with a small temple on top.
+void addPyramidBoxes(std::vector<float>& data) {
+    float currentY = PYRAMID_TERRACE_HEIGHT * 0.5f;
+
+    for (int i = 0; i < PYRAMID_TERRACE_COUNT; ++i) {
+        float halfSize = PYRAMID_BASE_HALF - i * PYRAMID_TERRACE_INSET;
+        addBox(data, halfSize, PYRAMID_TERRACE_HEIGHT * 0.5f, halfSize, currentY, 0.0f);
+        currentY += PYRAMID_TERRACE_HEIGHT;
+    }
+
+    // Temple on top (slightly rectangular, like the real one)
+    float templeCenterY = currentY + PYRAMID_TEMPLE_RISE;
+    addBox(data, PYRAMID_TEMPLE_HALF, PYRAMID_TEMPLE_HALF_HEIGHT, PYRAMID_TEMPLE_HALF, templeCenterY, 0.0f);
+}
+
+void buildPyramidData(std::vector<float>& data) {
+    if (meshOptimizeEnabled) {
+        // Same boxes, minus the faces buried in the terrace above, the temple or the plaza
+        std::vector<SolidBox> solids;
+        pyramidSolids(solids);
+        for (size_t i = 0; i + 1 < solids.size(); ++i)
+            addVisibleBoxFaces(data, solids[i], solids, pyramidHiddenFaces);
+        return;
+    }
+    addPyramidBoxes(data);
+}
+
+// Every shared mesh of the app, addressed by id so the scene cache can store them in a table
+enum MeshId {
+    MESH_PYRAMID,
+    MESH_UNIT_CUBE,
+    MESH_SPHERE_LOD0,                                  // unit spheres, one per LOD level
+    MESH_TREE_TRUNK = MESH_SPHERE_LOD0 + LOD_COUNT,
+    MESH_TREE_CANOPY_LOD0,                             // tree-local canopy, one per LOD level
+    MESH_ROCK_LOD0 = MESH_TREE_CANOPY_LOD0 + LOD_COUNT, // unit rock, one per LOD level
+    MESH_COUNT = MESH_ROCK_LOD0 + LOD_COUNT
+};
+
+// Meshes lit by the fixed-function pipeline (drawMeshLit). glNormalPointer does not convert
+// packed 10-bit normals the way attributes do on every driver (llvmpipe lights them far too
+// bright), so these get byte normals: same size, 8 bits per component.
+inline bool meshLitFixedFunction(int id) {
+    return id == MESH_PYRAMID;
+}
+
+// Name in reports ("sphere_lod2", ...)
+std::string meshName(int id) {
+    if (id == MESH_PYRAMID) return "pyramid";
+    if (id == MESH_UNIT_CUBE) return "unit_cube";
+    if (id == MESH_TREE_TRUNK) return "tree_trunk";
+    if (id < MESH_TREE_TRUNK) return "sphere_lod" + std::to_string(id - MESH_SPHERE_LOD0);
+    if (id < MESH_ROCK_LOD0) return "tree_canopy_lod" + std::to_string(id - MESH_TREE_CANOPY_LOD0);
+    return "rock_lod" + std::to_string(id - MESH_ROCK_LOD0);
+}
+
+MeshVBO& meshSlot(int id) {
+    if (id == MESH_PYRAMID) return pyramidMesh;
+    if (id == MESH_UNIT_CUBE) return unitCubeMesh;
+    if (id == MESH_TREE_TRUNK) return treeTrunkMesh;
+    if (id < MESH_TREE_TRUNK) return sphereLods[id - MESH_SPHERE_LOD0];
+    if (id < MESH_ROCK_LOD0) return treeCanopyLods[id - MESH_TREE_CANOPY_LOD0];
+    return rockLods[id - MESH_ROCK_LOD0];
+}
+
+// Interleaved [x y z nx ny nz] vertices of one mesh (CPU only, no GL calls)
+void buildMeshData(int id, std::vector<float>& data) {
+    if (id == MESH_PYRAMID) buildPyramidData(data);
+    else if (id == MESH_UNIT_CUBE) addBox(data, 0.5f, 0.5f, 0.5f, 0.0f, 0.0f);
+    // Tree meshes in tree-local units (scaled per instance): 0.5 x 4 x 0.5 trunk, radius 2.5 canopy
+    else if (id == MESH_TREE_TRUNK) addBox(data, 0.25f, 2.0f, 0.25f, 2.0f, 0.0f);
+    else if (id < MESH_TREE_TRUNK) {
+        int lod = id - MESH_SPHERE_LOD0;
+        addSphere(data, 1.0f, sphereLodSlices[lod], sphereLodStacks[lod], 0.0f);
+    }
+    else if (id < MESH_ROCK_LOD0) {
+        int lod = id - MESH_TREE_CANOPY_LOD0;
+        addSphere(data, 2.5f, sphereLodSlices[lod], sphereLodStacks[lod], 5.0f);
+    }
+    else {
+        // Slightly squashed unit sphere resting on the ground, scaled per instance
+        int lod = id - MESH_ROCK_LOD0;
+        addSphere(data, 1.0f, sphereLodSlices[lod], sphereLodStacks[lod], 0.0f);
+        for (size_t i = 0; i + 5 < data.size(); i += 6) {
+            data[i + 1] = data[i + 1] * 0.6f + 0.3f;
+            float nx = data[i + 3], ny = data[i + 4] / 0.6f, nz = data[i + 5];
+            float len = sqrtf(nx * nx + ny * ny + nz * nz);
+            data[i + 3] = nx / len; data[i + 4] = ny / len; data[i + 5] = nz / len;
+        }
+    }
+}
+
+// The visible instances are streamed every frame; only the scratch list is sized up front
+void createVegetationBatch(VegetationBatch& batch, SceneType scene, ObjectKind kind) {
+    const InstanceStore& store = sceneInstances[scene];
+    batch.visibleScratch.reserve(store.kindEnd[kind] - store.kindBegin[kind]);
+    batch.instanceCount = 0;
+}
+
+void createForests() {
+    createVegetationBatch(ancientForest, ANCIENT_SCENE, OBJ_TREE);
+    createVegetationBatch(modernTrees, MODERN_SCENE, OBJ_TREE);
+    createVegetationBatch(jungleRocks, ANCIENT_SCENE, OBJ_ROCK);
+}
+
+// The original ring of 8 clusters (60 units out, alternating heights), then any extra
+// clusters (--clouds) scattered over wider rings so a large count covers the sky
+void createCloudLayer(int clusters) {
+    const float puffOffsets[CLOUD_PUFFS][4] = {  // x, y, z, radius
+        { 0.0f, 0.0f, 0.0f, 4.0f }, { 3.0f, 1.0f, 1.5f, 3.0f }, { -1.0f, 1.0f, -0.5f, 3.5f }
+    };
+
+    std::vector<CloudPuff> puffs;
+    puffs.reserve((size_t)clusters * CLOUD_PUFFS);
+    Rng rng(0xC10D5ull);
+    for (int i = 0; i < clusters; ++i) {
+        float angle, ring, height, scale = 1.0f;
+        if (i < CLOUD_RING_CLUSTERS) {
+            angle = (float)i * (2.0f * (float)M_PI / CLOUD_RING_CLUSTERS);
+            ring = 60.0f;
+            height = 30.0f + (i % 2) * 3.0f;
+        }
+        else {
+            angle = rng.range(0.0f, 2.0f * (float)M_PI);
+            ring = sqrtf(rng.range(40.0f * 40.0f, 450.0f * 450.0f)); // uniform over the disc
+            height = rng.range(28.0f, 60.0f);
+            scale = rng.range(0.8f, 1.8f);
+        }
+        for (const auto& p : puffOffsets) {
+            puffs.push_back({ angle, ring, height, p[3] * scale, p[0] * scale, p[1] * scale, p[2] * scale });
+        }
+    }
+
+    cloudLayer.program = createProgram(cloudVertexSrc, vegetationFragmentSrc, shadowReceiverSrc);
+    cloudLayer.clusters = clusters;
+    cloudLayer.puffs = (int)puffs.size();
+    glGenBuffers(1, &cloudLayer.instanceVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, cloudLayer.instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, puffs.size() * sizeof(CloudPuff), puffs.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+// CPU only: fills the scene's static batches and writes the measured bounds into its instance store
+void bakeStaticScene(SceneType scene, std::vector<BakedBatch>& out) {
+    StaticBatchBuilder b;
+    InstanceStore& store = sceneInstances[scene];
 
-// ---------------- Temple entrance + decorative details ----------------
+    // Staircases cutting up each face
+    bakeStairs(b, store);
+    bakeTempleDetails(b, scene, store);
 
-void drawTempleDetails(SceneType scene)
-{
-    // ---- Temple geometry (must match createPyramidMesh) ----
+    // Dirty ground around the pyramid (ancient only, empty range otherwise)
+    bakeAncientGroundPatches(b, store);
 
-    const int   terraceCount = 9;
-    const float terraceHeight = 1.4f;
-    const float templeHalfSize = 3.5f;   // half size used in addBox(...)
-    const float templeOffsetY = 1.2f;   // same offset used there
+    // Fallen trees: the one leaning toward the pyramid front, then the jungle's logs
+    for (int id = store.kindBegin[OBJ_FALLEN_TREE]; id < store.kindEnd[OBJ_FALLEN_TREE]; ++id)
+        bakeFallenTree(b, store, id);
 
-    float terracesHeight = terraceCount * terraceHeight;
-    float templeCenterY = terracesHeight + templeOffsetY;
+    b.build(out, store);
+}
 
-    // Small epsilon so quads are slightly in front of temple faces
-    const float eps = 0.05f;
+// Everything initScene() needs, generated procedurally on the CPU
+// (terrain heights and instance stores are filled in place)
+struct GeneratedScene {
+    std::vector<float> meshes[MESH_COUNT];
+    std::vector<BakedBatch> batches[2];
+};
 
-    // ---------------- Common colors ----------------
-    GLfloat doorColorAncient[3] = { 0.03f, 0.03f, 0.03f };
-    GLfloat doorColorModern[3] = { 0.10f, 0.10f, 0.10f };
-    GLfloat frameColorAncient[3] = { 0.65f, 0.63f, 0.60f };
-    GLfloat frameColorModern[3] = { 0.98f, 0.96f, 0.92f };
+void generateScene(GeneratedScene& gen) {
+    // Heights first: placements stand on the terrain
+    buildTerrainHeights(terrain.heights);
+    pyramidHiddenFaces = HiddenFaceStats();
+    stairHiddenFaces = HiddenFaceStats();
 
-    glDisable(GL_LIGHTING);
-    glDisable(GL_CULL_FACE);   // so all quads are visible from any side
+    for (int id = 0; id < MESH_COUNT; ++id)
+        buildMeshData(id, gen.meshes[id]);
 
-    // Helper lambdas to pick colors
-    auto setDoorColor = [&]() {
-        if (scene == ANCIENT_SCENE)
-            glColor3f(doorColorAncient[0], doorColorAncient[1], doorColorAncient[2]);
-        else
-            glColor3f(doorColorModern[0], doorColorModern[1], doorColorModern[2]);
-        };
+    for (int scene = ANCIENT_SCENE; scene <= MODERN_SCENE; ++scene) {
+        sceneInstances[scene] = InstanceStore();
+        buildSceneInstances((SceneType)scene);
+        bakeStaticScene((SceneType)scene, gen.batches[scene]);
+    }
+}
 
-    auto setFrameColor = [&]() {
-        if (scene == ANCIENT_SCENE)
-            glColor3f(frameColorAncient[0], frameColorAncient[1], frameColorAncient[2]);
-        else
-            glColor3f(frameColorModern[0], frameColorModern[1], frameColorModern[2]);
-        };
+// The pyramid is the one shared mesh the optimization stage changes: its "before" ACMR
+// is the plain boxes' (bench report)
+void setUnoptimizedAcmr() {
+    if (!meshOptimizeEnabled || !meshPackingEnabled) return;
+    std::vector<float> boxes;
+    addPyramidBoxes(boxes);
+    meshSlot(MESH_PYRAMID).acmrBefore = triangleListAcmr(boxes);
+}
 
-    // ---------------- Main front entrance (+Z) ----------------
-    {
-        float doorHalfWidth = 1.4f;
-        float doorBottomY = templeCenterY - 1.5f;
-        float doorTopY = templeCenterY + 0.5f;
-        float zFront = templeHalfSize + eps;
+void uploadGeneratedScene(const GeneratedScene& gen) {
+    for (int id = 0; id < MESH_COUNT; ++id)
+        uploadMesh(meshSlot(id), gen.meshes[id], meshLitFixedFunction(id));
+    setUnoptimizedAcmr();
 
-        // Door opening
-        setDoorColor();
-        glBegin(GL_QUADS);
-        glVertex3f(-doorHalfWidth, doorBottomY, zFront);
-        glVertex3f(doorHalfWidth, doorBottomY, zFront);
-        glVertex3f(doorHalfWidth, doorTopY, zFront);
-        glVertex3f(-doorHalfWidth, doorTopY, zFront);
-        glEnd();
+    for (int scene = ANCIENT_SCENE; scene <= MODERN_SCENE; ++scene) {
+        for (const BakedBatch& batch : gen.batches[scene]) {
+            uploadStaticBatch((SceneType)scene, batch.r, batch.g, batch.b, batch.cullFace,
+                batch.data.data(), (int)(batch.data.size() / 6), batch.ranges.data(), (int)batch.ranges.size());
+        }
+    }
+}
 
-        // Frame
-        setFrameColor();
-        float frameDepth = 0.25f;
+// ---------------------- Scene Cache ----------------------
+
+// Versioned binary snapshot of everything generateScene() produces: the mesh table, the
+// terrain heights, both
+// scenes' instance tables (the SoA columns as-is) and their static batches (material table
+// + vertex and range blobs). --bake-scene writes it once; at startup the file is mapped
+// and each blob goes straight from the mapping into glBufferData / vector::assign, with
+// no per-vertex parsing. Any mismatch (magic, version, byte order, bounds) falls back to
+// procedural generation. Bump SCENE_CACHE_VERSION whenever generated content changes.
+//
+// Layout (native byte order, blobs 16-byte aligned):
+//   SceneCacheHeader | SceneCacheSection[sectionCount] | blobs...
+
+const char* SCENE_CACHE_MAGIC = "CITZ";
+const unsigned SCENE_CACHE_VERSION = 6;
+const unsigned SCENE_CACHE_BYTE_ORDER = 0x01020304;
+std::string sceneCachePath = "chichen_itza.scene";
+bool sceneCacheEnabled = true;  // --no-scene-cache forces procedural generation
+
+// Startup numbers for the benchmark report
+bool sceneLoadedFromCache = false;
+double sceneInitMs = 0.0;
+
+enum SceneCacheSectionType {
+    SECTION_MESH = 1,        // index = MeshId, float[6 * vertexCount]
+    SECTION_INSTANCES,       // index = SceneType, InstanceTableHeader + columns
+    SECTION_MATERIALS,       // index = SceneType, MaterialRecord[]
+    SECTION_BATCH_VERTICES,  // index = SceneType, float[6 * n], every batch back to back
+    SECTION_BATCH_RANGES,    // index = SceneType, BatchRange[], every batch back to back
+    SECTION_TERRAIN          // index 0, float[TERRAIN_SAMPLES^2] heights
+};
 
-        // Top lintel
-        glBegin(GL_QUADS);
-        glVertex3f(-doorHalfWidth - 0.3f, doorTopY + 0.25f, zFront);
-        glVertex3f(doorHalfWidth + 0.3f, doorTopY + 0.25f, zFront);
-        glVertex3f(doorHalfWidth + 0.3f, doorTopY + 0.75f, zFront + frameDepth);
-        glVertex3f(-doorHalfWidth - 0.3f, doorTopY + 0.75f, zFront + frameDepth);
-        glEnd();
+struct SceneCacheHeader {
+    char magic[4];
+    unsigned version;
+    unsigned byteOrder;
+    unsigned sectionCount;
+    unsigned long long fileSize;
+};
 
-        // Left column
-        glBegin(GL_QUADS);
-        glVertex3f(-doorHalfWidth - 0.3f, doorBottomY - 0.1f, zFront);
-        glVertex3f(-doorHalfWidth, doorBottomY - 0.1f, zFront);
-        glVertex3f(-doorHalfWidth, doorTopY + 0.8f, zFront + frameDepth);
-        glVertex3f(-doorHalfWidth - 0.3f, doorTopY + 0.8f, zFront + frameDepth);
-        glEnd();
+struct SceneCacheSection {
+    unsigned type;
+    unsigned index;
+    unsigned long long offset;
+    unsigned long long size;
+};
 
-        // Right column
-        glBegin(GL_QUADS);
-        glVertex3f(doorHalfWidth, doorBottomY - 0.1f, zFront);
-        glVertex3f(doorHalfWidth + 0.3f, doorBottomY - 0.1f, zFront);
-        glVertex3f(doorHalfWidth + 0.3f, doorTopY + 0.8f, zFront + frameDepth);
-        glVertex3f(doorHalfWidth, doorTopY + 0.8f, zFront + frameDepth);
-        glEnd();
+// Instance table: header, then INSTANCE_FLOAT_COLUMNS float[count] columns, then kind bytes
+struct InstanceTableHeader {
+    int count;
+    int kindBegin[OBJ_KIND_COUNT];
+    int kindEnd[OBJ_KIND_COUNT];
+};
+
+// One static batch: color + cull state and where its vertices/ranges live in the scene's blobs
+struct MaterialRecord {
+    float r, g, b;
+    unsigned cullFace;
+    unsigned firstVertex, vertexCount;
+    unsigned firstRange, rangeCount;
+};
+
+const int INSTANCE_FLOAT_COLUMNS = 14;
+
+void instanceFloatColumns(InstanceStore& store, std::vector<float>* columns[INSTANCE_FLOAT_COLUMNS]) {
+    std::vector<float>* all[INSTANCE_FLOAT_COLUMNS] = {
+        &store.posX, &store.posY, &store.posZ,
+        &store.scaleX, &store.scaleY, &store.scaleZ, &store.yaw,
+        &store.colorR, &store.colorG, &store.colorB,
+        &store.boundX, &store.boundY, &store.boundZ, &store.boundRadius
+    };
+    std::copy(all, all + INSTANCE_FLOAT_COLUMNS, columns);
+}
+
+// Read-only file mapping (mmap / MapViewOfFile)
+class MappedFile {
+public:
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { close(); return false; }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) { close(); return false; }
+        bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        length = (size_t)fileSize.QuadPart;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { close(); return false; }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { close(); return false; }
+        bytes = (const unsigned char*)p;
+        length = (size_t)st.st_size;
+#endif
+        if (!bytes) { close(); return false; }
+        return true;
     }
 
-    // ----------- Helper for smaller side/back entrances ---------
-    auto drawSmallEntranceZ = [&](bool backSide) {
-        // backSide == false → +Z, true → -Z
-        float doorHalfWidth = 0.9f;
-        float doorBottomY = templeCenterY - 1.0f;
-        float doorTopY = templeCenterY + 0.2f;
-        float zSign = backSide ? -1.0f : 1.0f;
-        float zFace = zSign * (templeHalfSize + eps);
-        float frameDepth = 0.20f;
+    void close() {
+#if defined(_WIN32)
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap((void*)bytes, length);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
 
-        // Door
-        setDoorColor();
-        glBegin(GL_QUADS);
-        glVertex3f(-doorHalfWidth, doorBottomY, zFace);
-        glVertex3f(doorHalfWidth, doorBottomY, zFace);
-        glVertex3f(doorHalfWidth, doorTopY, zFace);
-        glVertex3f(-doorHalfWidth, doorTopY, zFace);
-        glEnd();
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
 
-        // Simple frame strip around
-        setFrameColor();
-        glBegin(GL_QUADS);
-        // Top strip
-        glVertex3f(-doorHalfWidth - 0.2f, doorTopY + 0.15f, zFace);
-        glVertex3f(doorHalfWidth + 0.2f, doorTopY + 0.15f, zFace);
-        glVertex3f(doorHalfWidth + 0.2f, doorTopY + 0.40f, zFace + zSign * frameDepth);
-        glVertex3f(-doorHalfWidth - 0.2f, doorTopY + 0.40f, zFace + zSign * frameDepth);
-        glEnd();
+// Bake step: generate everything procedurally and write it out (no GL context needed)
+bool writeSceneCache(const std::string& path) {
+    GeneratedScene gen;
+    generateScene(gen);
+
+    struct Blob {
+        SceneCacheSection section;
+        std::vector<unsigned char> bytes;
+    };
+    std::vector<Blob> blobs;
+    auto addBlob = [&](unsigned type, unsigned index, const void* data, size_t size) {
+        Blob blob = { { type, index, 0, size }, {} };
+        blob.bytes.assign((const unsigned char*)data, (const unsigned char*)data + size);
+        blobs.push_back(std::move(blob));
+        return &blobs.back().bytes;
         };
 
-    auto drawSmallEntranceX = [&](bool rightSide) {
-        // rightSide == false → -X, true → +X
-        float doorHalfWidth = 0.9f;
-        float doorBottomY = templeCenterY - 1.0f;
-        float doorTopY = templeCenterY + 0.2f;
-        float xSign = rightSide ? 1.0f : -1.0f;
-        float xFace = xSign * (templeHalfSize + eps);
-        float frameDepth = 0.20f;
+    for (int id = 0; id < MESH_COUNT; ++id)
+        addBlob(SECTION_MESH, id, gen.meshes[id].data(), gen.meshes[id].size() * sizeof(float));
+    addBlob(SECTION_TERRAIN, 0, terrain.heights.data(), terrain.heights.size() * sizeof(float));
+
+    for (int scene = ANCIENT_SCENE; scene <= MODERN_SCENE; ++scene) {
+        InstanceStore& store = sceneInstances[scene];
+        InstanceTableHeader table = {};
+        table.count = store.size();
+        std::copy(store.kindBegin, store.kindBegin + OBJ_KIND_COUNT, table.kindBegin);
+        std::copy(store.kindEnd, store.kindEnd + OBJ_KIND_COUNT, table.kindEnd);
+
+        std::vector<unsigned char>& bytes = *addBlob(SECTION_INSTANCES, scene, &table, sizeof(table));
+        std::vector<float>* columns[INSTANCE_FLOAT_COLUMNS];
+        instanceFloatColumns(store, columns);
+        for (std::vector<float>* column : columns) {
+            const unsigned char* p = (const unsigned char*)column->data();
+            bytes.insert(bytes.end(), p, p + column->size() * sizeof(float));
+        }
+        bytes.insert(bytes.end(), store.kind.begin(), store.kind.end());
+
+        std::vector<MaterialRecord> materials;
+        std::vector<float> vertices;
+        std::vector<BatchRange> ranges;
+        for (const BakedBatch& batch : gen.batches[scene]) {
+            materials.push_back({ batch.r, batch.g, batch.b, batch.cullFace ? 1u : 0u,
+                (unsigned)(vertices.size() / 6), (unsigned)(batch.data.size() / 6),
+                (unsigned)ranges.size(), (unsigned)batch.ranges.size() });
+            vertices.insert(vertices.end(), batch.data.begin(), batch.data.end());
+            ranges.insert(ranges.end(), batch.ranges.begin(), batch.ranges.end());
+        }
+        addBlob(SECTION_MATERIALS, scene, materials.data(), materials.size() * sizeof(MaterialRecord));
+        addBlob(SECTION_BATCH_VERTICES, scene, vertices.data(), vertices.size() * sizeof(float));
+        addBlob(SECTION_BATCH_RANGES, scene, ranges.data(), ranges.size() * sizeof(BatchRange));
+    }
 
-        // Door
-        setDoorColor();
-        glBegin(GL_QUADS);
-        glVertex3f(xFace, doorBottomY, -doorHalfWidth);
-        glVertex3f(xFace, doorBottomY, doorHalfWidth);
-        glVertex3f(xFace, doorTopY, doorHalfWidth);
-        glVertex3f(xFace, doorTopY, -doorHalfWidth);
-        glEnd();
+    auto align = [](unsigned long long v) { return (v + 15) & ~15ull; };
+    unsigned long long offset = align(sizeof(SceneCacheHeader) + blobs.size() * sizeof(SceneCacheSection));
+    for (Blob& blob : blobs) {
+        blob.section.size = blob.bytes.size();
+        blob.section.offset = offset;
+        offset = align(offset + blob.section.size);
+    }
 
-        // Top strip
-        setFrameColor();
-        glBegin(GL_QUADS);
-        glVertex3f(xFace, doorTopY + 0.15f, -doorHalfWidth - 0.2f);
-        glVertex3f(xFace, doorTopY + 0.15f, doorHalfWidth + 0.2f);
-        glVertex3f(xFace + xSign * frameDepth, doorTopY + 0.40f, doorHalfWidth + 0.2f);
-        glVertex3f(xFace + xSign * frameDepth, doorTopY + 0.40f, -doorHalfWidth - 0.2f);
-        glEnd();
-        };
+    SceneCacheHeader header = {};
+    memcpy(header.magic, SCENE_CACHE_MAGIC, 4);
+    header.version = SCENE_CACHE_VERSION;
+    header.byteOrder = SCENE_CACHE_BYTE_ORDER;
+    header.sectionCount = (unsigned)blobs.size();
+    header.fileSize = offset;
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Scene cache: cannot write " << path << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> file((size_t)offset, 0);
+    memcpy(file.data(), &header, sizeof(header));
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        memcpy(file.data() + sizeof(header) + i * sizeof(SceneCacheSection), &blobs[i].section, sizeof(SceneCacheSection));
+        if (!blobs[i].bytes.empty())
+            memcpy(file.data() + blobs[i].section.offset, blobs[i].bytes.data(), blobs[i].bytes.size());
+    }
+    bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+    ok = (fclose(f) == 0) && ok;
 
-    // Back (-Z), Left (-X), Right (+X)
-    drawSmallEntranceZ(true);   // back side
-    drawSmallEntranceX(false);  // left side
-    drawSmallEntranceX(true);   // right side
+    if (ok) std::cout << "Scene cache: wrote " << path << " (" << offset << " bytes, " << blobs.size() << " sections)" << std::endl;
+    return ok;
+}
 
-    // ---------------- Dark band around temple top ----------------
-    float bandTopY = templeCenterY + templeHalfSize - 0.2f;
-    float bandBottomY = bandTopY - 0.4f;
-    float bandHalfX = templeHalfSize + 0.05f;
-    float bandHalfZ = templeHalfSize + 0.05f;
+// Maps the cache and uploads it; returns false (having touched nothing) when the file is missing or invalid
+bool loadSceneCache(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+
+    const unsigned char* base = file.data();
+    if (file.size() < sizeof(SceneCacheHeader)) return false;
+    const SceneCacheHeader* header = (const SceneCacheHeader*)base;
+    if (memcmp(header->magic, SCENE_CACHE_MAGIC, 4) != 0 || header->version != SCENE_CACHE_VERSION ||
+        header->byteOrder != SCENE_CACHE_BYTE_ORDER || header->fileSize != file.size()) {
+        std::cerr << "Scene cache: " << path << " is stale or from another build, generating the scene instead" << std::endl;
+        return false;
+    }
+    if (sizeof(SceneCacheHeader) + (size_t)header->sectionCount * sizeof(SceneCacheSection) > file.size()) return false;
+
+    // Index the sections; every blob must lie inside the file
+    const SceneCacheSection* sections = (const SceneCacheSection*)(base + sizeof(SceneCacheHeader));
+    const SceneCacheSection* meshes[MESH_COUNT] = {};
+    const SceneCacheSection* heights = nullptr;
+    const SceneCacheSection* perScene[SECTION_BATCH_RANGES + 1][2] = {};
+    for (unsigned i = 0; i < header->sectionCount; ++i) {
+        const SceneCacheSection& s = sections[i];
+        if (s.offset > file.size() || s.size > file.size() - s.offset || s.offset % 4 != 0) return false;
+        if (s.type == SECTION_MESH && s.index < MESH_COUNT) meshes[s.index] = &s;
+        else if (s.type == SECTION_TERRAIN) heights = &s;
+        else if (s.type > SECTION_MESH && s.type <= SECTION_BATCH_RANGES && s.index < 2) perScene[s.type][s.index] = &s;
+    }
+    for (const SceneCacheSection* s : meshes)
+        if (!s || s->size % (6 * sizeof(float)) != 0) return false;
+    if (!heights || heights->size != (size_t)TERRAIN_SAMPLES * TERRAIN_SAMPLES * sizeof(float)) return false;
+
+    // Validate both scenes before touching any state
+    for (int scene = ANCIENT_SCENE; scene <= MODERN_SCENE; ++scene) {
+        for (int type = SECTION_INSTANCES; type <= SECTION_BATCH_RANGES; ++type)
+            if (!perScene[type][scene]) return false;
+
+        const SceneCacheSection& inst = *perScene[SECTION_INSTANCES][scene];
+        if (inst.size < sizeof(InstanceTableHeader)) return false;
+        const InstanceTableHeader* table = (const InstanceTableHeader*)(base + inst.offset);
+        if (table->count < 0 || inst.size != sizeof(InstanceTableHeader) +
+            (size_t)table->count * (INSTANCE_FLOAT_COLUMNS * sizeof(float) + 1)) return false;
+        for (int k = 0; k < OBJ_KIND_COUNT; ++k) {
+            if (table->kindBegin[k] < 0 || table->kindBegin[k] > table->kindEnd[k] || table->kindEnd[k] > table->count)
+                return false;
+        }
 
-    if (scene == ANCIENT_SCENE)
-        glColor3f(0.35f, 0.35f, 0.36f);
-    else
-        glColor3f(0.45f, 0.45f, 0.47f);
+        const SceneCacheSection& mat = *perScene[SECTION_MATERIALS][scene];
+        size_t vertexCount = perScene[SECTION_BATCH_VERTICES][scene]->size / (6 * sizeof(float));
+        size_t rangeCount = perScene[SECTION_BATCH_RANGES][scene]->size / sizeof(BatchRange);
+        const MaterialRecord* materials = (const MaterialRecord*)(base + mat.offset);
+        for (size_t m = 0; m < mat.size / sizeof(MaterialRecord); ++m) {
+            if ((size_t)materials[m].firstVertex + materials[m].vertexCount > vertexCount ||
+                (size_t)materials[m].firstRange + materials[m].rangeCount > rangeCount) return false;
+        }
+        const BatchRange* ranges = (const BatchRange*)(base + perScene[SECTION_BATCH_RANGES][scene]->offset);
+        for (size_t r = 0; r < rangeCount; ++r) {
+            // -1 = never culled / drawn at every level; anything below would index the store
+            if (ranges[r].objectId < -1 || ranges[r].objectId >= table->count ||
+                ranges[r].lod < -1 || ranges[r].lod >= LOD_COUNT) return false;
+        }
+    }
 
-    glBegin(GL_QUADS);
-    // Front
-    glVertex3f(-bandHalfX, bandBottomY, bandHalfZ);
-    glVertex3f(bandHalfX, bandBottomY, bandHalfZ);
-    glVertex3f(bandHalfX, bandTopY, bandHalfZ);
-    glVertex3f(-bandHalfX, bandTopY, bandHalfZ);
+    for (int id = 0; id < MESH_COUNT; ++id) {
+        uploadMesh(meshSlot(id), (const float*)(base + meshes[id]->offset), (int)(meshes[id]->size / (6 * sizeof(float))),
+            meshLitFixedFunction(id));
+    }
+    setUnoptimizedAcmr();
+    const float* heightData = (const float*)(base + heights->offset);
+    terrain.heights.assign(heightData, heightData + (size_t)TERRAIN_SAMPLES * TERRAIN_SAMPLES);
+
+    for (int scene = ANCIENT_SCENE; scene <= MODERN_SCENE; ++scene) {
+        const unsigned char* p = base + perScene[SECTION_INSTANCES][scene]->offset;
+        const InstanceTableHeader* table = (const InstanceTableHeader*)p;
+        p += sizeof(InstanceTableHeader);
+
+        InstanceStore& store = sceneInstances[scene];
+        store = InstanceStore();
+        std::copy(table->kindBegin, table->kindBegin + OBJ_KIND_COUNT, store.kindBegin);
+        std::copy(table->kindEnd, table->kindEnd + OBJ_KIND_COUNT, store.kindEnd);
+
+        std::vector<float>* columns[INSTANCE_FLOAT_COLUMNS];
+        instanceFloatColumns(store, columns);
+        for (std::vector<float>* column : columns) {
+            column->assign((const float*)p, (const float*)p + table->count);
+            p += (size_t)table->count * sizeof(float);
+        }
+        store.kind.assign(p, p + table->count);
+        store.cell.assign(table->count, 0);
+        store.visible.assign(table->count, 1);
+        store.lod.assign(table->count, 0);
+
+        const SceneCacheSection& mat = *perScene[SECTION_MATERIALS][scene];
+        const MaterialRecord* materials = (const MaterialRecord*)(base + mat.offset);
+        const float* vertices = (const float*)(base + perScene[SECTION_BATCH_VERTICES][scene]->offset);
+        const BatchRange* ranges = (const BatchRange*)(base + perScene[SECTION_BATCH_RANGES][scene]->offset);
+        for (size_t m = 0; m < mat.size / sizeof(MaterialRecord); ++m) {
+            const MaterialRecord& r = materials[m];
+            uploadStaticBatch((SceneType)scene, r.r, r.g, r.b, r.cullFace != 0,
+                vertices + (size_t)r.firstVertex * 6, (int)r.vertexCount, ranges + r.firstRange, (int)r.rangeCount);
+        }
+    }
+    return true;
+}
 
-    // Back
-    glVertex3f(-bandHalfX, bandBottomY, -bandHalfZ);
-    glVertex3f(-bandHalfX, bandTopY, -bandHalfZ);
-    glVertex3f(bandHalfX, bandTopY, -bandHalfZ);
-    glVertex3f(bandHalfX, bandBottomY, -bandHalfZ);
+// ---------------------- Scene Residency ----------------------
+
+// Both scenes stay resident: meshes, static batches, instance stores, forests, terrain and
+// one shadow cache per scene are created by initScene() and never released, so SPACE only
+// picks the other draw path. What the first frame of the other scene could still pay for
+// is first-use work the driver defers until a program or buffer is drawn with, and shadow
+// cascades that went stale while the scene was hidden. prewarmScenes() draws both scenes
+// once at startup, and updateShadows() re-centers at most shadows.staleRedrawBudget stale
+// cascades per frame (a stale cascade still shades everything it covers).
+//
+// A switch requested by SPACE happens at the end of the next frame's world pass. With a
+// cross-fade, that frame's image is copied into a texture which drawHUD() blends over the
+// new scene while it fades out, so no frame renders both scenes.
+
+const int SWITCH_WATCH_FRAMES = 5; // frame intervals after a switch that count as "around" it
+
+struct SceneResidency {
+    bool enabled = true;            // --no-residency: no pre-warm, no shadow time slicing
+    float crossfadeSeconds = 0.4f;  // --crossfade S (0 = cut)
+    bool switchPending = false;
+    GLuint fadeTexture = 0;         // last frame of the previous scene, window sized
+    int fadeWidth = 0, fadeHeight = 0;
+    bool fading = false;
+    std::chrono::steady_clock::time_point fadeStart;
+    double prewarmMs = 0.0;
+    int switchWatch = 0;            // frame intervals left to watch after a switch
+    double switchWorstMs = 0.0;     // worst of them for the last switch (see perfBeginFrame)
+    double switchBaselineMs = 0.0;  // rolling frame interval just before it
+} residency;
+
+// Draws one scene's world (everything but the HUD); defined with the GLUT callbacks
+void drawWorld(SceneType scene);
+
+void requestSceneSwitch() {
+    residency.switchPending = true;
+}
 
-    // Left
-    glVertex3f(-bandHalfX, bandBottomY, -bandHalfZ);
-    glVertex3f(-bandHalfX, bandBottomY, bandHalfZ);
-    glVertex3f(-bandHalfX, bandTopY, bandHalfZ);
-    glVertex3f(-bandHalfX, bandTopY, -bandHalfZ);
+// Keeps the cross-fade snapshot at window size; resizing cancels a running fade
+void resizeFadeTexture(int w, int h) {
+    if (residency.fadeTexture && residency.fadeWidth == w && residency.fadeHeight == h) return;
+    if (!residency.fadeTexture) glGenTextures(1, &residency.fadeTexture);
+    glBindTexture(GL_TEXTURE_2D, residency.fadeTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    residency.fadeWidth = w;
+    residency.fadeHeight = h;
+    residency.fading = false;
+}
 
-    // Right
-    glVertex3f(bandHalfX, bandBottomY, -bandHalfZ);
-    glVertex3f(bandHalfX, bandTopY, -bandHalfZ);
-    glVertex3f(bandHalfX, bandTopY, bandHalfZ);
-    glVertex3f(bandHalfX, bandBottomY, bandHalfZ);
-    glEnd();
+// Called by displayCallback() after the world pass of the frame a switch was requested in
+void completeSceneSwitch() {
+    residency.switchPending = false;
+    if (residency.crossfadeSeconds > 0.0f && residency.fadeTexture) {
+        glBindTexture(GL_TEXTURE_2D, residency.fadeTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, residency.fadeWidth, residency.fadeHeight);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        residency.fading = true;
+        residency.fadeStart = frameTime;
+    }
+    currentScene = (currentScene == ANCIENT_SCENE) ? MODERN_SCENE : ANCIENT_SCENE;
+    residency.switchWatch = SWITCH_WATCH_FRAMES;
+    residency.switchWorstMs = 0.0;
+}
+
+// Blends the previous scene's last frame over the new one; drawHUD() calls it with its
+// window-space projection already set
+void drawCrossfade(int w, int h) {
+    if (!residency.fading) return;
+    double t = std::chrono::duration<double>(frameTime - residency.fadeStart).count() /
+        residency.crossfadeSeconds;
+    if (t >= 1.0) {
+        residency.fading = false;
+        return;
+    }
 
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_LIGHTING);
+    stateEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, residency.fadeTexture);
+    stateEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    stateColor(1.0f, 1.0f, 1.0f, (float)(1.0 - t));
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f); glVertex2f(0.0f, 0.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex2f((float)w, 0.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex2f((float)w, (float)h);
+    glTexCoord2f(0.0f, 1.0f); glVertex2f(0.0f, (float)h);
+    glEnd();
+    countDraw(4);
+    stateDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    stateDisable(GL_TEXTURE_2D);
 }
 
+// Draws the hidden scene, then the shown one, into the back buffer and throws the result
+// away: shaders, buffers and both shadow caches are touched before the first real frame
+void prewarmScenes() {
+    if (!residency.enabled) return;
+    auto start = std::chrono::steady_clock::now();
 
-// ---------------------- Scenes ----------------------
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluPerspective(camera.fov, (float)windowWidth / (float)std::max(windowHeight, 1), NEAR_PLANE, FAR_PLANE);
+    glMatrixMode(GL_MODELVIEW);
 
-void drawAncientScene() {
-    // Slightly darker, more desaturated stone with a hint of green
-    drawMeshLit(pyramidMesh, 0.38f, 0.40f, 0.34f);   // darker, more mossy
+    SceneType shown = currentScene;
+    SceneType hidden = (shown == ANCIENT_SCENE) ? MODERN_SCENE : ANCIENT_SCENE;
+    streamBeginFrame(); // two frames' worth of streamed instances and casters
+    drawWorld(hidden);
+    streamBeginFrame();
+    drawWorld(shown);
+    glFinish();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Staircases cutting up each face
-    drawStairs();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    frameStats = FrameStats();
+    residency.prewarmMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-    drawTempleDetails(ANCIENT_SCENE);
+// ---------------------- Performance Overlay ----------------------
+
+// Each stage of displayCallback() is timed on the CPU (steady_clock) and on the GPU
+// (GL_TIME_ELAPSED queries). Queries are double-buffered: frame N writes slot N % 2
+// and reads back slot (N + 1) % 2 from the previous frame, only if it is already
+// available, so the overlay never stalls the pipeline waiting for a result.
+//
+// The ground, clouds, scene and sky stages only emit draw items; their GPU work runs in
+// "submit". So every material run of submitRenderQueue() is timed too. A run can't nest a
+// GL_TIME_ELAPSED query inside the submit stage's, so each material switch writes a
+// GL_TIMESTAMP instead, one more closes the last run, and a frame's timestamps are read
+// back the same double-buffered way.
+
+enum FrameStage { STAGE_CULL, STAGE_SHADOWS, STAGE_GROUND, STAGE_CLOUDS, STAGE_SCENE, STAGE_SKY, STAGE_SUBMIT, STAGE_HUD, STAGE_COUNT };
+const char* frameStageNames[STAGE_COUNT] = { "cull", "shadows", "ground", "clouds", "scene", "sky", "submit", "hud" };
+
+struct StageTimer {
+    GLuint queries[2] = { 0, 0 };
+    bool issued[2] = { false, false };
+    std::chrono::steady_clock::time_point cpuStart;
+    double cpuMs = 0.0; // rolling averages
+    double gpuMs = 0.0;
+};
+
+// Timings per material, summed over its runs in the frame
+struct MaterialTimer {
+    std::vector<GLuint> queries[2];  // timestamp pool per parity
+    std::vector<int> runs[2];        // the material each timestamp starts, -1 = none (end of a submit)
+    int current = -1;                // run open on the CPU
+    std::chrono::steady_clock::time_point cpuStart;
+    double frameCpuMs[MAT_COUNT] = {};
+    double cpuMs[MAT_COUNT] = {};    // rolling averages
+    double gpuMs[MAT_COUNT] = {};
+};
 
-    // --- NEW: rocks + dirty ground around the pyramid ---
-    drawRocksAndDebris();
+const int PERF_HISTORY = 120; // frames kept for the frame-time graph
+
+struct PerfOverlay {
+    bool visible = false;         // toggled with 'P'
+    bool forceTiming = false;     // stage timers also run while benchmarking
+    bool gpuTimers = false;       // GL_TIME_ELAPSED available
+    StageTimer stages[STAGE_COUNT];
+    MaterialTimer materials;
+    int parity = 0;
+    std::chrono::steady_clock::time_point lastFrame;
+    bool haveLastFrame = false;
+    double frameMs = 0.0;         // rolling frame-to-frame interval
+    double intervalMs = 0.0;      // the last one
+    float history[PERF_HISTORY] = {};
+    int historyPos = 0;
+    double targetMs = 1000.0 / 60.0; // display interval frames are paced against
+    long long frames = 0;
+    int lateFrames = 0;           // interval above 1.5x the target
+    int droppedFrames = 0;        // whole target intervals missed by late frames
+    double worstMs = 0.0;
+    int simSteps = 0;             // fixed simulation steps taken before this frame
+    int hudPanel = -1;            // HUD buffer slots: background, graph bars,
+    int hudGraph = -1;            // and the first of PERF_TEXT_LINES text lines
+    int hudLines = -1;
+};
+PerfOverlay perf;
 
-    // Dense jungle trees around pyramid (more trees + two rings)
-    for (int i = 0; i < 100; ++i) {
-        float angle = (float)i * (2.0f * (float)M_PI / 48.0f);
+const double PERF_SMOOTHING = 0.1; // weight of the newest sample in the rolling averages
 
-        // inner + outer ring effect
-        float baseRadius = (i % 2 == 0) ? 32.0f : 40.0f;
-        float radius = baseRadius + (i % 5) * 1.5f;
+inline bool perfTimingActive() {
+    return perf.visible || perf.forceTiming;
+}
 
-        float x = cosf(angle) * radius;
-        float z = sinf(angle) * radius;
-        float scale = 0.9f + (i % 3) * 0.30f;   // more size variation
+void initPerfOverlay() {
+    perf.gpuTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (!perf.gpuTimers) return;
 
-        drawTree(x, z, scale, ANCIENT_SCENE);
+    for (StageTimer& stage : perf.stages) {
+        glGenQueries(2, stage.queries);
     }
+}
 
-    // Fallen tree leaning toward the pyramid front
-    drawFallenTree(18.0f, 10.0f, 6.0f, 200.0f);
-
+// Rolls last frame's material runs into the averages (the GPU side once its timestamps
+// are available) and frees this frame's slot; perf.parity is already this frame's
+void perfBeginMaterialFrame() {
+    MaterialTimer& m = perf.materials;
+    if (perfTimingActive()) {
+        for (int i = 0; i < MAT_COUNT; ++i) m.cpuMs[i] += (m.frameCpuMs[i] - m.cpuMs[i]) * PERF_SMOOTHING;
+    }
+    std::fill(m.frameCpuMs, m.frameCpuMs + MAT_COUNT, 0.0);
+    m.current = -1;
+
+    const std::vector<int>& runs = m.runs[perf.parity ^ 1];
+    const std::vector<GLuint>& queries = m.queries[perf.parity ^ 1];
+    if (perf.gpuTimers && !runs.empty()) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[runs.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) { // timestamps complete in order: the last one ready means all are
+            double frameGpuMs[MAT_COUNT] = {};
+            GLuint64 previous = 0;
+            for (size_t k = 0; k < runs.size(); ++k) {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[k], GL_QUERY_RESULT, &ns);
+                if (k > 0 && runs[k - 1] >= 0) frameGpuMs[runs[k - 1]] += (double)(ns - previous) / 1.0e6;
+                previous = ns;
+            }
+            for (int i = 0; i < MAT_COUNT; ++i) m.gpuMs[i] += (frameGpuMs[i] - m.gpuMs[i]) * PERF_SMOOTHING;
+        }
+    }
+    m.runs[perf.parity].clear(); // never block: an unread frame is simply dropped
 }
 
+// Called once at the top of displayCallback(): frame interval, graph, and last frame's GPU results
+void perfBeginFrame() {
+    auto now = std::chrono::steady_clock::now();
+    if (perf.haveLastFrame) {
+        double ms = std::chrono::duration<double, std::milli>(now - perf.lastFrame).count();
+        perf.intervalMs = ms;
+        if (residency.switchWatch > 0) {
+            if (residency.switchWatch == SWITCH_WATCH_FRAMES) residency.switchBaselineMs = perf.frameMs;
+            residency.switchWorstMs = std::max(residency.switchWorstMs, ms);
+            residency.switchWatch--;
+        }
+        perf.frameMs += (ms - perf.frameMs) * PERF_SMOOTHING;
+        perf.history[perf.historyPos] = (float)ms;
+        perf.historyPos = (perf.historyPos + 1) % PERF_HISTORY;
+
+        // Pacing: a frame is late when it missed its display slot, and each extra slot it
+        // covered is a dropped frame (the previous image was shown again)
+        perf.frames++;
+        perf.worstMs = std::max(perf.worstMs, ms);
+        if (ms > perf.targetMs * 1.5) {
+            perf.lateFrames++;
+            perf.droppedFrames += std::max(1, (int)(ms / perf.targetMs + 0.5) - 1);
+        }
+    }
+    perf.lastFrame = now;
+    perf.haveLastFrame = true;
 
-void drawModernScene() {
-    // Clean bright limestone
-    drawMeshLit(pyramidMesh, 1.0f, 0.96f, 0.90f);
+    perf.parity ^= 1;
+    perfBeginMaterialFrame();
+    if (!perfTimingActive() || !perf.gpuTimers) return;
 
-    // Sharp staircases
-    drawStairs();
+    int readSlot = perf.parity ^ 1;
+    for (StageTimer& stage : perf.stages) {
+        if (!stage.issued[readSlot]) continue;
 
-    drawTempleDetails(MODERN_SCENE);
+        GLint available = 0;
+        glGetQueryObjectiv(stage.queries[readSlot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue; // never block; the slot is simply reissued this frame
 
-    // Fewer, placed trees (landscaped)
-    drawTree(-25.0f, -25.0f, 1.5f, MODERN_SCENE);
-    drawTree(25.0f, -25.0f, 1.3f, MODERN_SCENE);
-    drawTree(-25.0f, 25.0f, 1.4f, MODERN_SCENE);
-    drawTree(25.0f, 25.0f, 1.2f, MODERN_SCENE);
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(stage.queries[readSlot], GL_QUERY_RESULT, &ns);
+        stage.gpuMs += ((double)ns / 1.0e6 - stage.gpuMs) * PERF_SMOOTHING;
+        stage.issued[readSlot] = false;
+    }
+}
 
-    // Tourists near the front of pyramid
-    drawTourist(-5.0f, 18.0f);
-    drawTourist(0.0f, 20.0f);
-    drawTourist(5.0f, 22.0f);
-    drawTourist(10.0f, 18.0f);
+void perfBeginStage(FrameStage id) {
+    if (!perfTimingActive()) return;
+    StageTimer& stage = perf.stages[id];
+
+    stage.cpuStart = std::chrono::steady_clock::now();
+    if (perf.gpuTimers) {
+        glBeginQuery(GL_TIME_ELAPSED, stage.queries[perf.parity]);
+    }
 }
 
-// ---------------------- VBO Creation ----------------------
+void perfEndStage(FrameStage id) {
+    if (!perfTimingActive()) return;
+    StageTimer& stage = perf.stages[id];
 
-void addBox(std::vector<float>& data,
-    float halfSizeX, float halfSizeY, float halfSizeZ,
-    float centerY, float centerZOffset)
-{
-    // center at (0, centerY, centerZOffset)
-    float cx = 0.0f;
-    float cy = centerY;
-    float cz = centerZOffset;
+    if (perf.gpuTimers) {
+        glEndQuery(GL_TIME_ELAPSED);
+        stage.issued[perf.parity] = true;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stage.cpuStart).count();
+    stage.cpuMs += (ms - stage.cpuMs) * PERF_SMOOTHING;
+}
 
-    // Convenience lambda to push one triangle
-    auto pushTri = [&](float x1, float y1, float z1,
-        float x2, float y2, float z2,
-        float x3, float y3, float z3,
-        float nx, float ny, float nz)
-        {
-            float v[9] = { x1,y1,z1,x2,y2,z2,x3,y3,z3 };
-            for (int i = 0; i < 3; ++i) {
-                data.push_back(v[i * 3 + 0]);
-                data.push_back(v[i * 3 + 1]);
-                data.push_back(v[i * 3 + 2]);
-                data.push_back(nx);
-                data.push_back(ny);
-                data.push_back(nz);
-            }
-        };
+void perfMarkMaterial(int material) {
+    if (!perfTimingActive()) return;
+    MaterialTimer& m = perf.materials;
+
+    auto now = std::chrono::steady_clock::now();
+    if (m.current >= 0) m.frameCpuMs[m.current] += std::chrono::duration<double, std::milli>(now - m.cpuStart).count();
+    m.current = material;
+    m.cpuStart = now;
+    if (!perf.gpuTimers) return;
+
+    std::vector<GLuint>& queries = m.queries[perf.parity];
+    std::vector<int>& runs = m.runs[perf.parity];
+    if (runs.size() == queries.size()) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        queries.push_back(query);
+    }
+    glQueryCounter(queries[runs.size()], GL_TIMESTAMP);
+    runs.push_back(material);
+}
 
-    float x0 = cx - halfSizeX, x1 = cx + halfSizeX;
-    float y0 = cy - halfSizeY, y1 = cy + halfSizeY;
-    float z0 = cz - halfSizeZ, z1 = cz + halfSizeZ;
+// HUD text buffer (Text section): slots are fixed ranges of quads in one shared VBO
+int hudAddSlot(int quadCapacity);
+void hudText(int slot, float x, float y, float r, float g, float b, const char* text);
+void hudRect(int slot, int index, float x0, float y0, float x1, float y1, float r, float g, float b, float a = 1.0f);
+void hudShowQuads(int slot, int quads);
+void hudHide(int slot);
+
+const int PERF_TEXT_LINES = STAGE_COUNT + MAT_COUNT + 13; // fps, pacing, draws, state, queue, stream, lod, jobs, crowd,
+                                                          // shadows, switch, two headers, one per stage and material
+
+void allocPerfOverlaySlots() {
+    perf.hudPanel = hudAddSlot(1);
+    perf.hudGraph = hudAddSlot(PERF_HISTORY + 1);
+    perf.hudLines = hudAddSlot(64);
+    for (int i = 1; i < PERF_TEXT_LINES; ++i) hudAddSlot(64);
+}
 
-    // Top (+Y)
-    pushTri(x0, y1, z0, x1, y1, z0, x1, y1, z1, 0, 1, 0);
-    pushTri(x0, y1, z0, x1, y1, z1, x0, y1, z1, 0, 1, 0);
+void hidePerfOverlay() {
+    hudHide(perf.hudPanel);
+    hudHide(perf.hudGraph);
+    for (int i = 0; i < PERF_TEXT_LINES; ++i) hudHide(perf.hudLines + i);
+}
 
-    // Bottom (-Y)
-    pushTri(x0, y0, z0, x1, y0, z1, x1, y0, z0, 0, -1, 0);
-    pushTri(x0, y0, z0, x0, y0, z1, x1, y0, z1, 0, -1, 0);
+// Laid out from drawHUD() in window coordinates; only lines whose text changed are rebuilt
+void drawPerfOverlay(int w, int h) {
+    const float panelW = 490.0f;
+    const float left = (float)w - panelW - 10.0f;
+    const float top = (float)h - 10.0f;
+    const int dy = 20;
+    const float graphH = 60.0f;
+    const float panelH = (float)(dy * (STAGE_COUNT + MAT_COUNT + 14)) + graphH + 20.0f;
+
+    hudRect(perf.hudPanel, 0, left, top - panelH, left + panelW, top, 0.0f, 0.0f, 0.0f);
+    hudShowQuads(perf.hudPanel, 1);
+
+    char line[128];
+    int slot = perf.hudLines;
+    float x = left + 10.0f;
+    float y = top - 22.0f;
+
+    double fps = perf.frameMs > 0.0 ? 1000.0 / perf.frameMs : 0.0;
+    snprintf(line, sizeof(line), "FPS %.1f  (%.2f ms)", fps, perf.frameMs);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "late %d  dropped %d  worst %.1f ms  sim %d step%s a=%.2f",
+        perf.lateFrames, perf.droppedFrames, perf.worstMs, perf.simSteps, perf.simSteps == 1 ? "" : "s", simAlpha);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "draws %d  verts %lld  culled %d/%d  occl %d", frameStats.drawCalls,
+        frameStats.vertices, frameStats.objectsCulled,
+        frameStats.objectsCulled + frameStats.objectsOccluded + frameStats.objectsVisible, frameStats.objectsOccluded);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "gl state %d issued  %d elided%s", frameStats.stateIssued, frameStats.stateElided,
+        glState.enabled ? "" : "  (cache off)");
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "queue %d  binds %d (-%d)  overdraw %.2f  arena %zu KB%s", frameStats.queueItems,
+        frameStats.materialSwitches, frameStats.materialSwitchesSaved, frameStats.overdraw, frameStats.arenaPeak / 1024,
+        renderQueue.sorted ? "" : "  (unsorted)");
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "stream %lld KB  %s x%d %zu KB  waits %d %.1f ms", frameStats.streamBytes / 1024,
+        streamRing.persistent ? "persistent" : "mapped", STREAM_FRAMES, streamRing.regionBytes / 1024,
+        frameStats.streamFenceWaits, frameStats.streamWaitMs);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "lod 0/1/2/3: %d / %d / %d / %d  terrain %d (-%d)", frameStats.lodObjects[0],
+        frameStats.lodObjects[1], frameStats.lodObjects[2], frameStats.lodObjects[3],
+        frameStats.terrainChunks, frameStats.terrainChunksCulled);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "jobs %d thread%s  cull %zu blocks  steals %d", workerPool().threadCount(),
+        workerPool().threadCount() == 1 ? "" : "s", cullBlockCounts.size(), frameStats.jobSteals);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "crowd %d  drawn %d  step %.2f ms  (%d thread%s)", crowd.count, frameStats.crowdVisible,
+        crowd.hashMs + crowd.steerMs + crowd.integrateMs + crowd.goalMs, crowd.threads, crowd.threads == 1 ? "" : "s");
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "shadows %s  redrawn %d/%d %.1f ms  dyn %d %.1f ms",
+        !shadows.enabled ? "off" : shadows.cacheEnabled ? "cached" : "uncached", frameStats.shadowCascadesRendered,
+        SHADOW_CASCADES, shadows.staticMs, frameStats.shadowDynamicCasters, shadows.dynamicMs);
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    snprintf(line, sizeof(line), "switch worst %.1f ms (was %.1f)  fade %.1f s  %s", residency.switchWorstMs,
+        residency.switchBaselineMs, residency.crossfadeSeconds, residency.enabled ? "warm" : "cold");
+    hudText(slot++, x, y, 1.0f, 1.0f, 0.6f, line);
+    y -= dy;
+
+    hudText(slot++, x, y, 0.8f, 0.8f, 0.8f,
+        perf.gpuTimers ? "stage          cpu ms    gpu ms" : "stage          cpu ms    (no gpu timers)");
+    y -= dy;
+
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        const StageTimer& stage = perf.stages[i];
+        if (perf.gpuTimers)
+            snprintf(line, sizeof(line), "%-12s %7.2f  %7.2f", frameStageNames[i], stage.cpuMs, stage.gpuMs);
+        else
+            snprintf(line, sizeof(line), "%-12s %7.2f", frameStageNames[i], stage.cpuMs);
+        hudText(slot++, x, y, 1.0f, 1.0f, 1.0f, line);
+        y -= dy;
+    }
 
-    // Front (+Z)
-    pushTri(x0, y0, z1, x1, y0, z1, x1, y1, z1, 0, 0, 1);
-    pushTri(x0, y0, z1, x1, y1, z1, x0, y1, z1, 0, 0, 1);
+    // What "submit" spent on each material
+    hudText(slot++, x, y, 0.8f, 0.8f, 0.8f, "submit by material");
+    y -= dy;
 
-    // Back (-Z)
-    pushTri(x0, y0, z0, x1, y1, z0, x1, y0, z0, 0, 0, -1);
-    pushTri(x0, y0, z0, x0, y1, z0, x1, y1, z0, 0, 0, -1);
+    for (int i = 0; i < MAT_COUNT; ++i) {
+        const MaterialTimer& m = perf.materials;
+        if (perf.gpuTimers)
+            snprintf(line, sizeof(line), "%-12s %7.2f  %7.2f", renderMaterialNames[i], m.cpuMs[i], m.gpuMs[i]);
+        else
+            snprintf(line, sizeof(line), "%-12s %7.2f", renderMaterialNames[i], m.cpuMs[i]);
+        hudText(slot++, x, y, 1.0f, 1.0f, 1.0f, line);
+        y -= dy;
+    }
 
-    // Left (-X)
-    pushTri(x0, y0, z0, x0, y0, z1, x0, y1, z1, -1, 0, 0);
-    pushTri(x0, y0, z0, x0, y1, z1, x0, y1, z0, -1, 0, 0);
+    // Frame-time graph: one bar per frame, 33.3 ms = full height, line at 16.7 ms
+    float graphBottom = top - panelH + 10.0f;
+    float barW = (panelW - 20.0f) / (float)PERF_HISTORY;
+    const float fullScaleMs = 33.3f;
+
+    for (int i = 0; i < PERF_HISTORY; ++i) {
+        float ms = perf.history[(perf.historyPos + i) % PERF_HISTORY];
+        float bh = std::min(ms / fullScaleMs, 1.0f) * graphH;
+        float bx = x + i * barW;
+        if (ms > 33.4f)      hudRect(perf.hudGraph, i, bx, graphBottom, bx + barW, graphBottom + bh, 0.9f, 0.2f, 0.2f);
+        else if (ms > 16.8f) hudRect(perf.hudGraph, i, bx, graphBottom, bx + barW, graphBottom + bh, 0.9f, 0.8f, 0.2f);
+        else                 hudRect(perf.hudGraph, i, bx, graphBottom, bx + barW, graphBottom + bh, 0.3f, 0.9f, 0.3f);
+    }
 
-    // Right (+X)
-    pushTri(x1, y0, z0, x1, y1, z1, x1, y0, z1, 1, 0, 0);
-    pushTri(x1, y0, z0, x1, y1, z0, x1, y1, z1, 1, 0, 0);
+    float targetY = graphBottom + graphH * (16.7f / fullScaleMs);
+    hudRect(perf.hudGraph, PERF_HISTORY, x, targetY, x + panelW - 20.0f, targetY + 1.0f, 0.6f, 0.6f, 0.6f);
+    hudShowQuads(perf.hudGraph, PERF_HISTORY + 1);
 }
 
-void createPyramidMesh(MeshVBO& mesh) {
-    std::vector<float> data;
+// ---------------------- Text (HUD) ----------------------
+// All HUD text and panels live in one vertex buffer and draw with one call. Glyphs come
+// from an alpha atlas built from an embedded fixed-width font, so text needs neither
+// GLUT bitmap fonts (one raster op per character) nor glutInit (it works headless).
+// The buffer is split into slots, one per line or panel; a slot is laid out again only
+// when its text, position or color changes, and only the changed vertex range is uploaded.
+
+// X11 misc-fixed 9x15 (public domain), printable ASCII. 16 rows per glyph, top row first;
+// bit 8 is the leftmost column. The baseline sits 4 rows above the bottom of the cell.
+const int FONT_GLYPH_W = 9;
+const int FONT_GLYPH_H = 16;
+const int FONT_BASELINE = 4;
+const int FONT_FIRST = 32;
+const int FONT_LAST = 126;
+
+const unsigned short fontGlyphs[FONT_LAST - FONT_FIRST + 1][FONT_GLYPH_H] = {
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // space
+    {0x000,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x000,0x000,0x010,0x010,0x000,0x000,0x000,0x000}, // !
+    {0x000,0x000,0x024,0x024,0x024,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // "
+    {0x000,0x000,0x000,0x048,0x048,0x0fc,0x048,0x048,0x0fc,0x048,0x048,0x000,0x000,0x000,0x000,0x000}, // #
+    {0x000,0x010,0x07c,0x092,0x090,0x050,0x038,0x014,0x012,0x012,0x092,0x07c,0x010,0x000,0x000,0x000}, // $
+    {0x000,0x000,0x042,0x0a4,0x0a4,0x048,0x010,0x010,0x024,0x04a,0x04a,0x084,0x000,0x000,0x000,0x000}, // %
+    {0x000,0x000,0x060,0x090,0x090,0x090,0x060,0x062,0x094,0x088,0x094,0x062,0x000,0x000,0x000,0x000}, // &
+    {0x000,0x000,0x00c,0x008,0x010,0x020,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // '
+    {0x000,0x008,0x010,0x010,0x020,0x020,0x020,0x020,0x020,0x020,0x010,0x010,0x008,0x000,0x000,0x000}, // (
+    {0x000,0x020,0x010,0x010,0x008,0x008,0x008,0x008,0x008,0x008,0x010,0x010,0x020,0x000,0x000,0x000}, // )
+    {0x000,0x000,0x000,0x000,0x010,0x092,0x054,0x038,0x054,0x092,0x010,0x000,0x000,0x000,0x000,0x000}, // *
+    {0x000,0x000,0x000,0x000,0x010,0x010,0x010,0x0fe,0x010,0x010,0x010,0x000,0x000,0x000,0x000,0x000}, // +
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x018,0x018,0x008,0x008,0x010,0x000}, // ,
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x0fe,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // -
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x018,0x018,0x000,0x000,0x000,0x000}, // .
+    {0x000,0x000,0x002,0x004,0x004,0x008,0x010,0x010,0x020,0x040,0x040,0x080,0x000,0x000,0x000,0x000}, // /
+    {0x000,0x000,0x038,0x044,0x082,0x082,0x082,0x082,0x082,0x082,0x044,0x038,0x000,0x000,0x000,0x000}, // 0
+    {0x000,0x000,0x010,0x030,0x050,0x090,0x010,0x010,0x010,0x010,0x010,0x0fe,0x000,0x000,0x000,0x000}, // 1
+    {0x000,0x000,0x07c,0x082,0x082,0x004,0x008,0x010,0x020,0x040,0x080,0x0fe,0x000,0x000,0x000,0x000}, // 2
+    {0x000,0x000,0x0fe,0x002,0x004,0x008,0x01c,0x002,0x002,0x002,0x082,0x07c,0x000,0x000,0x000,0x000}, // 3
+    {0x000,0x000,0x004,0x00c,0x014,0x024,0x044,0x084,0x0fe,0x004,0x004,0x004,0x000,0x000,0x000,0x000}, // 4
+    {0x000,0x000,0x0fe,0x080,0x080,0x0bc,0x0c2,0x002,0x002,0x002,0x082,0x07c,0x000,0x000,0x000,0x000}, // 5
+    {0x000,0x000,0x03c,0x040,0x080,0x080,0x0bc,0x0c2,0x082,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // 6
+    {0x000,0x000,0x0fe,0x002,0x002,0x004,0x008,0x010,0x020,0x020,0x040,0x040,0x000,0x000,0x000,0x000}, // 7
+    {0x000,0x000,0x038,0x044,0x082,0x044,0x038,0x044,0x082,0x082,0x044,0x038,0x000,0x000,0x000,0x000}, // 8
+    {0x000,0x000,0x07c,0x082,0x082,0x082,0x086,0x07a,0x002,0x002,0x004,0x078,0x000,0x000,0x000,0x000}, // 9
+    {0x000,0x000,0x000,0x000,0x000,0x018,0x018,0x000,0x000,0x000,0x018,0x018,0x000,0x000,0x000,0x000}, // :
+    {0x000,0x000,0x000,0x000,0x000,0x018,0x018,0x000,0x000,0x000,0x018,0x018,0x008,0x008,0x010,0x000}, // ;
+    {0x000,0x000,0x004,0x008,0x010,0x020,0x040,0x040,0x020,0x010,0x008,0x004,0x000,0x000,0x000,0x000}, // <
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x0fe,0x000,0x000,0x0fe,0x000,0x000,0x000,0x000,0x000,0x000}, // =
+    {0x000,0x000,0x040,0x020,0x010,0x008,0x004,0x004,0x008,0x010,0x020,0x040,0x000,0x000,0x000,0x000}, // >
+    {0x000,0x000,0x07c,0x082,0x082,0x002,0x004,0x008,0x010,0x010,0x000,0x010,0x000,0x000,0x000,0x000}, // ?
+    {0x000,0x000,0x07c,0x082,0x082,0x09e,0x0a2,0x0a6,0x09a,0x080,0x080,0x07c,0x000,0x000,0x000,0x000}, // @
+    {0x000,0x000,0x010,0x028,0x044,0x082,0x082,0x082,0x0fe,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // A
+    {0x000,0x000,0x0fc,0x042,0x042,0x042,0x0fc,0x042,0x042,0x042,0x042,0x0fc,0x000,0x000,0x000,0x000}, // B
+    {0x000,0x000,0x07c,0x082,0x080,0x080,0x080,0x080,0x080,0x080,0x082,0x07c,0x000,0x000,0x000,0x000}, // C
+    {0x000,0x000,0x0fc,0x042,0x042,0x042,0x042,0x042,0x042,0x042,0x042,0x0fc,0x000,0x000,0x000,0x000}, // D
+    {0x000,0x000,0x0fe,0x040,0x040,0x040,0x078,0x040,0x040,0x040,0x040,0x0fe,0x000,0x000,0x000,0x000}, // E
+    {0x000,0x000,0x0fe,0x040,0x040,0x040,0x078,0x040,0x040,0x040,0x040,0x040,0x000,0x000,0x000,0x000}, // F
+    {0x000,0x000,0x07c,0x082,0x080,0x080,0x080,0x08e,0x082,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // G
+    {0x000,0x000,0x082,0x082,0x082,0x082,0x0fe,0x082,0x082,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // H
+    {0x000,0x000,0x07c,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x07c,0x000,0x000,0x000,0x000}, // I
+    {0x000,0x000,0x01f,0x004,0x004,0x004,0x004,0x004,0x004,0x004,0x084,0x078,0x000,0x000,0x000,0x000}, // J
+    {0x000,0x000,0x082,0x084,0x088,0x090,0x0e0,0x0a0,0x090,0x088,0x084,0x082,0x000,0x000,0x000,0x000}, // K
+    {0x000,0x000,0x080,0x080,0x080,0x080,0x080,0x080,0x080,0x080,0x080,0x0fe,0x000,0x000,0x000,0x000}, // L
+    {0x000,0x000,0x082,0x082,0x0c6,0x0aa,0x0aa,0x092,0x092,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // M
+    {0x000,0x000,0x082,0x082,0x0c2,0x0a2,0x092,0x08a,0x086,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // N
+    {0x000,0x000,0x07c,0x082,0x082,0x082,0x082,0x082,0x082,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // O
+    {0x000,0x000,0x0fc,0x082,0x082,0x082,0x0fc,0x080,0x080,0x080,0x080,0x080,0x000,0x000,0x000,0x000}, // P
+    {0x000,0x000,0x07c,0x082,0x082,0x082,0x082,0x082,0x082,0x0a2,0x092,0x07c,0x008,0x006,0x000,0x000}, // Q
+    {0x000,0x000,0x0fc,0x082,0x082,0x082,0x0fc,0x090,0x088,0x084,0x082,0x082,0x000,0x000,0x000,0x000}, // R
+    {0x000,0x000,0x07c,0x082,0x082,0x080,0x070,0x00c,0x002,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // S
+    {0x000,0x000,0x0fe,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x000,0x000,0x000,0x000}, // T
+    {0x000,0x000,0x082,0x082,0x082,0x082,0x082,0x082,0x082,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // U
+    {0x000,0x000,0x082,0x082,0x082,0x044,0x044,0x044,0x028,0x028,0x028,0x010,0x000,0x000,0x000,0x000}, // V
+    {0x000,0x000,0x082,0x082,0x082,0x082,0x092,0x092,0x092,0x092,0x0aa,0x044,0x000,0x000,0x000,0x000}, // W
+    {0x000,0x000,0x082,0x082,0x044,0x028,0x010,0x010,0x028,0x044,0x082,0x082,0x000,0x000,0x000,0x000}, // X
+    {0x000,0x000,0x082,0x082,0x044,0x028,0x010,0x010,0x010,0x010,0x010,0x010,0x000,0x000,0x000,0x000}, // Y
+    {0x000,0x000,0x0fe,0x002,0x004,0x008,0x010,0x020,0x040,0x080,0x080,0x0fe,0x000,0x000,0x000,0x000}, // Z
+    {0x000,0x03c,0x020,0x020,0x020,0x020,0x020,0x020,0x020,0x020,0x020,0x020,0x03c,0x000,0x000,0x000}, // [
+    {0x000,0x000,0x080,0x040,0x040,0x020,0x010,0x010,0x008,0x004,0x004,0x002,0x000,0x000,0x000,0x000}, // backslash
+    {0x000,0x078,0x008,0x008,0x008,0x008,0x008,0x008,0x008,0x008,0x008,0x008,0x078,0x000,0x000,0x000}, // ]
+    {0x000,0x000,0x010,0x028,0x044,0x082,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // ^
+    {0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x1fe,0x000,0x000,0x000}, // _
+    {0x000,0x060,0x020,0x010,0x008,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // `
+    {0x000,0x000,0x000,0x000,0x000,0x07c,0x002,0x002,0x07e,0x082,0x086,0x07a,0x000,0x000,0x000,0x000}, // a
+    {0x000,0x000,0x080,0x080,0x080,0x0bc,0x0c2,0x082,0x082,0x082,0x0c2,0x0bc,0x000,0x000,0x000,0x000}, // b
+    {0x000,0x000,0x000,0x000,0x000,0x07c,0x082,0x080,0x080,0x080,0x082,0x07c,0x000,0x000,0x000,0x000}, // c
+    {0x000,0x000,0x002,0x002,0x002,0x07a,0x086,0x082,0x082,0x082,0x086,0x07a,0x000,0x000,0x000,0x000}, // d
+    {0x000,0x000,0x000,0x000,0x000,0x07c,0x082,0x082,0x0fe,0x080,0x080,0x07c,0x000,0x000,0x000,0x000}, // e
+    {0x000,0x000,0x01c,0x022,0x022,0x020,0x020,0x0f8,0x020,0x020,0x020,0x020,0x000,0x000,0x000,0x000}, // f
+    {0x000,0x000,0x000,0x000,0x000,0x07a,0x084,0x084,0x084,0x078,0x080,0x07c,0x082,0x082,0x07c,0x000}, // g
+    {0x000,0x000,0x080,0x080,0x080,0x0bc,0x0c2,0x082,0x082,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // h
+    {0x000,0x000,0x030,0x000,0x000,0x070,0x010,0x010,0x010,0x010,0x010,0x07c,0x000,0x000,0x000,0x000}, // i
+    {0x000,0x000,0x00c,0x000,0x000,0x01c,0x004,0x004,0x004,0x004,0x004,0x084,0x084,0x084,0x078,0x000}, // j
+    {0x000,0x000,0x080,0x080,0x080,0x082,0x08c,0x0b0,0x0c0,0x0b0,0x08c,0x082,0x000,0x000,0x000,0x000}, // k
+    {0x000,0x000,0x070,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x07c,0x000,0x000,0x000,0x000}, // l
+    {0x000,0x000,0x000,0x000,0x000,0x0ec,0x092,0x092,0x092,0x092,0x092,0x082,0x000,0x000,0x000,0x000}, // m
+    {0x000,0x000,0x000,0x000,0x000,0x0bc,0x0c2,0x082,0x082,0x082,0x082,0x082,0x000,0x000,0x000,0x000}, // n
+    {0x000,0x000,0x000,0x000,0x000,0x07c,0x082,0x082,0x082,0x082,0x082,0x07c,0x000,0x000,0x000,0x000}, // o
+    {0x000,0x000,0x000,0x000,0x000,0x0bc,0x0c2,0x082,0x082,0x082,0x0c2,0x0bc,0x080,0x080,0x080,0x000}, // p
+    {0x000,0x000,0x000,0x000,0x000,0x07a,0x086,0x082,0x082,0x082,0x086,0x07a,0x002,0x002,0x002,0x000}, // q
+    {0x000,0x000,0x000,0x000,0x000,0x09c,0x062,0x042,0x040,0x040,0x040,0x040,0x000,0x000,0x000,0x000}, // r
+    {0x000,0x000,0x000,0x000,0x000,0x07c,0x082,0x080,0x07c,0x002,0x082,0x07c,0x000,0x000,0x000,0x000}, // s
+    {0x000,0x000,0x000,0x020,0x020,0x0fc,0x020,0x020,0x020,0x020,0x022,0x01c,0x000,0x000,0x000,0x000}, // t
+    {0x000,0x000,0x000,0x000,0x000,0x084,0x084,0x084,0x084,0x084,0x084,0x07a,0x000,0x000,0x000,0x000}, // u
+    {0x000,0x000,0x000,0x000,0x000,0x082,0x082,0x044,0x044,0x028,0x028,0x010,0x000,0x000,0x000,0x000}, // v
+    {0x000,0x000,0x000,0x000,0x000,0x082,0x082,0x092,0x092,0x092,0x0aa,0x044,0x000,0x000,0x000,0x000}, // w
+    {0x000,0x000,0x000,0x000,0x000,0x082,0x044,0x028,0x010,0x028,0x044,0x082,0x000,0x000,0x000,0x000}, // x
+    {0x000,0x000,0x000,0x000,0x000,0x084,0x084,0x084,0x084,0x084,0x08c,0x074,0x004,0x084,0x078,0x000}, // y
+    {0x000,0x000,0x000,0x000,0x000,0x0fe,0x004,0x008,0x010,0x020,0x040,0x0fe,0x000,0x000,0x000,0x000}, // z
+    {0x000,0x00e,0x010,0x010,0x010,0x008,0x030,0x030,0x008,0x010,0x010,0x010,0x00e,0x000,0x000,0x000}, // {
+    {0x000,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x010,0x000,0x000,0x000}, // |
+    {0x000,0x0e0,0x010,0x010,0x010,0x020,0x018,0x018,0x020,0x010,0x010,0x010,0x0e0,0x000,0x000,0x000}, // }
+    {0x000,0x000,0x062,0x092,0x08c,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000}, // ~
+};
 
-    // More El Castillo–like proportions:
-    // 9 terraces, each slightly inset, shorter height,
-    // with a small temple on top.
-    const int   terraceCount = 9;
-    const float baseHalf = 13.5f;
-    const float terraceHeight = 1.4f;
+// 16 x 6 cells; the cell after '~' is solid and backs the panel / graph rectangles
+const int HUD_ATLAS_COLS = 16;
+const int HUD_ATLAS_W = HUD_ATLAS_COLS * FONT_GLYPH_W;
+const int HUD_ATLAS_H = 6 * FONT_GLYPH_H;
+const int HUD_SOLID_CELL = FONT_LAST - FONT_FIRST + 1;
 
-    float currentY = terraceHeight * 0.5f;
+struct HudVertex {
+    float x, y;
+    float u, v;
+    unsigned char r, g, b, a;
+};
 
-    for (int i = 0; i < terraceCount; ++i) {
-        float halfSize = baseHalf - i * 1.2f;
-        addBox(data, halfSize, terraceHeight * 0.5f, halfSize, currentY, 0.0f);
-        currentY += terraceHeight;
-    }
+struct HudSlot {
+    int first = 0;          // first vertex in the shared buffer
+    int capacity = 0;       // quads reserved
+    int quads = 0;          // quads currently laid out
+    bool visible = false;
+    std::string text;       // layout key of text slots
+    float x = 0.0f, y = 0.0f;
+    unsigned int color = 0;
+};
 
-    // Temple on top (slightly rectangular, like the real one)
-    float templeCenterY = currentY + 1.2f;
-    addBox(data, 3.5f, 2.0f, 3.5f, templeCenterY, 0.0f);
+struct HudTextBuffer {
+    GLuint atlas = 0;
+    GLuint vbo = 0;
+    int vboVertices = 0;                // allocated size of the VBO
+    std::vector<HudVertex> vertices;    // CPU copy of every slot
+    std::vector<HudSlot> slots;
+    int dirtyBegin = 0;                 // vertex range to upload before the next draw
+    int dirtyEnd = 0;
+    std::vector<GLint> drawFirst;       // per-frame glMultiDrawArrays lists
+    std::vector<GLsizei> drawCount;
+};
+HudTextBuffer hud;
+
+// drawHUD() slots
+const int HELP_LINE_COUNT = 12;
+const char* helpLines[HELP_LINE_COUNT] = {
+    "Controls:",
+    "  W / A / S / D : Move forward / left / back / right",
+    "  Q / E         : Move up / down",
+    "  Mouse drag    : Look around",
+    "  Arrow keys    : Rotate camera",
+    "  SPACE         : Switch Ancient / Modern scene",
+    "  F             : Toggle fog (Ancient scene)",
+    "  H             : Show / hide this help panel",
+    "  P             : Toggle performance overlay",
+    "  C             : Toggle frustum culling",
+    "  O             : Toggle occlusion culling",
+    "  ESC           : Quit application",
+};
+int hudTitleSlot = -1;
+int hudHintSlot = -1;
+int hudHelpPanelSlot = -1;
+int hudHelpSlot = -1;       // first of HELP_LINE_COUNT
+int hudStatusSlot = -1;
+
+int hudAddSlot(int quadCapacity) {
+    HudSlot slot;
+    slot.first = (int)hud.vertices.size();
+    slot.capacity = quadCapacity;
+    hud.vertices.resize(hud.vertices.size() + quadCapacity * 4);
+    hud.slots.push_back(slot);
+    return (int)hud.slots.size() - 1;
+}
 
-    mesh.vertexCount = (int)(data.size() / 6);
+void hudMarkDirty(int begin, int end) {
+    if (begin >= end) return;
+    if (hud.dirtyBegin >= hud.dirtyEnd) {
+        hud.dirtyBegin = begin;
+        hud.dirtyEnd = end;
+        return;
+    }
+    hud.dirtyBegin = std::min(hud.dirtyBegin, begin);
+    hud.dirtyEnd = std::max(hud.dirtyEnd, end);
+}
 
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Counter-clockwise (x0,y0)-(x1,y1); GL_CULL_FACE stays on for the HUD
+void writeHudQuad(HudVertex* v, float x0, float y0, float x1, float y1,
+    float u0, float v0, float u1, float v1, unsigned int color) {
+    const float xs[4] = { x0, x1, x1, x0 };
+    const float ys[4] = { y0, y0, y1, y1 };
+    const float us[4] = { u0, u1, u1, u0 };
+    const float vs[4] = { v0, v0, v1, v1 };
+    for (int i = 0; i < 4; ++i) {
+        v[i].x = xs[i];
+        v[i].y = ys[i];
+        v[i].u = us[i];
+        v[i].v = vs[i];
+        memcpy(&v[i].r, &color, 4);
+    }
 }
 
-// Ground VBO is still created (to satisfy VBO requirement) but we now
-// use the simpler cube-based drawGround() for visual clarity.
-void createGroundMesh(MeshVBO& mesh) {
-    std::vector<float> data;
+void hudText(int slot, float x, float y, float r, float g, float b, const char* text) {
+    HudSlot& s = hud.slots[slot];
+    unsigned int color = packRGBA8(r, g, b, 1.0f);
+    s.visible = true;
+    if (s.x == x && s.y == y && s.color == color && s.text == text) return;
+
+    s.text = text;
+    s.x = x;
+    s.y = y;
+    s.color = color;
+
+    // Whole pixels so the nearest-filtered glyphs map 1:1 onto the screen
+    float penX = floorf(x);
+    float penY = floorf(y) - FONT_BASELINE;
+    int quads = 0;
+    for (const char* c = text; *c && quads < s.capacity; ++c, penX += FONT_GLYPH_W) {
+        int glyph = (unsigned char)*c;
+        if (glyph == ' ') continue;
+        if (glyph < FONT_FIRST || glyph > FONT_LAST) glyph = '?';
+
+        int cell = glyph - FONT_FIRST;
+        float u0 = (float)(cell % HUD_ATLAS_COLS * FONT_GLYPH_W) / HUD_ATLAS_W;
+        float vTop = (float)(cell / HUD_ATLAS_COLS * FONT_GLYPH_H) / HUD_ATLAS_H;
+        writeHudQuad(&hud.vertices[s.first + quads * 4], penX, penY, penX + FONT_GLYPH_W, penY + FONT_GLYPH_H,
+            u0, vTop + (float)FONT_GLYPH_H / HUD_ATLAS_H, u0 + (float)FONT_GLYPH_W / HUD_ATLAS_W, vTop, color);
+        quads++;
+    }
+    s.quads = quads;
+    hudMarkDirty(s.first, s.first + quads * 4);
+}
 
-    float halfSize = 80.0f;
-    float y = 0.0f;
+// Solid rectangle as quad `index` of a slot; unchanged rectangles are not re-uploaded
+void hudRect(int slot, int index, float x0, float y0, float x1, float y1, float r, float g, float b, float a) {
+    HudSlot& s = hud.slots[slot];
+    float u = ((float)(HUD_SOLID_CELL % HUD_ATLAS_COLS) + 0.5f) * FONT_GLYPH_W / HUD_ATLAS_W;
+    float v = ((float)(HUD_SOLID_CELL / HUD_ATLAS_COLS) + 0.5f) * FONT_GLYPH_H / HUD_ATLAS_H;
+
+    HudVertex quad[4];
+    writeHudQuad(quad, x0, y0, x1, y1, u, v, u, v, packRGBA8(r, g, b, a));
+    HudVertex* dst = &hud.vertices[s.first + index * 4];
+    if (memcmp(dst, quad, sizeof(quad)) == 0) return;
+    memcpy(dst, quad, sizeof(quad));
+    hudMarkDirty(s.first + index * 4, s.first + index * 4 + 4);
+}
 
-    auto pushTri = [&](float x1, float z1,
-        float x2, float z2,
-        float x3, float z3)
-        {
-            float v[9] = { x1,y,z1,x2,y,z2,x3,y,z3 };
-            for (int i = 0; i < 3; ++i) {
-                data.push_back(v[i * 3 + 0]);
-                data.push_back(v[i * 3 + 1]);
-                data.push_back(v[i * 3 + 2]);
-                data.push_back(0.0f);
-                data.push_back(1.0f);
-                data.push_back(0.0f);
-            }
-        };
+void hudShowQuads(int slot, int quads) {
+    hud.slots[slot].quads = quads;
+    hud.slots[slot].visible = true;
+}
 
-    // Two triangles forming a big square
-    pushTri(-halfSize, -halfSize, halfSize, -halfSize, halfSize, halfSize);
-    pushTri(-halfSize, -halfSize, halfSize, halfSize, -halfSize, halfSize);
+void hudHide(int slot) {
+    hud.slots[slot].visible = false;
+}
 
-    mesh.vertexCount = (int)(data.size() / 6);
+void createHudText() {
+    std::vector<unsigned char> texels(HUD_ATLAS_W * HUD_ATLAS_H, 0);
+    for (int cell = 0; cell <= HUD_SOLID_CELL; ++cell) {
+        int cx = cell % HUD_ATLAS_COLS * FONT_GLYPH_W;
+        int cy = cell / HUD_ATLAS_COLS * FONT_GLYPH_H;
+        for (int row = 0; row < FONT_GLYPH_H; ++row) {
+            for (int col = 0; col < FONT_GLYPH_W; ++col) {
+                bool on = cell == HUD_SOLID_CELL || (fontGlyphs[cell][row] >> (FONT_GLYPH_W - 1 - col) & 1);
+                texels[(cy + row) * HUD_ATLAS_W + cx + col] = on ? 255 : 0;
+            }
+        }
+    }
 
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenTextures(1, &hud.atlas);
+    glBindTexture(GL_TEXTURE_2D, hud.atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA8, HUD_ATLAS_W, HUD_ATLAS_H, 0, GL_ALPHA, GL_UNSIGNED_BYTE, texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(1, &hud.vbo);
+
+    hudTitleSlot = hudAddSlot(64);
+    hudHintSlot = hudAddSlot(32);
+    hudHelpPanelSlot = hudAddSlot(1);
+    hudHelpSlot = hudAddSlot((int)strlen(helpLines[0]));
+    for (int i = 1; i < HELP_LINE_COUNT; ++i) hudAddSlot((int)strlen(helpLines[i]));
+    hudStatusSlot = hudAddSlot(64);
+    allocPerfOverlaySlots();
 }
 
-// ---------------------- Text (HUD) ----------------------
+// Uploads the dirty range and draws every visible slot in one glMultiDrawArrays
+void drawHudText() {
+    glBindBuffer(GL_ARRAY_BUFFER, hud.vbo);
+    if (hud.vboVertices < (int)hud.vertices.size()) {
+        hud.vboVertices = (int)hud.vertices.size();
+        glBufferData(GL_ARRAY_BUFFER, hud.vboVertices * sizeof(HudVertex), hud.vertices.data(), GL_DYNAMIC_DRAW);
+    }
+    else if (hud.dirtyBegin < hud.dirtyEnd) {
+        glBufferSubData(GL_ARRAY_BUFFER, hud.dirtyBegin * sizeof(HudVertex),
+            (hud.dirtyEnd - hud.dirtyBegin) * sizeof(HudVertex), &hud.vertices[hud.dirtyBegin]);
+    }
+    hud.dirtyBegin = hud.dirtyEnd = 0;
+
+    hud.drawFirst.clear();
+    hud.drawCount.clear();
+    long long vertices = 0;
+    for (const HudSlot& s : hud.slots) {
+        if (!s.visible || s.quads == 0) continue;
+        hud.drawFirst.push_back(s.first);
+        hud.drawCount.push_back(s.quads * 4);
+        vertices += s.quads * 4;
+    }
 
-void renderBitmapString(float x, float y, const char* string) {
-    glRasterPos2f(x, y);
-    while (*string) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *string);
-        ++string;
+    if (!hud.drawFirst.empty()) {
+        const GLsizei stride = sizeof(HudVertex);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, stride, (void*)offsetof(HudVertex, x));
+        glTexCoordPointer(2, GL_FLOAT, stride, (void*)offsetof(HudVertex, u));
+        glColorPointer(4, GL_UNSIGNED_BYTE, stride, (void*)offsetof(HudVertex, r));
+
+        stateEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, hud.atlas);
+        stateEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        glMultiDrawArrays(GL_QUADS, hud.drawFirst.data(), hud.drawCount.data(), (GLsizei)hud.drawFirst.size());
+        countDraw(vertices);
+
+        stateDisable(GL_BLEND);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        stateDisable(GL_TEXTURE_2D);
+        glDisableClientState(GL_COLOR_ARRAY);
+        stateForgetColor();
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
     }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void drawHUD() {
-    int w = glutGet(GLUT_WINDOW_WIDTH);
-    int h = glutGet(GLUT_WINDOW_HEIGHT);
+    int w = windowWidth;
+    int h = windowHeight;
 
-    glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
+    stateDisable(GL_LIGHTING);
+    stateDisable(GL_DEPTH_TEST);
 
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
@@ -898,64 +6364,50 @@ void drawHUD() {
     glPushMatrix();
     glLoadIdentity();
 
-    // -------------------- Title at top left --------------------
-    glColor3f(1, 1, 1);
-    if (currentScene == ANCIENT_SCENE) {
-        renderBitmapString(10, h - 30, "Ancient Chichen Itza - Lost in the Jungle");
+    drawCrossfade(w, h);
+
+    // -------------------- Title at top left --------------------
+    if (currentScene == ANCIENT_SCENE) {
+        hudText(hudTitleSlot, 10, h - 30, 1, 1, 1, "Ancient Chichen Itza - Lost in the Jungle");
+    }
+    else {
+        hudText(hudTitleSlot, 10, h - 30, 1, 1, 1, "Modern Chichen Itza - Tourist Landmark");
+    }
+
+    if (perf.visible) {
+        drawPerfOverlay(w, h);
     }
     else {
-        renderBitmapString(10, h - 30, "Modern Chichen Itza - Tourist Landmark");
+        hidePerfOverlay();
     }
 
     if (!showHelp) {
         // Small hint at bottom-left when help is hidden
-        glColor3f(0.8f, 0.8f, 0.8f);
-        renderBitmapString(10, 20, "[H] Show controls");
+        hudText(hudHintSlot, 10, 20, 0.8f, 0.8f, 0.8f, "[H] Show controls");
+        hudHide(hudHelpPanelSlot);
+        for (int i = 0; i < HELP_LINE_COUNT; ++i) hudHide(hudHelpSlot + i);
+        hudHide(hudStatusSlot);
     }
     else {
         // -------------------- Controls panel --------------------
+        hudHide(hudHintSlot);
         int x = 10;
         int y = h - 70;    // start a bit below the title
         int dy = 22;       // line spacing
 
-        // Optional: a slightly dark background panel for readability
-        glDisable(GL_TEXTURE_2D);
-        glColor4f(0.0f, 0.0f, 0.0f, 0.55f);
-        glBegin(GL_QUADS);
-        glVertex2f(5, y + 10);
-        glVertex2f(360, y + 10);
-        glVertex2f(360, y - 9 * dy - 10);
-        glVertex2f(5, y - 9 * dy - 10);
-        glEnd();
-
-        // Controls text
-        glColor3f(1.0f, 1.0f, 1.0f);
-        renderBitmapString((float)x, (float)y, "Controls:");
-        y -= dy;
+        // A slightly dark background panel for readability
+        hudRect(hudHelpPanelSlot, 0, 5, (float)(y - HELP_LINE_COUNT * dy - 10), 490, (float)(y + 16),
+            0.0f, 0.0f, 0.0f, 0.55f);
+        hudShowQuads(hudHelpPanelSlot, 1);
 
-        renderBitmapString((float)x, (float)y, "  W / A / S / D : Move forward / left / back / right");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  Q / E         : Move up / down");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  Mouse drag    : Look around");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  Arrow keys    : Rotate camera");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  SPACE         : Switch Ancient / Modern scene");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  F             : Toggle fog (Ancient scene)");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  H             : Show / hide this help panel");
-        y -= dy;
-        renderBitmapString((float)x, (float)y, "  ESC           : Quit application");
+        for (int i = 0; i < HELP_LINE_COUNT; ++i) {
+            hudText(hudHelpSlot + i, (float)x, (float)y, 1.0f, 1.0f, 1.0f, helpLines[i]);
+            y -= dy;
+        }
 
-        // Dynamic info line (example: fog state if you implemented fogEnabled)
-        y -= dy;
+        // Dynamic info line: the only help line that changes while it is shown
         char infoLine[128];
-
         if (currentScene == ANCIENT_SCENE) {
-            // If you don't have fogEnabled, remove this block
-            extern bool fogEnabled; // make sure fogEnabled is declared globally
             snprintf(infoLine, sizeof(infoLine),
                 "Status: Scene = Ancient | Fog = %s",
                 fogEnabled ? "ON" : "OFF");
@@ -964,110 +6416,464 @@ void drawHUD() {
             snprintf(infoLine, sizeof(infoLine),
                 "Status: Scene = Modern");
         }
-
-        glColor3f(0.8f, 0.9f, 1.0f);
-        renderBitmapString((float)x, (float)y, infoLine);
+        hudText(hudStatusSlot, (float)x, (float)y, 0.8f, 0.9f, 1.0f, infoLine);
     }
 
+    drawHudText();
+
     // Restore matrices
     glPopMatrix();
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
+    stateEnable(GL_DEPTH_TEST);
+    stateEnable(GL_LIGHTING);
+}
+
+
+// ---------------------- Session Recording ----------------------
+// --record file logs every input callback, every simulation tick and every displayed frame
+// of an interactive session with its steady-clock time. --replay file feeds the log back
+// through the same callbacks (see runReplayFrame), the recorded tick and frame times
+// standing in for the clock, so the session runs again frame for frame: same steps, same
+// camera, same scene switches and toggles, whatever the new frame times are. Events are
+// kept in memory and written at exit.
+//
+// Layout (native byte order): SessionHeader | SessionEvent[eventCount]
+
+const char* SESSION_MAGIC = "CITR";
+const unsigned SESSION_VERSION = 1;
+
+enum SessionEventType {
+    EVENT_KEY_DOWN = 1,  // code = key, as GLUT delivered it
+    EVENT_KEY_UP,
+    EVENT_SPECIAL_DOWN,  // code = GLUT_KEY_*
+    EVENT_SPECIAL_UP,
+    EVENT_MOUSE,         // code = button, state = GLUT_DOWN / GLUT_UP
+    EVENT_MOTION,
+    EVENT_RESHAPE,       // x, y = new window size
+    EVENT_TICK,          // simAdvance() at this time
+    EVENT_FRAME          // displayCallback() at this time
+};
+
+struct SessionEvent {
+    long long timeNs;      // since the recording started
+    unsigned char type;
+    unsigned char code;
+    unsigned short state;
+    short x, y;            // cursor position
+};
+static_assert(sizeof(SessionEvent) == 16, "session events are written as-is");
+
+enum SessionToggle { TOGGLE_FOG = 1, TOGGLE_CULL = 2, TOGGLE_OCCLUSION = 4, TOGGLE_PERF = 8, TOGGLE_HELP = 16 };
+
+struct SessionHeader {
+    char magic[4];
+    unsigned version;
+    unsigned byteOrder;
+    unsigned eventCount;
+    unsigned frameCount;
+    int width, height;     // window size at the first frame
+    int scene;             // state the session started in
+    unsigned toggles;
+    Camera startCamera;
+    Camera endCamera;      // at the last frame; a replay that ends elsewhere has drifted
+};
+
+struct Session {
+    bool recording = false;
+    bool replaying = false;
+    std::string path;
+    SessionHeader header = {};
+    std::vector<SessionEvent> events;
+    std::chrono::steady_clock::time_point start;  // time zero of the event times
+    size_t next = 0;                              // replay position
+};
+Session session;
+
+void sessionRecord(SessionEventType type, int code, int state, int x, int y,
+    std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now()) {
+    if (!session.recording) return;
+    SessionEvent event = {};
+    event.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(time - session.start).count();
+    event.type = (unsigned char)type;
+    event.code = (unsigned char)code;
+    event.state = (unsigned short)state;
+    event.x = (short)x;
+    event.y = (short)y;
+    session.events.push_back(event);
+}
+
+// Recorded event time back on the clock (differences come out exactly as recorded)
+std::chrono::steady_clock::time_point sessionTime(const SessionEvent& event) {
+    return session.start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::nanoseconds(event.timeNs));
+}
+
+// The clock reading the frame loop advances the simulation to
+std::chrono::steady_clock::time_point sessionTick() {
+    auto now = std::chrono::steady_clock::now();
+    sessionRecord(EVENT_TICK, 0, 0, 0, 0, now);
+    return now;
+}
+
+// Start of displayCallback(): latches frameTime, unless a replay already set it
+void sessionBeginFrame() {
+    if (session.replaying) return;
+    frameTime = std::chrono::steady_clock::now();
+    if (!session.recording) return;
+    if (session.header.frameCount++ == 0) {
+        session.header.width = windowWidth;
+        session.header.height = windowHeight;
+    }
+    session.header.endCamera = camera; // ticks after the last frame are not replayed
+    sessionRecord(EVENT_FRAME, 0, 0, 0, 0, frameTime);
+}
+
+void writeSessionRecording() {
+    if (!session.recording) return;
+    session.recording = false;
+    SessionHeader& header = session.header;
+    header.eventCount = (unsigned)session.events.size();
+
+    FILE* f = fopen(session.path.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Session: cannot write " << session.path << std::endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!session.events.empty())
+        ok = fwrite(session.events.data(), sizeof(SessionEvent), session.events.size(), f) == session.events.size() && ok;
+    ok = (fclose(f) == 0) && ok;
+    if (ok) std::cout << "Session: recorded " << header.frameCount << " frames (" << header.eventCount
+        << " events) to " << session.path << std::endl;
+    else std::cerr << "Session: failed writing " << session.path << std::endl;
+}
+
+// Called once the scene is up; the file is written at exit (ESC and closing the window both exit)
+void startSessionRecording() {
+    SessionHeader& header = session.header;
+    memcpy(header.magic, SESSION_MAGIC, 4);
+    header.version = SESSION_VERSION;
+    header.byteOrder = SCENE_CACHE_BYTE_ORDER;
+    header.scene = currentScene;
+    header.toggles = (fogEnabled ? TOGGLE_FOG : 0) | (cullingEnabled ? TOGGLE_CULL : 0) |
+        (occlusionEnabled ? TOGGLE_OCCLUSION : 0) | (perf.visible ? TOGGLE_PERF : 0) | (showHelp ? TOGGLE_HELP : 0);
+    header.startCamera = camera;
+    session.start = std::chrono::steady_clock::now();
+    session.recording = true;
+    atexit(writeSessionRecording);
+}
+
+// Reads the whole log; false (with a message) when it is missing, truncated or from another version
+bool loadSessionReplay(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(SessionHeader)) {
+        std::cerr << "Session: cannot read " << path << std::endl;
+        return false;
+    }
+    SessionHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SESSION_MAGIC, 4) != 0 || header.version != SESSION_VERSION ||
+        header.byteOrder != SCENE_CACHE_BYTE_ORDER ||
+        file.size() != sizeof(SessionHeader) + (size_t)header.eventCount * sizeof(SessionEvent) ||
+        header.width <= 0 || header.height <= 0) {
+        std::cerr << "Session: " << path << " is not a recording this build can replay" << std::endl;
+        return false;
+    }
+    session.header = header;
+    session.events.resize(header.eventCount);
+    if (header.eventCount > 0)
+        memcpy(session.events.data(), file.data() + sizeof(SessionHeader), header.eventCount * sizeof(SessionEvent));
+    // Input after the last frame (the ESC that ended the session) has nothing left to show
+    while (!session.events.empty() && session.events.back().type != EVENT_FRAME) session.events.pop_back();
+    session.path = path;
+    session.next = 0;
+    session.start = std::chrono::steady_clock::now();
+    session.replaying = true;
+    return true;
+}
+
+// Puts the scene, toggles and camera back the way the recording started (after initScene)
+void applySessionStart() {
+    const SessionHeader& header = session.header;
+    currentScene = header.scene == MODERN_SCENE ? MODERN_SCENE : ANCIENT_SCENE;
+    fogEnabled = (header.toggles & TOGGLE_FOG) != 0;
+    cullingEnabled = (header.toggles & TOGGLE_CULL) != 0;
+    occlusionEnabled = (header.toggles & TOGGLE_OCCLUSION) != 0;
+    perf.visible = (header.toggles & TOGGLE_PERF) != 0;
+    showHelp = (header.toggles & TOGGLE_HELP) != 0;
+    camera = header.startCamera;
+}
+
+
+// ---------------------- Frame Loop ----------------------
+// Simulation (camera motion, the crowd, and the clock clouds drift by) advances in fixed SIM_STEP
+// steps paid for by the monotonic clock, so its speed no longer depends on how often
+// GLUT delivers callbacks. Rendering runs uncapped or paced by the swap interval and
+// draws a blend of the last two simulation states.
+
+const double SIM_STEP = 1.0 / 60.0;
+const int SIM_MAX_STEPS = 8;            // per frame; a longer stall drops the backlog instead
+const float CAMERA_MOVE_SPEED = 45.0f;  // units per second while a movement key is held
+const float CAMERA_TURN_SPEED = 90.0f;  // degrees per second while an arrow key is held
+
+struct SimState {
+    double time = 0.0;
+    Camera camera = {};
+};
+
+enum ArrowKey { ARROW_LEFT, ARROW_RIGHT, ARROW_UP, ARROW_DOWN, ARROW_COUNT };
+
+struct FrameLoop {
+    SimState previous;
+    SimState current;
+    double accumulator = 0.0;           // clock time not yet simulated
+    std::chrono::steady_clock::time_point lastTick;
+    bool started = false;
+    bool vsync = true;                  // --no-vsync renders uncapped
+    bool keyHeld[256] = {};             // lower-case keys, set/cleared by the GLUT key callbacks
+    bool arrowHeld[ARROW_COUNT] = {};
+};
+FrameLoop frameLoop;
+
+// Both states take the current camera (start-up, benchmark camera path)
+void simSyncCamera() {
+    frameLoop.previous.camera = camera;
+    frameLoop.current.camera = camera;
+}
+
+inline float heldAxis(bool positive, bool negative) {
+    return (positive ? 1.0f : 0.0f) - (negative ? 1.0f : 0.0f);
+}
+
+void simStep(SimState& s) {
+    const float dt = (float)SIM_STEP;
+    s.time += SIM_STEP;
+
+    const bool* key = frameLoop.keyHeld;
+    float move = CAMERA_MOVE_SPEED * dt;
+    moveCamera(s.camera, heldAxis(key['w'], key['s']) * move, heldAxis(key['d'], key['a']) * move,
+        heldAxis(key['q'], key['e']) * move);
+
+    const bool* arrow = frameLoop.arrowHeld;
+    float turn = CAMERA_TURN_SPEED * dt;
+    s.camera.yaw += heldAxis(arrow[ARROW_RIGHT], arrow[ARROW_LEFT]) * turn;
+    s.camera.pitch += heldAxis(arrow[ARROW_UP], arrow[ARROW_DOWN]) * turn;
+    s.camera.pitch = std::min(std::max(s.camera.pitch, -89.0f), 89.0f);
+}
+
+// Render state = previous + (current - previous) * alpha
+void simInterpolate(float alpha) {
+    const SimState& a = frameLoop.previous;
+    const SimState& b = frameLoop.current;
+    auto mix = [alpha](float from, float to) { return from + (to - from) * alpha; };
+
+    timeSeconds = (float)(a.time + (b.time - a.time) * alpha);
+
+    camera.x = mix(a.camera.x, b.camera.x);
+    camera.y = mix(a.camera.y, b.camera.y);
+    camera.z = mix(a.camera.z, b.camera.z);
+    camera.yaw = mix(a.camera.yaw, b.camera.yaw);
+    camera.pitch = mix(a.camera.pitch, b.camera.pitch);
+    simAlpha = alpha;
+}
+
+// Takes the steps owed up to now (the clock, or a recorded tick), then interpolates the render state
+void simAdvance(std::chrono::steady_clock::time_point now) {
+    if (!frameLoop.started) {
+        frameLoop.lastTick = now;
+        frameLoop.started = true;
+    }
+    frameLoop.accumulator += std::chrono::duration<double>(now - frameLoop.lastTick).count();
+    frameLoop.lastTick = now;
+
+    int steps = 0;
+    while (frameLoop.accumulator >= SIM_STEP && steps < SIM_MAX_STEPS) {
+        frameLoop.previous = frameLoop.current;
+        simStep(frameLoop.current);
+        if (currentScene == MODERN_SCENE) crowdStep((float)SIM_STEP);
+        frameLoop.accumulator -= SIM_STEP;
+        ++steps;
+    }
+    if (frameLoop.accumulator >= SIM_STEP)
+        frameLoop.accumulator = fmod(frameLoop.accumulator, SIM_STEP);
+
+    perf.simSteps = steps;
+    simInterpolate((float)(frameLoop.accumulator / SIM_STEP));
+}
+
+// Benchmark frames take exactly one step and show it, so runs are reproducible
+void simAdvanceFixed() {
+    frameLoop.previous = frameLoop.current;
+    simStep(frameLoop.current);
+    if (currentScene == MODERN_SCENE) crowdStep((float)SIM_STEP);
+    perf.simSteps = 1;
+    simInterpolate(1.0f);
+}
+
+// Mouse look bypasses the fixed step so it never lags the cursor
+void simLook(float yawDelta, float pitchDelta) {
+    for (Camera* cam : { &frameLoop.previous.camera, &frameLoop.current.camera, &camera }) {
+        cam->yaw += yawDelta;
+        cam->pitch = std::min(std::max(cam->pitch + pitchDelta, -89.0f), 89.0f);
+    }
+}
+
+// Vsync through the platform's swap-interval extension (all variants take just the interval)
+void setSwapInterval(int interval) {
+#ifdef _WIN32
+    typedef BOOL(WINAPI* SwapIntervalProc)(int);
+    auto swapInterval = (SwapIntervalProc)glutGetProcAddress("wglSwapIntervalEXT");
+#else
+    typedef int (*SwapIntervalProc)(int);
+    auto swapInterval = (SwapIntervalProc)glutGetProcAddress("glXSwapIntervalMESA");
+    if (!swapInterval && interval > 0)
+        swapInterval = (SwapIntervalProc)glutGetProcAddress("glXSwapIntervalSGI");
+#endif
+    if (swapInterval) swapInterval(interval);
+    else std::cerr << "No swap interval control; frame pacing is left to the driver" << std::endl;
 }
 
+void frameIdleCallback() {
+    simAdvance(sessionTick());
+    glutPostRedisplay();
+}
 
 // ---------------------- GLUT Callbacks ----------------------
 
 bool dragging = false;
 int lastMouseX = 0, lastMouseY = 0;
 
-void displayCallback() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    if (currentScene == ANCIENT_SCENE && fogEnabled) {
-        glEnable(GL_FOG);
+void drawWorld(SceneType scene) {
+    if (scene == ANCIENT_SCENE && fogEnabled) {
+        stateEnable(GL_FOG);
     }
     else {
-        glDisable(GL_FOG);
+        stateDisable(GL_FOG);
     }
 
     applyCamera();
-    setupLights(currentScene);
-    drawSkybox(currentScene);
+    setupLights(scene);
+
+    // Visibility, LOD and draw lists on the worker pool
+    perfBeginStage(STAGE_CULL);
+    int stealsBefore = workerPool().steals();
+    cullScene(scene);
+    buildDrawLists(scene);
+    frameStats.jobSteals += workerPool().steals() - stealsBefore;
+    perfEndStage(STAGE_CULL);
+
+    perfBeginStage(STAGE_SHADOWS);
+    updateShadows(scene);
+    perfEndStage(STAGE_SHADOWS);
+
+    // Emit (ground, clouds, scene and sky stages: instance updates and draw items),
+    // then sort and draw everything at once
+    beginRenderQueue(scene);
 
-    // Ground first
-    drawGround(currentScene);
+    perfBeginStage(STAGE_GROUND);
+    queueTerrain(scene);
+    perfEndStage(STAGE_GROUND);
 
     // 3D clouds
-    drawClouds(currentScene);
+    perfBeginStage(STAGE_CLOUDS);
+    queueClouds(scene);
+    perfEndStage(STAGE_CLOUDS);
 
     // Scenes
-    if (currentScene == ANCIENT_SCENE) {
-        drawAncientScene();
+    perfBeginStage(STAGE_SCENE);
+    if (scene == ANCIENT_SCENE) {
+        queueAncientScene();
     }
     else {
-        drawModernScene();
+        queueModernScene();
     }
+    perfEndStage(STAGE_SCENE);
+
+    // Last: only the pixels nothing covered
+    perfBeginStage(STAGE_SKY);
+    queueSky();
+    perfEndStage(STAGE_SKY);
+
+    perfBeginStage(STAGE_SUBMIT);
+    submitRenderQueue();
+    perfEndStage(STAGE_SUBMIT);
+}
+
+void displayCallback() {
+    sessionBeginFrame();
+    frameStats = FrameStats();
+    streamBeginFrame();
+    perfBeginFrame();
+    const float* clear = skyHorizon[currentScene];
+    glClearColor(clear[0], clear[1], clear[2], 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    drawWorld(currentScene);
+    if (residency.switchPending) completeSceneSwitch();
+
+    perfBeginStage(STAGE_HUD);
     drawHUD();
+    perfEndStage(STAGE_HUD);
 
-    glutSwapBuffers();
+    if (headlessMode) glFinish();
+    else              glutSwapBuffers();
 }
 
 void reshapeCallback(int w, int h) {
+    sessionRecord(EVENT_RESHAPE, 0, 0, w, h);
     if (h == 0) h = 1;
+    windowWidth = w;
+    windowHeight = h;
     float aspect = (float)w / (float)h;
     glViewport(0, 0, w, h);
+    resizeFadeTexture(w, h);
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluPerspective(camera.fov, aspect, 0.1f, 1000.0f);
+    gluPerspective(camera.fov, aspect, NEAR_PLANE, FAR_PLANE);
     glMatrixMode(GL_MODELVIEW);
 }
 
 void keyboardCallback(unsigned char key, int x, int y) {
-    float moveSpeed = 1.5f;
+    sessionRecord(EVENT_KEY_DOWN, key, 0, x, y);
+    key = (unsigned char)tolower(key);
+    frameLoop.keyHeld[key] = true; // movement keys are read by simStep()
 
     switch (key) {
-    case 'w': case 'W':
-        moveCamera(moveSpeed, 0.0f, 0.0f);
-        break;
-    case 's': case 'S':
-        moveCamera(-moveSpeed, 0.0f, 0.0f);
-        break;
-    case 'a': case 'A':
-        moveCamera(0.0f, -moveSpeed, 0.0f);
-        break;
-    case 'd': case 'D':
-        moveCamera(0.0f, moveSpeed, 0.0f);
+    case 'h':
+        showHelp = !showHelp;
         break;
-    case 'q': case 'Q':
-        moveCamera(0.0f, 0.0f, moveSpeed);
+    case 'f':
+        fogEnabled = !fogEnabled;
         break;
-    case 'e': case 'E':
-        moveCamera(0.0f, 0.0f, -moveSpeed);
+    case 'p':
+        perf.visible = !perf.visible;
         break;
-    case 'h': case 'H':
-        showHelp = !showHelp;
+    case 'c':
+        cullingEnabled = !cullingEnabled;
         break;
-    case 'f': case 'F':
-        fogEnabled = !fogEnabled;
+    case 'o':
+        occlusionEnabled = !occlusionEnabled;
         break;
     case ' ':
-        currentScene = (currentScene == ANCIENT_SCENE) ? MODERN_SCENE : ANCIENT_SCENE;
+        requestSceneSwitch();
         break;
     case 27: // ESC
         exit(0);
         break;
     }
-    glutPostRedisplay();
+}
+
+void keyboardUpCallback(unsigned char key, int x, int y) {
+    sessionRecord(EVENT_KEY_UP, key, 0, x, y);
+    frameLoop.keyHeld[(unsigned char)tolower(key)] = false;
 }
 
 void mouseCallback(int button, int state, int x, int y) {
+    sessionRecord(EVENT_MOUSE, button, state, x, y);
     if (button == GLUT_LEFT_BUTTON) {
         if (state == GLUT_DOWN) {
             dragging = true;
@@ -1081,6 +6887,7 @@ void mouseCallback(int button, int state, int x, int y) {
 }
 
 void motionCallback(int x, int y) {
+    sessionRecord(EVENT_MOTION, 0, 0, x, y);
     if (!dragging) return;
 
     int dx = x - lastMouseX;
@@ -1089,48 +6896,27 @@ void motionCallback(int x, int y) {
     lastMouseY = y;
 
     float sensitivity = 0.3f;
-    camera.yaw += dx * sensitivity;
-    camera.pitch -= dy * sensitivity;
-
-    if (camera.pitch > 89.0f) camera.pitch = 89.0f;
-    if (camera.pitch < -89.0f) camera.pitch = -89.0f;
-
-    glutPostRedisplay();
+    simLook(dx * sensitivity, -dy * sensitivity);
 }
 
-void timerCallback(int value) {
-    timeSeconds += 0.016f;
-    cloudOffset += 0.05f;
-    if (cloudOffset > 100.0f) cloudOffset = 0.0f;
-
-    touristBounce = 0.1f * sinf(timeSeconds * 2.0f);
-
-    glutPostRedisplay();
-    glutTimerFunc(16, timerCallback, 0);
+// Arrow keys rotate the camera while held (see simStep)
+void setArrowHeld(int key, bool held) {
+    switch (key) {
+    case GLUT_KEY_LEFT:  frameLoop.arrowHeld[ARROW_LEFT] = held; break;
+    case GLUT_KEY_RIGHT: frameLoop.arrowHeld[ARROW_RIGHT] = held; break;
+    case GLUT_KEY_UP:    frameLoop.arrowHeld[ARROW_UP] = held; break;
+    case GLUT_KEY_DOWN:  frameLoop.arrowHeld[ARROW_DOWN] = held; break;
+    }
 }
 
 void specialCallback(int key, int x, int y) {
-    float rotateSpeed = 2.0f;
-    float pitchSpeed = 2.0f;
-
-    switch (key) {
-    case GLUT_KEY_LEFT:
-        camera.yaw -= rotateSpeed;
-        break;
-    case GLUT_KEY_RIGHT:
-        camera.yaw += rotateSpeed;
-        break;
-    case GLUT_KEY_UP:
-        camera.pitch += pitchSpeed;
-        if (camera.pitch > 89.0f) camera.pitch = 89.0f;
-        break;
-    case GLUT_KEY_DOWN:
-        camera.pitch -= pitchSpeed;
-        if (camera.pitch < -89.0f) camera.pitch = -89.0f;
-        break;
-    }
+    sessionRecord(EVENT_SPECIAL_DOWN, key, 0, x, y);
+    setArrowHeld(key, true);
+}
 
-    glutPostRedisplay();
+void specialUpCallback(int key, int x, int y) {
+    sessionRecord(EVENT_SPECIAL_UP, key, 0, x, y);
+    setArrowHeld(key, false);
 }
 
 // ---------------------- Initialization ----------------------
@@ -1138,11 +6924,11 @@ void specialCallback(int key, int x, int y) {
 void initGL() {
     glewInit();
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    stateEnable(GL_DEPTH_TEST);
+    stateEnable(GL_CULL_FACE);
     glFrontFace(GL_CCW);
 
-    glEnable(GL_COLOR_MATERIAL);
+    stateEnable(GL_COLOR_MATERIAL);
     glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
 
     // --- Fog base setup (we'll enable/disable per-frame) ---
@@ -1151,20 +6937,818 @@ void initGL() {
     glFogfv(GL_FOG_COLOR, fogColor);
     glFogf(GL_FOG_DENSITY, 0.015f);        // tweak for more/less fog
     glHint(GL_FOG_HINT, GL_NICEST);
+
+    initPerfOverlay();
+    createHudText();
 }
 
 
 void initScene() {
-    createPyramidMesh(pyramidMesh);
-    createGroundMesh(groundMesh); // kept for VBO usage requirement
+    auto start = std::chrono::steady_clock::now();
+
+    // Meshes, instance stores and static batches: from the baked cache when there is a
+    // valid one, otherwise generated (placements first, the bake reads the instance store)
+    sceneLoadedFromCache = sceneCacheEnabled && loadSceneCache(sceneCachePath);
+    if (!sceneLoadedFromCache) {
+        GeneratedScene gen;
+        generateScene(gen);
+        uploadGeneratedScene(gen);
+    }
+
+    vegetationProgram = createProgram(vegetationVertexSrc, vegetationFragmentSrc, shadowReceiverSrc);
+    createForests();
+    createSky();
+    createTerrain();
+    createCloudLayer(cloudClusterCount);
+    initCrowd(crowdAgentCount);
+    createCrowdRenderer();
+    createShadows();
+    invalidateShadowCaches(); // static casters are (re)uploaded
+
+    buildObjectGrid(ANCIENT_SCENE);
+    buildObjectGrid(MODERN_SCENE);
+    initOccluders();
+
+    sceneInitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    prewarmScenes();
+}
+
+// ---------------------- Benchmark ----------------------
+
+// --bench [frames]   play a scripted camera path through both scenes and print JSON stats
+// --headless         render offscreen through EGL (no window, no GPU needed with llvmpipe)
+// --size W H         render target size (default 1280x720 for benchmarks)
+// --out file.json    write the report to a file instead of stdout
+// --no-cull          disable frustum culling (for before/after comparisons)
+// --no-occlusion     disable occlusion culling behind the pyramid
+// --bake-scene [file]  write the binary scene cache (default chichen_itza.scene) and exit
+// --scene file       load the scene cache from another path
+// --no-scene-cache   always generate the scene procedurally
+// --no-shadows       skip shadow mapping; --no-shadow-cache re-renders static shadow casters every frame
+// --no-mesh-packing  upload shared meshes as float triangle lists (no welding or packing)
+// --no-mesh-optimize keep hidden faces and the generated triangle order (implies --no-scene-cache)
+// --no-state-cache   send every GL state call, redundant or not (still counted)
+// --no-render-sort   submit render queue items in emission order
+// --no-persistent-map  stream per-frame data by mapping each upload (no glBufferStorage)
+// --no-residency     no scene pre-warm and no time-sliced shadow catch-up (scene switches as before)
+// --crossfade S      scene switch cross-fade in seconds (default 0.4, 0 = cut)
+// --threads N       worker pool threads, the main thread included (default one per core)
+// --record file      log an interactive session's input, ticks and frames (written at exit)
+// --replay file      re-run a recorded session frame for frame and print JSON frame stats
+//                    (with --headless: offscreen at the recorded size; --out applies too)
+// --bench-jungle [n] time the jungle generator for about n plants (default 100000) and exit
+struct BenchConfig {
+    bool enabled = false;
+    bool headless = false;
+    int frames = 600;        // measured frames per scene
+    int warmupFrames = 30;   // not measured (first uploads, shader compiles)
+    int width = 1280;
+    int height = 720;
+    std::string outputPath;
+};
+BenchConfig bench;
+bool bakeSceneOnly = false; // --bake-scene
+int jungleBenchPlants = 0;  // --bench-jungle
+int crowdBenchAgents = 0;   // --bench-crowd
+bool recordSession = false; // --record (session.path)
+std::string replayPath;     // --replay
+
+// Generator timing only (no GL): best and mean of a few runs at the requested density
+void runJungleBenchmark(int targetPlants) {
+    JungleParams params;
+    params.minDistance = jungleSpacingForCount(params, targetPlants);
+
+    const int runs = 5;
+    JungleStats stats;
+    double best = 0.0, total = 0.0;
+    for (int run = 0; run < runs; ++run) {
+        generateJungle(params, &stats);
+        best = (run == 0) ? stats.ms : std::min(best, stats.ms);
+        total += stats.ms;
+    }
+
+    printf("{\n  \"jungle\": { \"target\": %d, \"min_distance\": %.3f, \"plants\": %d, \"trees\": %d, \"rocks\": %d, \"logs\": %d,\n",
+        targetPlants, params.minDistance, stats.plants, stats.perKind[PLANT_TREE], stats.perKind[PLANT_ROCK], stats.perKind[PLANT_LOG]);
+    printf("    \"threads\": %d, \"runs\": %d, \"best_ms\": %.3f, \"mean_ms\": %.3f }\n}\n",
+        stats.threads, runs, best, total / runs);
+}
+
+// Steps the crowd without rendering and reports the update rate
+void runCrowdBenchmark(int agents) {
+    initCrowd(agents);
+    const int warmupSteps = 60;
+    const int steps = 300;
+    for (int i = 0; i < warmupSteps; ++i) crowdStep((float)SIM_STEP);
+
+    // Visitors in a queue (initCrowd seeds them) and those who reached its head and climbed
+    auto inQueues = []() { return (int)(crowd.nextTicket[0] + crowd.nextTicket[1] + crowd.nextTicket[2] +
+        crowd.nextTicket[3] - crowd.served[0] - crowd.served[1] - crowd.served[2] - crowd.served[3]); };
+    int servedBefore = crowd.served[0] + crowd.served[1] + crowd.served[2] + crowd.served[3];
+    long long queuedSum = 0;
+
+    double hash = 0.0, steer = 0.0, integrate = 0.0, goals = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        crowdStep((float)SIM_STEP);
+        hash += crowd.hashMs;
+        steer += crowd.steerMs;
+        integrate += crowd.integrateMs;
+        goals += crowd.goalMs;
+        queuedSum += inQueues();
+    }
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    int queued = 0;
+    for (int i = 0; i < crowd.count; ++i) queued += crowd.queue[i] >= 0 ? 1 : 0;
+    int climbed = crowd.served[0] + crowd.served[1] + crowd.served[2] + crowd.served[3] - servedBefore;
+
+    printf("{\n  \"crowd\": { \"agents\": %d, \"queued\": %d, \"queued_mean\": %.1f, \"climbed\": %d, \"threads\": %d, "
+        "\"simd\": %s, \"steps\": %d,\n", agents, queued, (double)queuedSum / steps, climbed, crowd.threads,
+        CROWD_SIMD ? "true" : "false", steps);
+    printf("    \"step_ms\": %.3f, \"hash_ms\": %.3f, \"steer_ms\": %.3f, \"integrate_ms\": %.3f, \"goals_ms\": %.3f,\n",
+        total / steps, hash / steps, steer / steps, integrate / steps, goals / steps);
+    printf("    \"agents_per_ms\": %.0f }\n}\n", (double)agents * steps / total);
+}
+
+struct BenchSample {
+    double ms;
+    int drawCalls;
+    long long vertices;
+    int objectsCulled;
+    int objectsOccluded;
+    int stateIssued;
+    int stateElided;
+    int queueItems;
+    int materialSwitches;
+    int materialSwitchesSaved;
+    double overdraw;
+    long long streamBytes;
+    int streamFenceWaits;
+};
+
+std::vector<BenchSample> benchSamples[2]; // indexed by SceneType
+int benchFrame = 0;
+
+// Pacing over the measured frames only; warmup frames and the shadow and switch runs
+// after the path also go through perfBeginFrame()
+struct BenchPacing {
+    long long frames = 0;
+    int lateFrames = 0;
+    int droppedFrames = 0;
+    double worstMs = 0.0;
+};
+BenchPacing benchPacing;
+double benchStageMs[STAGE_COUNT][2]; // cpu, gpu: rolling stage timings where the path ended
+double benchMaterialMs[MAT_COUNT][2];  // and the same per material of the submit stage
+
+// Adds what perfBeginFrame() counted for the frame just drawn, given the counters from before it
+void addBenchPacing(const BenchPacing& before) {
+    if (perf.frames == before.frames) return; // first frame: no interval yet
+    benchPacing.frames += perf.frames - before.frames;
+    benchPacing.lateFrames += perf.lateFrames - before.lateFrames;
+    benchPacing.droppedFrames += perf.droppedFrames - before.droppedFrames;
+    benchPacing.worstMs = std::max(benchPacing.worstMs, perf.intervalMs);
+}
+
+// Deterministic fly-around: orbit the pyramid while moving in and out through the
+// tree ring, bobbing in height and sometimes turning away to face the jungle.
+void benchCameraAt(int frame, int frameCount) {
+    float t = (float)frame / (float)frameCount;
+    float angle = t * 2.0f * (float)M_PI;
+
+    float radius = 45.0f - 20.0f * sinf(angle * 2.0f);
+    camera.x = sinf(angle) * radius;
+    camera.z = cosf(angle) * radius;
+    camera.y = 8.0f + 10.0f * (0.5f + 0.5f * sinf(angle * 3.0f));
+
+    float yawToCenter = atan2f(-camera.x, camera.z) * 180.0f / (float)M_PI;
+    camera.yaw = yawToCenter + 60.0f * sinf(angle * 1.5f);
+    camera.pitch = atan2f(8.0f - camera.y, radius) * 180.0f / (float)M_PI;
+}
+
+struct BenchSummary {
+    double minMs = 0.0, meanMs = 0.0, p95Ms = 0.0, p99Ms = 0.0, maxMs = 0.0;
+    double drawCalls = 0.0, vertices = 0.0, objectsCulled = 0.0, objectsOccluded = 0.0; // per-frame averages
+    double stateIssued = 0.0, stateElided = 0.0;
+    double queueItems = 0.0, materialSwitches = 0.0, materialSwitchesSaved = 0.0, overdraw = 0.0;
+    double streamBytes = 0.0;
+    int streamFenceWaits = 0; // total over the run
+    int frames = 0;
+};
+
+BenchSummary summarizeSamples(const std::vector<BenchSample>& samples) {
+    BenchSummary sum;
+    sum.frames = (int)samples.size();
+    if (samples.empty()) return sum;
+
+    std::vector<double> ms;
+    for (const BenchSample& sample : samples) {
+        ms.push_back(sample.ms);
+        sum.meanMs += sample.ms;
+        sum.drawCalls += sample.drawCalls;
+        sum.vertices += (double)sample.vertices;
+        sum.objectsCulled += sample.objectsCulled;
+        sum.objectsOccluded += sample.objectsOccluded;
+        sum.stateIssued += sample.stateIssued;
+        sum.stateElided += sample.stateElided;
+        sum.queueItems += sample.queueItems;
+        sum.materialSwitches += sample.materialSwitches;
+        sum.materialSwitchesSaved += sample.materialSwitchesSaved;
+        sum.overdraw += sample.overdraw;
+        sum.streamBytes += (double)sample.streamBytes;
+        sum.streamFenceWaits += sample.streamFenceWaits;
+    }
+    std::sort(ms.begin(), ms.end());
+
+    // Nearest-rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)ceil(p * (double)ms.size());
+        return ms[rank > 0 ? rank - 1 : 0];
+        };
+
+    double n = (double)samples.size();
+    sum.minMs = ms.front();
+    sum.maxMs = ms.back();
+    sum.meanMs /= n;
+    sum.p95Ms = percentile(0.95);
+    sum.p99Ms = percentile(0.99);
+    sum.drawCalls /= n;
+    sum.vertices /= n;
+    sum.objectsCulled /= n;
+    sum.objectsOccluded /= n;
+    sum.stateIssued /= n;
+    sum.stateElided /= n;
+    sum.queueItems /= n;
+    sum.materialSwitches /= n;
+    sum.materialSwitchesSaved /= n;
+    sum.overdraw /= n;
+    sum.streamBytes /= n;
+    return sum;
+}
+
+void writeSummaryJson(FILE* out, const char* name, const BenchSummary& sum, bool last) {
+    fprintf(out,
+        "    \"%s\": { \"frames\": %d, \"min_ms\": %.3f, \"mean_ms\": %.3f, \"p95_ms\": %.3f, "
+        "\"p99_ms\": %.3f, \"max_ms\": %.3f, \"draw_calls\": %.1f, \"vertices\": %.0f, "
+        "\"objects_culled\": %.1f, \"objects_occluded\": %.1f, \"state_issued\": %.1f, \"state_elided\": %.1f, "
+        "\"queue_items\": %.1f, \"material_switches\": %.1f, \"material_switches_saved\": %.1f, \"overdraw\": %.2f, "
+        "\"stream_bytes\": %.0f, \"stream_fence_waits\": %d }%s\n",
+        name, sum.frames, sum.minMs, sum.meanMs, sum.p95Ms, sum.p99Ms, sum.maxMs,
+        sum.drawCalls, sum.vertices, sum.objectsCulled, sum.objectsOccluded, sum.stateIssued, sum.stateElided,
+        sum.queueItems, sum.materialSwitches, sum.materialSwitchesSaved, sum.overdraw, sum.streamBytes, sum.streamFenceWaits,
+        last ? "" : ",");
+}
+
+struct ShadowBenchResult {
+    int frames = 0;
+    double cachedMs = 0.0, uncachedMs = 0.0;  // per frame, GPU work included
+    int cascadesRedrawn = 0;                  // by the cached run
+};
+ShadowBenchResult shadowBench[2]; // indexed by SceneType
+
+struct SwitchBenchResult {
+    int switches = 0;
+    double medianMs = 0.0;        // frames away from a switch
+    double worstSwitchMs = 0.0;   // worst of the SWITCH_WATCH_FRAMES frames from each switch on
+    double worstOtherMs = 0.0;    // worst of the rest
+};
+SwitchBenchResult switchBench;
+
+void writeBenchReport() {
+    FILE* out = stdout;
+    if (!bench.outputPath.empty()) {
+        out = fopen(bench.outputPath.c_str(), "w");
+        if (!out) {
+            std::cerr << "Could not open " << bench.outputPath << " for writing" << std::endl;
+            out = stdout;
+        }
+    }
+
+    std::vector<BenchSample> all = benchSamples[ANCIENT_SCENE];
+    all.insert(all.end(), benchSamples[MODERN_SCENE].begin(), benchSamples[MODERN_SCENE].end());
+
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    fprintf(out, "{\n");
+    fprintf(out, "  \"renderer\": \"%s\",\n", renderer ? renderer : "unknown");
+    fprintf(out, "  \"headless\": %s,\n", headlessMode ? "true" : "false");
+    fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", windowWidth, windowHeight);
+    fprintf(out, "  \"threads\": %d,\n", workerPool().threadCount());
+    fprintf(out, "  \"startup\": { \"scene_source\": \"%s\", \"init_scene_ms\": %.3f, \"prewarm_ms\": %.3f },\n",
+        sceneLoadedFromCache ? "cache" : "generated", sceneInitMs, residency.prewarmMs);
+    fprintf(out, "  \"scenes\": {\n");
+    writeSummaryJson(out, "ancient", summarizeSamples(benchSamples[ANCIENT_SCENE]), false);
+    writeSummaryJson(out, "modern", summarizeSamples(benchSamples[MODERN_SCENE]), true);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"overall\": {\n");
+    writeSummaryJson(out, "all", summarizeSamples(all), true);
+    fprintf(out, "  },\n");
+
+    // Rolling stage timings at the end of the path (see Performance Overlay)
+    fprintf(out, "  \"stages_ms\": {\n");
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        fprintf(out, "    \"%s\": { \"cpu\": %.3f, \"gpu\": %.3f }%s\n", frameStageNames[i],
+            benchStageMs[i][0], benchStageMs[i][1], i + 1 < STAGE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    // The submit stage split by material (the emit stages before it only queue draw items)
+    fprintf(out, "  \"materials_ms\": {\n");
+    for (int i = 0; i < MAT_COUNT; ++i) {
+        fprintf(out, "    \"%s\": { \"cpu\": %.3f, \"gpu\": %.3f }%s\n", renderMaterialNames[i],
+            benchMaterialMs[i][0], benchMaterialMs[i][1], i + 1 < MAT_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    // Frame-to-frame intervals of the measured frames against a 60 Hz display (see perfBeginFrame)
+    fprintf(out, "  \"pacing\": { \"target_ms\": %.3f, \"frames\": %lld, \"late\": %d, \"dropped\": %d, "
+        "\"worst_ms\": %.3f },\n", perf.targetMs, benchPacing.frames, benchPacing.lateFrames, benchPacing.droppedFrames,
+        benchPacing.worstMs);
+
+    // Shadow pass alone, static cascades cached vs. re-rendered every frame (see runShadowBenchmark)
+    fprintf(out, "  \"shadows\": {\n");
+    for (int scene = 0; scene < 2; ++scene) {
+        const ShadowBenchResult& result = shadowBench[scene];
+        fprintf(out, "    \"%s\": { \"frames\": %d, \"cached_ms\": %.3f, \"uncached_ms\": %.3f, "
+            "\"cascades_redrawn\": %d, \"cascades_total\": %d }%s\n", scene == ANCIENT_SCENE ? "ancient" : "modern",
+            result.frames, result.cachedMs, result.uncachedMs, result.cascadesRedrawn, result.frames * SHADOW_CASCADES,
+            scene == 0 ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    // Shared meshes as float triangle lists vs. as uploaded (see uploadMesh)
+    size_t sourceTotal = 0, uploadedTotal = 0;
+    for (int id = 0; id < MESH_COUNT; ++id) {
+        sourceTotal += meshSlot(id).sourceBytes;
+        uploadedTotal += meshSlot(id).uploadedBytes;
+    }
+    fprintf(out, "  \"meshes\": { \"packed\": %s, \"bytes_before\": %zu, \"bytes_after\": %zu,\n",
+        meshPackingEnabled ? "true" : "false", sourceTotal, uploadedTotal);
+    for (int id = 0; id < MESH_COUNT; ++id) {
+        const MeshVBO& mesh = meshSlot(id);
+        fprintf(out, "    \"%s\": { \"vertices_before\": %zu, \"vertices\": %d, \"indices\": %d, \"positions\": \"%s\", "
+            "\"bytes_before\": %zu, \"bytes_after\": %zu, \"acmr_before\": %.3f, \"acmr_after\": %.3f, "
+            "\"overdraw_clusters\": %d }%s\n",
+            meshName(id).c_str(), mesh.sourceBytes / (6 * sizeof(float)), mesh.vertexCount, mesh.indexCount,
+            mesh.positionType == GL_HALF_FLOAT ? "half" : "float", mesh.sourceBytes, mesh.uploadedBytes,
+            mesh.acmrBefore, mesh.acmrAfter, mesh.overdrawClusters, id + 1 < MESH_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    // Hidden-face pass of the generator (see addVisibleBoxFaces; zero when loaded from the cache).
+    // Removed and added triangles are both listed: cutting around a covered middle can take
+    // more triangles than the face had, while the area always drops.
+    fprintf(out, "  \"hidden_faces\": { \"optimized\": %s, \"cache_size\": %d,\n", meshOptimizeEnabled ? "true" : "false",
+        VERTEX_CACHE_SIZE);
+    const HiddenFaceStats* hiddenFaces[2] = { &pyramidHiddenFaces, &stairHiddenFaces };
+    for (int i = 0; i < 2; ++i) {
+        const HiddenFaceStats& stats = *hiddenFaces[i];
+        fprintf(out, "    \"%s\": { \"triangles_before\": %d, \"triangles_after\": %d, \"faces_removed\": %d, "
+            "\"triangles_removed\": %d, \"faces_split\": %d, \"triangles_added\": %d, \"area_before\": %.1f, "
+            "\"area_after\": %.1f, \"area_removed\": %.1f }%s\n", i == 0 ? "pyramid" : "stairs",
+            stats.trianglesBefore, stats.trianglesAfter, stats.facesRemoved, 2 * stats.facesRemoved, stats.facesSplit,
+            stats.trianglesAdded, stats.areaBefore, stats.areaAfter, stats.areaBefore - stats.areaAfter, i == 0 ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    // Scene switches mid-path (see runSwitchBenchmark)
+    fprintf(out, "  \"scene_switch\": { \"resident\": %s, \"crossfade_s\": %.2f, \"switches\": %d, \"median_ms\": %.3f, "
+        "\"worst_switch_ms\": %.3f, \"worst_other_ms\": %.3f }\n}\n", residency.enabled ? "true" : "false",
+        residency.crossfadeSeconds, switchBench.switches, switchBench.medianMs, switchBench.worstSwitchMs,
+        switchBench.worstOtherMs);
+
+    if (out != stdout) fclose(out);
+}
+
+// Frame times of a replayed session (see Session Recording), laid out like the benchmark report
+void writeReplayReport() {
+    FILE* out = stdout;
+    if (!bench.outputPath.empty()) {
+        out = fopen(bench.outputPath.c_str(), "w");
+        if (!out) {
+            std::cerr << "Could not open " << bench.outputPath << " for writing" << std::endl;
+            out = stdout;
+        }
+    }
+
+    std::vector<BenchSample> all = benchSamples[ANCIENT_SCENE];
+    all.insert(all.end(), benchSamples[MODERN_SCENE].begin(), benchSamples[MODERN_SCENE].end());
+
+    const SessionHeader& header = session.header;
+    const std::vector<SessionEvent>& events = session.events;
+    double recordedSeconds = events.empty() ? 0.0 : events.back().timeNs * 1e-9;
+    bool inSync = memcmp(&camera, &header.endCamera, sizeof(Camera)) == 0;
+
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    fprintf(out, "{\n");
+    fprintf(out, "  \"renderer\": \"%s\",\n", renderer ? renderer : "unknown");
+    fprintf(out, "  \"headless\": %s,\n", headlessMode ? "true" : "false");
+    fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", windowWidth, windowHeight);
+    fprintf(out, "  \"threads\": %d,\n", workerPool().threadCount());
+    fprintf(out, "  \"replay\": { \"file\": \"%s\", \"events\": %u, \"frames\": %d, \"warmup_frames\": %d, "
+        "\"recorded_s\": %.3f, \"in_sync\": %s },\n", session.path.c_str(), header.eventCount, benchFrame,
+        std::min(bench.warmupFrames, benchFrame), recordedSeconds, inSync ? "true" : "false");
+    fprintf(out, "  \"scenes\": {\n");
+    writeSummaryJson(out, "ancient", summarizeSamples(benchSamples[ANCIENT_SCENE]), false);
+    writeSummaryJson(out, "modern", summarizeSamples(benchSamples[MODERN_SCENE]), true);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"overall\": {\n");
+    writeSummaryJson(out, "all", summarizeSamples(all), true);
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"stages_ms\": {\n");
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        fprintf(out, "    \"%s\": { \"cpu\": %.3f, \"gpu\": %.3f }%s\n", frameStageNames[i],
+            perf.stages[i].cpuMs, perf.stages[i].gpuMs, i + 1 < STAGE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"materials_ms\": {\n");
+    for (int i = 0; i < MAT_COUNT; ++i) {
+        fprintf(out, "    \"%s\": { \"cpu\": %.3f, \"gpu\": %.3f }%s\n", renderMaterialNames[i],
+            perf.materials.cpuMs[i], perf.materials.gpuMs[i], i + 1 < MAT_COUNT ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+
+    if (!inSync)
+        std::cerr << "Session: replay ended away from the recorded camera; the log no longer matches this build's simulation" << std::endl;
+    if (out != stdout) fclose(out);
+}
+
+// Times updateShadows() alone over the start of the bench path (same camera speed as the
+// measured frames), once with the static cascades cached and once re-rendering them all
+void runShadowBenchmark() {
+    if (!shadows.enabled) return;
+    const int perScene = bench.warmupFrames + bench.frames;
+    const int frames = std::min(perScene, 120);
+    bool cacheSetting = shadows.cacheEnabled;
+
+    for (int scene = 0; scene < 2; ++scene) {
+        ShadowBenchResult& result = shadowBench[scene];
+        result = ShadowBenchResult();
+        result.frames = frames;
+        for (int pass = 0; pass < 2; ++pass) {
+            shadows.cacheEnabled = (pass == 0);
+            invalidateShadowCaches();
+            double total = 0.0;
+            for (int frame = 0; frame < frames; ++frame) {
+                benchCameraAt(frame, perScene);
+                frameStats = FrameStats();
+                streamBeginFrame(); // the casters are streamed like a real frame's
+                glFinish();
+                auto start = std::chrono::steady_clock::now();
+                updateShadows((SceneType)scene);
+                glFinish();
+                total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (pass == 0) result.cascadesRedrawn += frameStats.shadowCascadesRendered;
+            }
+            (pass == 0 ? result.cachedMs : result.uncachedMs) = total / frames;
+        }
+    }
+    shadows.cacheEnabled = cacheSetting;
+}
+
+// Flies part of the bench path at the default run's pace (whatever --bench says), switching
+// scenes every SWITCH_BENCH_SEGMENT frames the way SPACE does (switch at the end of a frame,
+// cross-fade included), and compares the frames from each switch on with the rest. The
+// first segment only warms up.
+const int SWITCH_BENCH_SEGMENT = 40;
+const int SWITCH_BENCH_SWITCHES = 4;
+const int SWITCH_BENCH_PATH_FRAMES = 630;
+
+void runSwitchBenchmark() {
+    std::vector<double> around, other;
+    int sinceSwitch = SWITCH_WATCH_FRAMES;
+    currentScene = ANCIENT_SCENE;
+
+    for (int frame = 0; frame < SWITCH_BENCH_SEGMENT * (SWITCH_BENCH_SWITCHES + 1); ++frame) {
+        if (frame > 0 && frame % SWITCH_BENCH_SEGMENT == 0) {
+            requestSceneSwitch();
+            sinceSwitch = 0;
+        }
+        benchCameraAt(SWITCH_BENCH_PATH_FRAMES / 2 + frame, SWITCH_BENCH_PATH_FRAMES);
+        simSyncCamera();
+        simAdvanceFixed();
+
+        auto start = std::chrono::steady_clock::now();
+        displayCallback();
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (sinceSwitch < SWITCH_WATCH_FRAMES && frame >= SWITCH_BENCH_SEGMENT) around.push_back(ms);
+        else if (frame >= SWITCH_BENCH_SEGMENT) other.push_back(ms);
+        ++sinceSwitch;
+    }
+
+    switchBench = SwitchBenchResult();
+    switchBench.switches = SWITCH_BENCH_SWITCHES;
+    if (!other.empty()) {
+        std::sort(other.begin(), other.end());
+        switchBench.medianMs = other[other.size() / 2];
+        switchBench.worstOtherMs = other.back();
+    }
+    for (double ms : around) switchBench.worstSwitchMs = std::max(switchBench.worstSwitchMs, ms);
+}
+
+// Renders one scripted frame; returns true once both scenes have been measured
+bool runBenchmarkFrame() {
+    int perScene = bench.warmupFrames + bench.frames;
+    if (benchFrame >= 2 * perScene) return true;
+
+    SceneType scene = (benchFrame < perScene) ? ANCIENT_SCENE : MODERN_SCENE;
+    int sceneFrame = benchFrame % perScene;
+
+    currentScene = scene;
+    benchCameraAt(sceneFrame, perScene);
+    simSyncCamera();
+    simAdvanceFixed();
+
+    BenchPacing pacingBefore = { perf.frames, perf.lateFrames, perf.droppedFrames, perf.worstMs };
+    auto start = std::chrono::steady_clock::now();
+    displayCallback();
+    glFinish(); // include GPU (or llvmpipe) work in the frame time
+    auto end = std::chrono::steady_clock::now();
+
+    if (sceneFrame >= bench.warmupFrames) {
+        addBenchPacing(pacingBefore);
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        benchSamples[scene].push_back({ ms, frameStats.drawCalls, frameStats.vertices, frameStats.objectsCulled,
+            frameStats.objectsOccluded, frameStats.stateIssued, frameStats.stateElided, frameStats.queueItems,
+            frameStats.materialSwitches, frameStats.materialSwitchesSaved, frameStats.overdraw, frameStats.streamBytes,
+            frameStats.streamFenceWaits });
+    }
+
+    ++benchFrame;
+    if (benchFrame < 2 * perScene) return false;
+
+    // The runs below draw frames of their own (the switch run 200 full ones); they must
+    // not show up in the path's stage timings or pacing
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        benchStageMs[i][0] = perf.stages[i].cpuMs;
+        benchStageMs[i][1] = perf.stages[i].gpuMs;
+    }
+    for (int i = 0; i < MAT_COUNT; ++i) {
+        benchMaterialMs[i][0] = perf.materials.cpuMs[i];
+        benchMaterialMs[i][1] = perf.materials.gpuMs[i];
+    }
+    runShadowBenchmark();
+    runSwitchBenchmark();
+    writeBenchReport();
+    return true;
+}
+
+// Feeds the recording through the callbacks up to and including its next frame, which is
+// timed like a benchmark frame; returns true once the last frame has been shown
+bool runReplayFrame() {
+    std::vector<SessionEvent>& events = session.events;
+    while (session.next < events.size()) {
+        const SessionEvent& event = events[session.next++];
+        switch (event.type) {
+        case EVENT_KEY_DOWN:     keyboardCallback(event.code, event.x, event.y); break;
+        case EVENT_KEY_UP:       keyboardUpCallback(event.code, event.x, event.y); break;
+        case EVENT_SPECIAL_DOWN: specialCallback(event.code, event.x, event.y); break;
+        case EVENT_SPECIAL_UP:   specialUpCallback(event.code, event.x, event.y); break;
+        case EVENT_MOUSE:        mouseCallback(event.code, event.state, event.x, event.y); break;
+        case EVENT_MOTION:       motionCallback(event.x, event.y); break;
+        case EVENT_TICK:         simAdvance(sessionTime(event)); break;
+        case EVENT_RESHAPE:
+            // The offscreen target keeps the size of the first frame
+            if (!headlessMode) glutReshapeWindow(event.x, event.y);
+            break;
+        case EVENT_FRAME: {
+            int frame = benchFrame++;
+            SceneType scene = currentScene;
+            frameTime = sessionTime(event);
+
+            auto start = std::chrono::steady_clock::now();
+            displayCallback();
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+
+            if (frame >= bench.warmupFrames) {
+                double ms = std::chrono::duration<double, std::milli>(end - start).count();
+                benchSamples[scene].push_back({ ms, frameStats.drawCalls, frameStats.vertices, frameStats.objectsCulled,
+                    frameStats.objectsOccluded, frameStats.stateIssued, frameStats.stateElided, frameStats.queueItems,
+                    frameStats.materialSwitches, frameStats.materialSwitchesSaved, frameStats.overdraw,
+                    frameStats.streamBytes, frameStats.streamFenceWaits });
+            }
+            return false;
+        }
+        }
+    }
+    writeReplayReport();
+    return true;
+}
+
+void replayIdleCallback() {
+    if (runReplayFrame()) exit(0);
+}
+
+void benchIdleCallback() {
+    if (runBenchmarkFrame()) exit(0);
+}
+
+#if HAVE_EGL_HEADLESS
+GLuint offscreenFbo = 0;
+
+// Surfaceless EGL context with a desktop GL compatibility profile (fixed function is still used)
+bool createHeadlessContext() {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        std::cerr << "EGL: no display available" << std::endl;
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL: desktop OpenGL not supported" << std::endl;
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cerr << "EGL: could not create a surfaceless context (0x"
+            << std::hex << eglGetError() << std::dec << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Color + depth renderbuffers standing in for the window's back buffer
+void createOffscreenTarget(int w, int h) {
+    GLuint color = 0, depth = 0;
+    glGenFramebuffers(1, &offscreenFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+}
+#endif
+
+void parseCommandLine(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--bench") {
+            bench.enabled = true;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                bench.frames = atoi(argv[++i]);
+        }
+        else if (arg == "--headless") {
+            bench.enabled = true;
+            bench.headless = true;
+        }
+        else if (arg == "--size" && i + 2 < argc) {
+            bench.width = std::max(1, atoi(argv[++i]));
+            bench.height = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--out" && i + 1 < argc) {
+            bench.outputPath = argv[++i];
+        }
+        else if (arg == "--no-vsync") {
+            frameLoop.vsync = false;
+        }
+        else if (arg == "--no-cull") {
+            cullingEnabled = false;
+        }
+        else if (arg == "--no-occlusion") {
+            occlusionEnabled = false;
+        }
+        else if (arg == "--bake-scene") {
+            bakeSceneOnly = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                sceneCachePath = argv[++i];
+        }
+        else if (arg == "--scene" && i + 1 < argc) {
+            sceneCachePath = argv[++i];
+        }
+        else if (arg == "--no-scene-cache") {
+            sceneCacheEnabled = false;
+        }
+        else if (arg == "--no-shadows") {
+            shadows.enabled = false;
+        }
+        else if (arg == "--no-shadow-cache") {
+            shadows.cacheEnabled = false;
+        }
+        else if (arg == "--no-mesh-packing") {
+            meshPackingEnabled = false;
+        }
+        else if (arg == "--no-state-cache") {
+            glState.enabled = false;
+        }
+        else if (arg == "--no-render-sort") {
+            renderQueue.sorted = false;
+        }
+        else if (arg == "--no-persistent-map") {
+            streamRing.persistentEnabled = false;
+        }
+        else if (arg == "--no-mesh-optimize") {
+            meshOptimizeEnabled = false;
+            sceneCacheEnabled = false; // the cache holds optimized meshes
+        }
+        else if (arg == "--no-residency") {
+            residency.enabled = false;
+            shadows.staleRedrawBudget = SHADOW_CASCADES;
+        }
+        else if (arg == "--crossfade" && i + 1 < argc) {
+            residency.crossfadeSeconds = std::max(0.0f, (float)atof(argv[++i]));
+        }
+        else if (arg == "--clouds" && i + 1 < argc) {
+            cloudClusterCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--crowd" && i + 1 < argc) {
+            crowdAgentCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            workerThreadLimit = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            session.path = argv[++i];
+            recordSession = true;
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--bench-crowd") {
+            crowdBenchAgents = 50000;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                crowdBenchAgents = atoi(argv[++i]);
+        }
+        else if (arg == "--bench-jungle") {
+            jungleBenchPlants = 100000;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                jungleBenchPlants = atoi(argv[++i]);
+        }
+    }
 }
 
 // ---------------------- main ----------------------
 
 int main(int argc, char** argv) {
+    parseCommandLine(argc, argv);
+    if (bakeSceneOnly)
+        return writeSceneCache(sceneCachePath) ? 0 : 1;
+    if (jungleBenchPlants > 0) {
+        runJungleBenchmark(jungleBenchPlants);
+        return 0;
+    }
+    if (crowdBenchAgents > 0) {
+        runCrowdBenchmark(crowdBenchAgents);
+        return 0;
+    }
+    if (!replayPath.empty()) {
+        if (!loadSessionReplay(replayPath)) return 1;
+        bench.width = session.header.width;
+        bench.height = session.header.height;
+    }
+    perf.forceTiming = bench.enabled || session.replaying;
+
+    if (bench.headless) {
+#if HAVE_EGL_HEADLESS
+        if (!createHeadlessContext()) return 1;
+        headlessMode = true;
+
+        initGL();
+        createOffscreenTarget(bench.width, bench.height);
+        initScene();
+        reshapeCallback(bench.width, bench.height);
+
+        if (session.replaying) {
+            applySessionStart();
+            simSyncCamera();
+            while (!runReplayFrame()) {}
+            return 0;
+        }
+        while (!runBenchmarkFrame()) {}
+        return 0;
+#else
+        std::cerr << "Headless mode needs EGL; running the benchmark in a window instead" << std::endl;
+#endif
+    }
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-    glutInitWindowSize(1980, 1080);
+    if (bench.enabled || session.replaying) glutInitWindowSize(bench.width, bench.height);
+    else               glutInitWindowSize(1980, 1080);
     glutCreateWindow("Chichen Itza Through Time");
 
     initGL();
@@ -1172,11 +7756,33 @@ int main(int argc, char** argv) {
 
     glutDisplayFunc(displayCallback);
     glutReshapeFunc(reshapeCallback);
+    glutIgnoreKeyRepeat(1);
+    if (session.replaying) {
+        // The recording drives the camera; live input would break the replay
+        applySessionStart();
+        simSyncCamera();
+        setSwapInterval(0);
+        glutIdleFunc(replayIdleCallback);
+        glutMainLoop();
+        return 0;
+    }
     glutKeyboardFunc(keyboardCallback);
+    glutKeyboardUpFunc(keyboardUpCallback);
     glutSpecialFunc(specialCallback);
+    glutSpecialUpFunc(specialUpCallback);
     glutMouseFunc(mouseCallback);
     glutMotionFunc(motionCallback);
-    glutTimerFunc(16, timerCallback, 0);
+
+    if (bench.enabled) {
+        setSwapInterval(0); // measure render time, not the refresh rate
+        glutIdleFunc(benchIdleCallback);
+    }
+    else {
+        setSwapInterval(frameLoop.vsync ? 1 : 0);
+        simSyncCamera();
+        if (recordSession) startSessionRecording();
+        glutIdleFunc(frameIdleCallback);
+    }
 
     glutMainLoop();
     return 0;